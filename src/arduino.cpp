@@ -4,50 +4,63 @@
 
 #if defined(ARDUINO_ARCH_AVR)
 
-constexpr void fastDigitalWrite(const uint8_t pin, const uint8_t val) {
-    if(val) {
-        if(pin > 13) {
-            PORTC |= (1 << (pin - 13));
-        } else if(pin < 8) {
-            PORTD | = (1 << pin);
-        } else {
-            PORTB |= (1 << (pin -8 ));
-        }
-    } else {
-        if(pin > 13) {
-            PORTC &= ~(1 << (pin - 13));
-        } else if(pin < 8) {
-            PORTD & = ~(1 << pin);
+static_assert(sizeof(SID_CS) == decltype(sidArray)::NUM_SIDS, "SID_CS pin table does not match the number of SIDs");
+
+// the pin map as port masks, in flash
+static constexpr SIDBusMap<NUM_SID_AX, NUM_SID_DX, NUM_SIDS> busMap ARDUINOSID_PROGMEM(SID_AX, SID_DX, SID_CS);
+
+class AVRPorts {
+public:
+    static inline uint8_t read(const uint8_t port) {
+        return port == SID_BUS_PORT_B ? PORTB : port == SID_BUS_PORT_C ? PORTC : PORTD;
+    }
+
+    static inline void write(const uint8_t port, const uint8_t val) {
+        if(port == SID_BUS_PORT_B) {
+            PORTB = val;
+        } else if(port == SID_BUS_PORT_C) {
+            PORTC = val;
         } else {
-            PORTB &= ~(1 << (pin -8 ));
+            PORTD = val;
         }
     }
-}
+};
 
 void writeRegister(const uint8_t sid, const uint8_t reg, const uint8_t val) {
     // TODO: somehow wait for last write to be done
 
-    // reset chip select lines
-    for(uint8_t i = 0; i < SIDArray::MAX_NUM_SIDS; i++) {
-        fastDigitalWrite(SID_CS[i], HIGH);
-    }
+    AVRPorts ports;
 
-    // set address lines
-    for(uint8_t i = 0, ax = reg; i < NUM_SID_AX; i++, ax >>= 1) {
-        fastDigitalWrite(SID_AX[i], (ax & 1) ? HIGH : LOW);
-    }
+    // deselect all chips and set address and data lines, then pull chip select line for given SID
+    sidBusWrite(ports, busMap, sid, reg, val);
 
-    // set data lines
-    for(uint8_t i = 0, dx = val; i < NUM_SID_DX; i++, dx >>= 1) {
-        fastDigitalWrite(SID_DX[i], (dx & 1) ? HIGH : LOW);
-    }
+    // TODO: somehow signal everything is ready to write
+}
 
-    // pull chip select line for given SID
-    digitalWrite(SID_CS[sid], LOW);
+// write the same register of several SIDs in one bus cycle, one bit per SID
+void writeRegisters(const uint8_t chips, const uint8_t reg, const uint8_t val) {
+    AVRPorts ports;
 
-    // TODO: somehow signal everything is ready to write
+    sidBusWriteChips(ports, busMap, chips, reg, val);
 }
 
+// register sink writing straight to the bus, for sketches which do not drain a queue from the timer ISR
+
+class BusSink {
+public:
+    inline bool write(const uint8_t sid, const uint8_t reg, const uint8_t val) {
+        writeRegister(sid, reg, val);
+
+        return true;
+    }
+
+    inline bool writeMulticast(const uint8_t chips, const uint8_t reg, const uint8_t val) {
+        writeRegisters(chips, reg, val);
+
+        return true;
+    }
+};
+
 void setup_board() {
     // set up pins as digital output
 
@@ -65,7 +78,7 @@ void setup_board() {
     pinMode(SID_PHI_2, OUTPUT);
 
     // chip select lines
-    for(uint8_t i = 0; i < SIDArray::MAX_NUM_SIDS; i++) {
+    for(uint8_t i = 0; i < NUM_SIDS; i++) {
         pinMode(SID_CS[i], OUTPUT);
     }
 
@@ -78,8 +91,29 @@ void setup_board() {
     ...
 }
 
+// set by the timer interrupt, the main loop then flushes the changed registers into the write queue
+volatile bool timerTick = false;
+
+ISR(TIMER0_COMPA_vect) {
+    std::tuple<uint8_t, uint8_t, uint8_t> write;
+
+    const bool popped = registerQueue.pop(write);
+
+    if(popped) {
+        writeRegisters(std::get<0>(write), std::get<1>(write), std::get<2>(write));
+    }
+
+    sidArray.drained(popped);
+
+    timerTick = true;
+}
+
 void loop_board() {
+    if(timerTick) {
+        timerTick = false;
 
+        sidArray.flush();
+    }
 }
 
 #endif
@@ -69,7 +69,7 @@ static const uint8_t SID_A4 = A4;
 
 static const uint8_t NUM_SID_AX = 5;
 
-static const std::array<uint8_t, NUM_SID_AX> SID_AX = { SID_A0, SID_A1, SID_A2, SID_A3, SID_A4 };
+static constexpr std::array<uint8_t, NUM_SID_AX> SID_AX = { SID_A0, SID_A1, SID_A2, SID_A3, SID_A4 };
 
 static const uint8_t SID_D0 = 2;
 static const uint8_t SID_D1 = 3;
@@ -82,10 +82,16 @@ static const uint8_t SID_D7 = 10;
 
 static const uint8_t NUM_SID_DX = 8;
 
-static const std::array<uint8_t, NUM_SID_DX> SID_DX = { SID_D0, SID_D1, SID_D2, SID_D3, SID_D4, SID_D5, SID_D6, SID_D7 };
+static constexpr std::array<uint8_t, NUM_SID_DX> SID_DX = { SID_D0, SID_D1, SID_D2, SID_D3, SID_D4, SID_D5, SID_D6, SID_D7 };
 
 static const uint8_t SID_PHI_2 = 6;
 
-static const std::array<uint8_t, SIDArray::MAX_NUM_SIDS> SID_CS = { A5, 11, 12, 13 };
+// number of SIDs populated on this board, one chip select line each
+
+static const uint8_t NUM_SIDS = 4;
+
+static constexpr uint8_t SID_CS[] = { A5, 11, 12, 13 };
+
+static_assert(sizeof(SID_CS) == NUM_SIDS, "SID_CS needs one chip select pin per SID");
 
 #endif //ARDUINOSID_ARDUINO_H
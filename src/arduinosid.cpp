@@ -4,9 +4,17 @@
 
 #include "arduinosid.h"
 #include "sid.h"
+#include "sinks.h"
+#include "midi.h"
+#include "bus.h"
 
-SIDArray sidArray(true);
-auto &ringBuffer = sidArray.getRingBuffer();
+typedef PriorityRingBufferSink<registerQueueSize(NUM_SIDS), NUM_SIDS> QueueSink;
+
+SIDArray<NUM_SIDS, QueueSink> sidArray(true);
+auto &registerQueue = sidArray.getSink();
+
+SIDMIDIHandler<NUM_SIDS, QueueSink> midiHandler(sidArray);
+MIDIParser<SIDMIDIHandler<NUM_SIDS, QueueSink>> midiParser(midiHandler);
 
 #if defifed(ARDUINO_ARCH_AVR)
 #include "arduino.cpp"
@@ -16,10 +24,15 @@ auto &ringBuffer = sidArray.getRingBuffer();
 #error uknown driver board
 #endif
 
-setup() {
+void setup() {
+    Serial.begin(31250);
     setup_board();
 }
 
-loop() {
+void loop() {
+    while(Serial.available() > 0) {
+        midiParser.parse((uint8_t) Serial.read());
+    }
+
     loop_board();
 }
\ No newline at end of file
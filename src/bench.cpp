@@ -0,0 +1,1392 @@
+#include "sid.h"
+#include "sinks.h"
+#include "sidemu.h"
+#include "trace.h"
+#include "lfo.h"
+#include "freq.h"
+#include "voices.h"
+#include "midi.h"
+#include "schedule.h"
+#include "patch.h"
+#include "render.h"
+#include "resample.h"
+#include "smooth.h"
+#include "modmatrix.h"
+#include "bus.h"
+#include "arduino.h"
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+
+// the float prototypes are the reference for the LFO engine
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#pragma GCC diagnostic ignored "-Wreturn-type"
+#define main lfo_main
+#include "lfo.c"
+#undef main
+#pragma GCC diagnostic pop
+#include <iostream>
+#include <string>
+
+// host benchmarks, build with e.g. g++ -std=c++17 -O2 -pthread -o bench bench.cpp
+//
+// usage: bench [--json] [trace [midi]]
+//
+// The draining path is benchmarked against the given trace or a recorded modulation loop, the MIDI parser against
+// the given raw MIDI byte stream or a generated one.
+//
+// With --json the results are written to stdout as one JSON document, {"results": [{"name", "value", "unit"}]},
+// for comparing runs in CI; the readable output then goes to stderr.
+
+// collects the results of all benchmarks
+class BenchReport {
+private:
+    struct Result {
+        std::string name;
+        double value;
+        std::string unit;
+    };
+
+    std::vector<Result> results;
+
+    static void quoted(std::ostream &out, const std::string &s) {
+        out << '"';
+
+        for(const char c : s) {
+            if(c == '"' || c == '\\') {
+                out << '\\';
+            }
+
+            out << c;
+        }
+
+        out << '"';
+    }
+
+public:
+    bool json = false;
+
+    // stream for the readable output
+    std::ostream &text() {
+        return json ? std::cerr : std::cout;
+    }
+
+    void add(const std::string &name, const double value, const char *unit) {
+        results.push_back({ name, value, unit });
+    }
+
+    void writeJSON(std::ostream &out) const {
+        out << "{\n  \"results\": [";
+
+        for(size_t i = 0; i < results.size(); i++) {
+            out << (i ? ",\n    " : "\n    ") << "{\"name\": ";
+            quoted(out, results[i].name);
+            out << ", \"value\": " << results[i].value << ", \"unit\": ";
+            quoted(out, results[i].unit);
+            out << "}";
+        }
+
+        out << "\n  ]\n}\n";
+    }
+};
+
+static BenchReport report;
+
+// sink which just folds all writes into a checksum, so the compiler cannot drop them
+class ChecksumSink {
+public:
+    uint32_t sum = 0;
+
+    inline bool write(const uint8_t sid, const uint8_t reg, const uint8_t val) {
+        sum = sum * 31 + ((uint32_t) sid << 16 | (uint32_t) reg << 8 | val);
+
+        return true;
+    }
+};
+
+template <typename F>
+double nsPerOp(const uint32_t ops, F f) {
+    auto start = std::chrono::steady_clock::now();
+
+    f();
+
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::nano>(end - start).count() / ops;
+}
+
+// a mix of setters as a modulation loop would call them, 8 setter calls per iteration
+template <typename S>
+void setterWorkload(S &sid, const uint32_t iterations) {
+    for(uint32_t i = 0; i < iterations; i++) {
+        auto voice = sid.getVoice(i % 3);
+
+        voice.setFQ((uint16_t) (i * 7));
+        voice.setPW((uint16_t) (i * 13));
+        voice.setGate(i & 1);
+        voice.setAttack(i & 0x0f);
+        sid.getFilter().setFilterFQ((uint16_t) (i * 3));
+        sid.getFilter().setFilterRes((uint8_t) i);
+    }
+}
+
+void benchSetters() {
+    const uint32_t iterations = 10000000;
+    const uint32_t ops = iterations * 8;
+    uint32_t sum = 0;
+
+    double callbackNs = nsPerOp(ops, [&]() {
+        CallbackSink sink([&sum](const uint8_t sid, const uint8_t reg, const uint8_t val) {
+            sum = sum * 31 + ((uint32_t) sid << 16 | (uint32_t) reg << 8 | val);
+        });
+        SID<CallbackSink> sid(sink, 0);
+
+        setterWorkload(sid, iterations);
+    });
+
+    double policyNs = nsPerOp(ops, [&]() {
+        ChecksumSink sink;
+        SID<ChecksumSink> sid(sink, 0);
+
+        setterWorkload(sid, iterations);
+        sum += sink.sum;
+    });
+
+    double shadowNs = nsPerOp(ops, [&]() {
+        static SIDArray<1, ChecksumSink> sidArray;
+
+        setterWorkload(sidArray.getSID(0), iterations);
+        sidArray.flush();
+        sum += sidArray.getSink().sum;
+    });
+
+    report.add("setter.callback", callbackNs, "ns/call");
+    report.add("setter.policy", policyNs, "ns/call");
+    report.add("setter.shadow", shadowNs, "ns/call");
+
+    report.text() << "setter, std::function callback: " << callbackNs << " ns/call\n";
+    report.text() << "setter, inlined sink policy:    " << policyNs << " ns/call\n";
+    report.text() << "setter, SIDArray shadow file:   " << shadowNs << " ns/call\n";
+    report.text() << "(checksum " << sum << ")\n";
+}
+
+// one setter on its own, straight into a sink and into the shadow register file of a SIDArray, which only
+// writes what has changed when flushed once per 1000 calls
+template <typename F>
+void benchSetter(const char *name, F f) {
+    const uint32_t iterations = 10000000;
+    static SIDArray<1, ChecksumSink> sidArray;
+    ChecksumSink sink;
+    SID<ChecksumSink> sid(sink, 0);
+
+    double directNs = nsPerOp(iterations, [&]() {
+        for(uint32_t i = 0; i < iterations; i++) {
+            f(sid, i);
+        }
+    });
+
+    double shadowNs = nsPerOp(iterations, [&]() {
+        for(uint32_t i = 0; i < iterations; i++) {
+            f(sidArray.getSID(0), i);
+
+            if(i % 1000 == 999) {
+                sidArray.flush();
+            }
+        }
+    });
+
+    report.add(std::string("setter.") + name + ".policy", directNs, "ns/call");
+    report.add(std::string("setter.") + name + ".shadow", shadowNs, "ns/call");
+
+    report.text() << "setter " << name << ": " << directNs << " ns/call into the sink, " << shadowNs
+                  << " ns/call into SIDArray (checksum " << sink.sum + sidArray.getSink().sum << ")\n";
+}
+
+void benchSetterKinds() {
+    benchSetter("setFQ", [](auto &sid, const uint32_t i) { sid.getVoice(i % 3).setFQ((uint16_t) (i * 7)); });
+    benchSetter("setPW", [](auto &sid, const uint32_t i) { sid.getVoice(i % 3).setPW((uint16_t) (i * 13)); });
+    benchSetter("setGate", [](auto &sid, const uint32_t i) { sid.getVoice(i % 3).setGate(i & 4); });
+    benchSetter("setWave", [](auto &sid, const uint32_t i) { sid.getVoice(i % 3).setWave(0x10 << (i & 3)); });
+    benchSetter("setAttack", [](auto &sid, const uint32_t i) { sid.getVoice(i % 3).setAttack(i & 0x0f); });
+    benchSetter("setFilterFQ", [](auto &sid, const uint32_t i) { sid.getFilter().setFilterFQ((uint16_t) (i * 3)); });
+    benchSetter("setFilterRes", [](auto &sid, const uint32_t i) { sid.getFilter().setFilterRes((uint8_t) i); });
+    benchSetter("setVolume", [](auto &sid, const uint32_t i) { sid.getFilter().setVolume(i & 0x0f); });
+}
+
+// put/pop pairs on a register queue held at a fill level, as the main loop and the ISR see it under load
+template <typename Put, typename Pop>
+double ringBufferPutPop(const size_t fill, const uint32_t ops, Put put, Pop pop) {
+    for(size_t i = 0; i < fill; i++) {
+        put(std::make_tuple((uint8_t) 0, (uint8_t) i, (uint8_t) i));
+    }
+
+    double ns = nsPerOp(ops, [&]() {
+        for(uint32_t i = 0; i < ops; i++) {
+            put(std::make_tuple((uint8_t) (i % 6), (uint8_t) (i % 25), (uint8_t) i));
+            pop();
+        }
+    });
+
+    for(size_t i = 0; i < fill; i++) {
+        pop();
+    }
+
+    return ns;
+}
+
+void benchRingBuffer() {
+    typedef std::tuple<uint8_t, uint8_t, uint8_t> Write;
+    const uint32_t ops = 20000000;
+    static const uint8_t levels[3] = { 0, 50, 90 };
+    static SPSCRingBuffer<Write, 256> spsc;
+    static RingBuffer<Write, 256> legacy;
+    uint32_t sum = 0;
+
+    for(const uint8_t level : levels) {
+        const size_t fill = spsc.capacity() * level / 100;
+        Write write;
+
+        double spscNs = ringBufferPutPop(fill, ops, [&](const Write &w) { spsc.put(w); }, [&]() {
+            spsc.pop(write);
+            sum += std::get<2>(write);
+        });
+
+        double legacyNs = ringBufferPutPop(fill, ops, [&](const Write &w) { legacy.put(w); }, [&]() {
+            sum += std::get<2>(legacy.pop_head());
+        });
+
+        report.add("ringbuffer.spsc.fill" + std::to_string(level), spscNs, "ns/op");
+        report.add("ringbuffer.legacy.fill" + std::to_string(level), legacyNs, "ns/op");
+
+        report.text() << "ring buffer put+pop at " << (int) level << "% fill: SPSCRingBuffer " << spscNs
+                      << " ns, RingBuffer " << legacyNs << " ns\n";
+    }
+
+    report.text() << "(checksum " << sum << ")\n";
+}
+
+// the waveform and phasor kernels of lfo.c one by one, against the table lookup of the LFO engine
+void benchLFOKernels() {
+    const uint32_t calls = 10000000;
+    float sum = 0;
+    int32_t fixedSum = 0;
+
+    auto kernel = [&](const char *name, auto f) {
+        double ns = nsPerOp(calls, [&]() {
+            for(uint32_t i = 0; i < calls; i++) {
+                sum += f(i);
+            }
+        });
+
+        report.add(std::string("lfo.kernel.") + name, ns, "ns/call");
+        report.text() << "lfo.c " << name << ": " << ns << " ns/call\n";
+    };
+
+    kernel("phasor", [](const uint32_t i) { return phasor(3.7, 0.25, (long) i); });
+    kernel("sine", [](const uint32_t i) { return sine((i & 0xffff) / 65536.0f); });
+    kernel("triangle", [](const uint32_t i) { return triangle((i & 0xffff) / 65536.0f); });
+    kernel("saw_up", [](const uint32_t i) { return saw_up((i & 0xffff) / 65536.0f); });
+    kernel("saw_down", [](const uint32_t i) { return saw_down((i & 0xffff) / 65536.0f); });
+    kernel("rectangle", [](const uint32_t i) { return rectangle((i & 0xffff) / 65536.0f, 0.3f); });
+
+    static const char *names[5] = { "sine", "triangle", "saw_up", "saw_down", "rectangle" };
+
+    for(uint8_t shape = LFO_SINE; shape <= LFO_RECTANGLE; shape++) {
+        double ns = nsPerOp(calls, [&]() {
+            for(uint32_t i = 0; i < calls; i++) {
+                fixedSum += LFOTables::lookup((LFOShape) shape, i * 0x9e3779b9U);
+            }
+        });
+
+        report.add(std::string("lfo.lookup.") + names[shape], ns, "ns/call");
+        report.text() << "LFOTables::lookup " << names[shape] << ": " << ns << " ns/call\n";
+    }
+
+    report.text() << "(checksum " << sum << " " << fixedSum << ")\n";
+}
+
+// pitch conversions: the float helpers of Frequency against the FQ tables
+void benchFrequency() {
+    const uint32_t calls = 10000000;
+    float sum = 0;
+    uint32_t fqSum = 0;
+
+    double halftonesNs = nsPerOp(calls, [&]() {
+        for(uint32_t i = 0; i < calls; i++) {
+            sum += Frequency::addHalftones(440.0f, (int) (i % 49) - 24);
+        }
+    });
+
+    double centsNs = nsPerOp(calls, [&]() {
+        for(uint32_t i = 0; i < calls; i++) {
+            sum += Frequency::addCents(440.0f, (int) (i % 401) - 200);
+        }
+    });
+
+    double hzNs = nsPerOp(calls, [&]() {
+        for(uint32_t i = 0; i < calls; i++) {
+            fqSum += Frequency::hzToFQ(Frequency::noteToHz(i % 96, (double) (i % 100)), Frequency::PAL_CLOCK);
+        }
+    });
+
+    double tableNs = nsPerOp(calls, [&]() {
+        for(uint32_t i = 0; i < calls; i++) {
+            fqSum += noteToFQ(i % 96, (int16_t) (i % 401) - 200, i & 1);
+        }
+    });
+
+    report.add("freq.addHalftones", halftonesNs, "ns/call");
+    report.add("freq.addCents", centsNs, "ns/call");
+    report.add("freq.noteToHz.hzToFQ", hzNs, "ns/call");
+    report.add("freq.noteToFQ", tableNs, "ns/call");
+
+    report.text() << "Frequency::addHalftones: " << halftonesNs << " ns/call, addCents: " << centsNs << " ns/call\n";
+    report.text() << "note to FQ, noteToHz + hzToFQ: " << hzNs << " ns/call, tables: " << tableNs << " ns/call\n";
+    report.text() << "(checksum " << sum << " " << fqSum << ")\n";
+}
+
+// the whole way of a register write on the host: setter, shadow register file, flush into the register queue
+// of the sketch and the ISR's bus writes on simulated ports; per write which reaches the bus
+void benchArrayToBus() {
+    typedef PriorityRingBufferSink<registerQueueSize(NUM_SIDS), NUM_SIDS> QueueSink;
+
+    static constexpr SIDBusMap<NUM_SID_AX, NUM_SID_DX, NUM_SIDS> map(SID_AX, SID_DX, SID_CS);
+    static SIDArray<NUM_SIDS, QueueSink> sidArray;
+    SimulatedPorts ports;
+    const uint32_t ticks = 200000;
+    uint32_t written = 0;
+
+    double ns = nsPerOp(1, [&]() {
+        std::tuple<uint8_t, uint8_t, uint8_t> write;
+
+        for(uint32_t t = 0; t < ticks; t++) {
+            // a sweep on every chip and a gate on one voice per tick
+            for(uint8_t sid = 0; sid < NUM_SIDS; sid++) {
+                sidArray.getSID(sid).getFilter().setFilterFQ((uint16_t) (t * 97 + sid * 1000));
+                sidArray.getSID(sid).getVoice(t % 3).setPW((uint16_t) (t * 31 + sid * 77));
+            }
+
+            sidArray.getSID(t % NUM_SIDS).getVoice(t / NUM_SIDS % 3).setGate(t / (NUM_SIDS * 3) & 1);
+
+            sidArray.flush();
+
+            while(sidArray.getSink().pop(write)) {
+                sidBusWriteChips(ports, map, std::get<0>(write), std::get<1>(write), std::get<2>(write));
+                written++;
+            }
+        }
+    });
+
+    report.add("array.write_to_bus", ns / written, "ns/write");
+    report.add("array.writes_per_tick", (double) written / ticks, "writes");
+
+    report.text() << "SIDArray<" << (int) NUM_SIDS << "> setters to simulated bus: " << ns / written << " ns/bus write, "
+                  << (double) written / ticks << " bus writes per tick (" << ports.writes << " port writes)\n";
+}
+
+// all 18 voices of 6 chips playing, half of them through the filter
+template <typename Emulator>
+void setupEmulatorWorkload(Emulator &emu) {
+    static const uint8_t waves[4] = { 0x11, 0x21, 0x41, 0x81 };
+
+    for(uint8_t sid = 0; sid < Emulator::NUM_SIDS; sid++) {
+        for(uint8_t voice = 0; voice < SIDLayout::NUM_VOICES; voice++) {
+            const uint8_t base = voice * SIDLayout::NUM_VOICE_REGS;
+
+            emu.write(sid, base + SIDVoiceLayout::SIDRegFQLo, 0x40 + sid * 16 + voice);
+            emu.write(sid, base + SIDVoiceLayout::SIDRegFQHi, 0x10 + sid * 4 + voice * 3);
+            emu.write(sid, base + SIDVoiceLayout::SIDRegPWHi, 0x08);
+            emu.write(sid, base + SIDVoiceLayout::SIDRegAD, 0x22);
+            emu.write(sid, base + SIDVoiceLayout::SIDRegSR, 0xa4);
+            emu.write(sid, base + SIDVoiceLayout::SIDRegWvCtl, waves[(sid + voice) & 3]);
+        }
+
+        emu.write(sid, SIDFilterLayout::SIDRegFCHi, 0x40);
+        emu.write(sid, SIDFilterLayout::SIDRegResFilt, 0x85);
+        emu.write(sid, SIDFilterLayout::SIDRegModVol, 0x1f);
+    }
+}
+
+// renders the same workload through every kernel the cpu supports; all of them must match the scalar output
+void benchEmulator() {
+    const uint32_t sampleRate = 44100;
+    const uint32_t seconds = 20;
+    static const char *names[3] = { "scalar", "sse2", "avx2" };
+    static int16_t reference[sampleRate];
+    static int16_t buffer[sampleRate];
+
+    for(uint8_t k = SID_KERNEL_SCALAR; k <= SID_KERNEL_AVX2; k++) {
+        if(!sidKernelSupported((SIDKernel) k)) {
+            report.text() << "emulator, " << names[k] << " kernel: not supported\n";
+            continue;
+        }
+
+        SIDEmulator<6> emu(SIDEmulation::PAL_CLOCK, sampleRate);
+        emu.setKernel((SIDKernel) k);
+        setupEmulatorWorkload(emu);
+
+        double ns = nsPerOp(seconds, [&]() {
+            for(uint32_t i = 0; i < seconds; i++) {
+                emu.render(sampleRate, buffer);
+
+                if(k == SID_KERNEL_SCALAR) {
+                    memcpy(reference, buffer, sizeof(buffer));
+                }
+            }
+        });
+
+        // the reference holds the last second of the scalar run
+        const bool identical = memcmp(reference, buffer, sizeof(buffer)) == 0;
+
+        report.add(std::string("emulator.") + names[k] + ".realtime", 1e9 / ns, "x");
+        report.add(std::string("emulator.") + names[k] + ".identical", identical, "bool");
+
+        report.text() << "emulator, " << names[k] << " kernel, 6 chips at " << sampleRate << " Hz: "
+                      << 1e9 / ns << "x real time, "
+                      << 6 * SIDLayout::NUM_VOICES * sampleRate * (1e9 / ns) / 1e6 << "M voice samples/s, "
+                      << (identical ? "bit identical" : "MISMATCH") << "\n";
+    }
+}
+
+// records one second of a modulation loop on 6 chips, flushed once per millisecond as the timer ISR would
+void recordTrace(const char *path) {
+    std::ofstream out(path, std::ios::binary);
+    SIDArray<6, TraceRecorder<ChecksumSink>> sidArray(false, out, SIDEmulation::PAL_CLOCK);
+
+    for(uint32_t tick = 0; tick < 1000; tick++) {
+        for(uint8_t sid = 0; sid < 6; sid++) {
+            setterWorkload(sidArray.getSID(sid), 4);
+        }
+
+        sidArray.flush();
+        sidArray.getSink().tick(SIDEmulation::PAL_CLOCK / 1000);
+    }
+}
+
+// replays a trace into the shadow register file, flushing and draining the register queue whenever the
+// timestamp changes
+void benchTraceDrain(const char *path) {
+    TraceReplayer replayer(path);
+
+    if(!replayer.isOpen()) {
+        report.text() << "trace " << path << ": cannot open\n";
+        return;
+    }
+
+    static SIDArray<6, RingBufferSink<registerQueueSize(6)>> sidArray;
+    auto &buffer = sidArray.getSink().getBuffer();
+    const uint32_t passes = 100;
+    size_t records = 0;
+    size_t drained = 0;
+
+    double ns = nsPerOp(1, [&]() {
+        for(uint32_t pass = 0; pass < passes; pass++) {
+            uint64_t ticks, last = 0;
+            uint8_t sid, reg, val;
+            std::tuple<uint8_t, uint8_t, uint8_t> write;
+
+            replayer.rewind();
+
+            while(replayer.next(ticks, sid, reg, val)) {
+                if(ticks != last) {
+                    sidArray.flush();
+
+                    while(buffer.pop(write)) {
+                        drained++;
+                    }
+
+                    last = ticks;
+                }
+
+                sidArray.getSID(sid % 6).setRegister(reg, val);
+                records++;
+            }
+        }
+    });
+
+    report.add("trace.drain", ns / records, "ns/write");
+    report.add("trace.queued", (double) drained / records * 100, "%");
+
+    report.text() << "trace " << path << ", replayed through SIDArray<6>: " << ns / records << " ns/write, "
+                  << (double) drained / records * 100 << "% of writes reached the queue\n";
+}
+
+// 64 LFOs at a 1 kHz control rate, fixed point engine against the float prototypes of lfo.c
+void benchLFO() {
+    const uint8_t numLFOs = 64;
+    const uint32_t ticks = 100000;
+    static LFOEngine<numLFOs> engine(1000);
+    int32_t sum = 0;
+    float floatSum = 0;
+
+    for(uint8_t i = 0; i < numLFOs; i++) {
+        engine.setRate(i, 100 + i * 250);
+        engine.setShift(i, i * 1024);
+        engine.setShape(i, (LFOShape) (i % 5));
+    }
+
+    double fixedNs = nsPerOp(ticks * numLFOs, [&]() {
+        for(uint32_t t = 0; t < ticks; t++) {
+            engine.tick();
+            sum += engine.getValue(t % numLFOs);
+        }
+    });
+
+    double floatNs = nsPerOp(ticks * numLFOs, [&]() {
+        for(long t = 0; t < (long) ticks; t++) {
+            for(uint8_t i = 0; i < numLFOs; i++) {
+                const float phase = phasor(0.1 + i * 0.25, i / 64.0, t);
+
+                switch(i % 5) {
+                    case LFO_SINE: floatSum += sine(phase); break;
+                    case LFO_TRIANGLE: floatSum += triangle(phase); break;
+                    case LFO_SAW_UP: floatSum += saw_up(phase); break;
+                    case LFO_SAW_DOWN: floatSum += saw_down(phase); break;
+                    default: floatSum += rectangle(phase, 0.5);
+                }
+            }
+        }
+    });
+
+    report.add("lfo.engine.fixed", fixedNs, "ns/tick");
+    report.add("lfo.engine.float", floatNs, "ns/tick");
+
+    report.text() << "LFO, fixed point engine:  " << fixedNs << " ns/LFO tick\n";
+    report.text() << "LFO, lfo.c float:         " << floatNs << " ns/LFO tick\n";
+    report.text() << "(checksum " << sum << " " << floatSum << ")\n";
+
+    // error of a 3.7 Hz LFO in Q15 steps, against lfo.c in the first minute, and against an exact reference for
+    // both after running for a day, where the float phasor has lost its precision
+    static const char *names[4] = { "sine", "triangle", "saw_up", "saw_down" };
+    static const long starts[2] = { 0, 86400000L };
+
+    for(uint8_t shape = LFO_SINE; shape <= LFO_SAW_DOWN; shape++) {
+        auto wave = [shape](const double phase) {
+            return shape == LFO_SINE ? sine(phase) :
+                   shape == LFO_TRIANGLE ? triangle(phase) :
+                   shape == LFO_SAW_UP ? saw_up(phase) : saw_down(phase);
+        };
+
+        report.text() << "LFO accuracy, " << names[shape] << ":";
+
+        for(long start : starts) {
+            LFOEngine<1> lfo(1000);
+            double fixedError = 0;
+            double floatError = 0;
+
+            lfo.setRate(0, 3700);
+            lfo.setShape(0, (LFOShape) shape);
+            lfo.getLFO(0).phase = (uint32_t) ((((uint64_t) start * 3700 % 1000000) << 32) / 1000000);
+
+            for(long t = start; t < start + 60000; t++) {
+                const double exact = start ? wave((double) (t * 3700 % 1000000) / 1000000) : wave(phasor(3.7, 0, t));
+                const double prototype = wave(phasor(3.7, 0, t));
+
+                lfo.tick();
+
+                // ignore the saw jump, where a sample in either cycle is right
+                const double error = fabs(lfo.getValue(0) - exact * LFOTables::MAX);
+
+                if(error < LFOTables::MAX) {
+                    fixedError = std::max(fixedError, error);
+                }
+
+                if(fabs(prototype - exact) < 1) {
+                    floatError = std::max(floatError, fabs(prototype - exact) * LFOTables::MAX);
+                }
+            }
+
+            const std::string name = std::string("lfo.accuracy.") + names[shape] + (start ? ".day" : ".minute");
+
+            report.add(name, fixedError, "q15");
+            report.add(name + ".float", floatError, "q15");
+
+            if(start) {
+                report.text() << ", after a day " << fixedError << " (lfo.c " << floatError << ")";
+            } else {
+                report.text() << " max error " << fixedError << " in the first minute";
+            }
+        }
+
+        report.text() << "\n";
+    }
+}
+
+// 10k notes per second for 10 seconds on 18 voices, each held for 20 to 520 ms, driving a SIDArray with the
+// frequency tables; the register writes are flushed once per millisecond
+void benchVoiceAllocator() {
+    const uint32_t notesPerTick = 10;
+    const uint32_t ticks = 10000;
+    static VoiceAllocator<6> voices(STEAL_OLDEST);
+    static SIDArray<6, ChecksumSink> sidArray;
+
+    // note offs scheduled per tick, in a ring of 512 ticks
+    static uint8_t offs[512][notesPerTick];
+    uint32_t seed = 1;
+    uint32_t steals = 0;
+
+    memset(offs, voices.NONE, sizeof(offs));
+
+    double ns = nsPerOp(ticks * notesPerTick, [&]() {
+        for(uint32_t t = 0; t < ticks; t++) {
+            uint8_t (&due)[notesPerTick] = offs[t % 512];
+
+            for(uint32_t i = 0; i < notesPerTick; i++) {
+                if(due[i] != voices.NONE) {
+                    const uint8_t v = voices.noteOff(due[i]);
+
+                    if(v != voices.NONE) {
+                        sidArray.getSID(voices.getSIDNo(v)).getVoice(voices.getVoiceNo(v)).setGate(false);
+                    }
+
+                    due[i] = voices.NONE;
+                }
+
+                seed = seed * 1103515245 + 12345;
+
+                const uint8_t note = 36 + (seed >> 16) % 60;
+                bool stolen;
+                const uint8_t v = voices.noteOn(note, (seed >> 8) % 7 == 6 ? voices.NONE : (seed >> 8) % 6, &stolen);
+                auto voice = sidArray.getSID(voices.getSIDNo(v)).getVoice(voices.getVoiceNo(v));
+
+                voice.setFQ(noteToFQ(note));
+                voice.setGate(true);
+                steals += stolen;
+
+                // held for 20 to 520 ms, rounded to whole ticks
+                offs[(t + 20 + (seed >> 4) % 500) % 512][i] = note;
+            }
+
+            sidArray.flush();
+        }
+    });
+
+    report.add("voices.note", ns, "ns/note");
+
+    report.text() << "voice allocator, note on/off with setters: " << ns << " ns/note, "
+                  << 1e9 / ns / 1e6 << "M notes/s, " << steals << " steals (checksum " << sidArray.getSink().sum << ")\n";
+}
+
+// a MIDI stream as a keyboard player with a sequencer would send it: chords with running status, pitch bend and
+// controller sweeps, interleaved clocks and the odd SysEx
+std::vector<uint8_t> generateMIDI(const size_t events) {
+    std::vector<uint8_t> bytes;
+    uint32_t seed = 7;
+
+    for(size_t i = 0; i < events; i++) {
+        seed = seed * 1103515245 + 12345;
+
+        const uint8_t channel = (seed >> 8) % 8;
+        const uint8_t note = 36 + (seed >> 16) % 48;
+
+        switch((seed >> 24) % 16) {
+            case 0:
+                bytes.insert(bytes.end(), { (uint8_t) (0xe0 | channel), (uint8_t) (seed & 0x7f), (uint8_t) ((seed >> 4) & 0x7f) });
+                break;
+
+            case 1:
+                bytes.insert(bytes.end(), { (uint8_t) (0xb0 | channel), 74, (uint8_t) (seed & 0x7f), 1, (uint8_t) ((seed >> 4) & 0x7f) });
+                break;
+
+            case 2:
+                bytes.insert(bytes.end(), { 0xf0, 0x7d, 0x01, 0x02, 0x03, 0xf7 });
+                break;
+
+            case 3:
+                bytes.push_back(0xf8);
+                break;
+
+            default:
+                // note on, note off as note on with velocity 0 under running status
+                bytes.insert(bytes.end(), { (uint8_t) (0x90 | channel), note, 100, (uint8_t) (note + 4), 0, note, 0 });
+                break;
+        }
+    }
+
+    return bytes;
+}
+
+// notes the time the first gate on write reaches the sink
+class LatencySink {
+public:
+    std::chrono::steady_clock::time_point gateTime;
+    bool gated = false;
+    uint32_t sum = 0;
+
+    inline bool write(const uint8_t sid, const uint8_t reg, const uint8_t val) {
+        if(!gated && reg % SIDLayout::NUM_VOICE_REGS == SIDVoiceLayout::SIDRegWvCtl && reg < SIDFilterLayout::SIDRegFCLo &&
+           (val & SIDVoiceLayout::SIDCtlGat)) {
+            gateTime = std::chrono::steady_clock::now();
+            gated = true;
+        }
+
+        sum += val;
+
+        return true;
+    }
+};
+
+// parse throughput into the SID voice layer, flushing once per 1 ms tick worth of bytes at MIDI speed (31250
+// baud, 3 bytes per ms rounded down), and the time from feeding a note on to its gate reaching the sink
+void benchMIDI(const std::vector<uint8_t> &bytes) {
+    typedef SIDMIDIHandler<6, LatencySink> Synth;
+
+    static SIDArray<6, LatencySink> sidArray;
+    static Synth synth(sidArray);
+    MIDIParser<Synth> parser(synth);
+    const uint32_t passes = 20;
+
+    double ns = nsPerOp(bytes.size() * passes, [&]() {
+        for(uint32_t pass = 0; pass < passes; pass++) {
+            for(size_t i = 0; i < bytes.size(); i++) {
+                parser.parse(bytes[i]);
+
+                if(i % 3 == 2) {
+                    sidArray.flush();
+                }
+            }
+        }
+    });
+
+    report.add("midi.parse", ns, "ns/byte");
+
+    report.text() << "MIDI parser into SIDArray<6>: " << ns << " ns/byte, " << 1e3 / ns << " MB/s, "
+                  << 1e9 / ns / 3125 << "x MIDI wire speed (checksum " << sidArray.getSink().sum << ")\n";
+
+    // latency of single note ons, with the notes in the stream released in between
+    std::vector<double> latencies;
+    auto &sink = sidArray.getSink();
+
+    for(uint32_t i = 0; i < 100000; i++) {
+        const uint8_t note = 36 + i % 48;
+        const uint8_t on[3] = { 0x90, note, 100 };
+        const uint8_t off[3] = { 0x80, note, 0 };
+
+        sink.gated = false;
+
+        auto start = std::chrono::steady_clock::now();
+
+        parser.parse(on, 3);
+        sidArray.flush();
+
+        latencies.push_back(std::chrono::duration<double, std::nano>(sink.gateTime - start).count());
+
+        parser.parse(off, 3);
+        sidArray.flush();
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+
+    report.add("midi.latency.p50", latencies[latencies.size() / 2], "ns");
+    report.add("midi.latency.p99", latencies[latencies.size() * 99 / 100], "ns");
+
+    report.text() << "MIDI note on to gate write: p50 " << latencies[latencies.size() / 2]
+                  << " ns, p99 " << latencies[latencies.size() * 99 / 100]
+                  << " ns, max " << latencies.back() << " ns, plus up to one tick until the flush\n";
+}
+
+// simulated gate to bus latency in bus cycles: every 1 ms control tick sweeps the filter and pulse widths of
+// all 6 chips and gates a few voices, the bus then drains a fixed number of writes per tick, slightly fewer than
+// the sweep produces, so the queue stays under load
+template <typename Sink>
+void simulateGateLatency(const char *name, const char *key) {
+    static SIDArray<6, Sink> sidArray;
+    const uint32_t ticks = 20000;
+    const uint32_t busCyclesPerTick = 24;
+
+    // bus cycle at which a gate change was requested, per voice, 0 if none is pending
+    uint64_t requested[6][3] = {};
+    bool gates[6][3] = {};
+    uint64_t cycle = 1;
+    uint32_t seed = 3;
+    std::vector<uint64_t> latencies;
+
+    for(uint32_t t = 0; t < ticks; t++) {
+        for(uint8_t sid = 0; sid < 6; sid++) {
+            sidArray.getSID(sid).getFilter().setFilterFQ((uint16_t) (t * 97 + sid * 1000));
+
+            for(uint8_t v = 0; v < 3; v++) {
+                sidArray.getSID(sid).getVoice(v).setPW((uint16_t) (t * 31 + v * 500 + sid * 77));
+            }
+        }
+
+        for(uint8_t i = 0; i < 2; i++) {
+            seed = seed * 1103515245 + 12345;
+
+            const uint8_t sid = (seed >> 16) % 6;
+            const uint8_t v = (seed >> 8) % 3;
+
+            if(!requested[sid][v]) {
+                gates[sid][v] = !gates[sid][v];
+                sidArray.getSID(sid).getVoice(v).setGate(gates[sid][v]);
+                requested[sid][v] = cycle;
+            }
+        }
+
+        sidArray.flush();
+
+        std::tuple<uint8_t, uint8_t, uint8_t> write;
+
+        for(uint32_t i = 0; i < busCyclesPerTick && sidArray.getSink().pop(write); i++, cycle++) {
+            const uint8_t chips = std::get<0>(write);
+            const uint8_t reg = std::get<1>(write);
+
+            if(reg >= SIDFilterLayout::SIDRegFCLo || reg % SIDLayout::NUM_VOICE_REGS != SIDVoiceLayout::SIDRegWvCtl) {
+                continue;
+            }
+
+            for(uint8_t sid = 0; sid < 6; sid++) {
+                uint64_t &r = requested[sid][reg / SIDLayout::NUM_VOICE_REGS];
+
+                if((chips & (1 << sid)) && r && (std::get<2>(write) & SIDVoiceLayout::SIDCtlGat) == gates[sid][reg / SIDLayout::NUM_VOICE_REGS]) {
+                    latencies.push_back(cycle - r);
+                    r = 0;
+                }
+            }
+        }
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+
+    report.add(std::string("gate.") + key + ".p50", latencies[latencies.size() / 2], "bus cycles");
+    report.add(std::string("gate.") + key + ".p99", latencies[latencies.size() * 99 / 100], "bus cycles");
+    report.add(std::string("gate.") + key + ".max", latencies.back(), "bus cycles");
+
+    report.text() << "gate to bus latency, " << name << ": p50 " << latencies[latencies.size() / 2]
+                  << ", p90 " << latencies[latencies.size() * 9 / 10]
+                  << ", p99 " << latencies[latencies.size() * 99 / 100]
+                  << ", max " << latencies.back() << " bus cycles (" << latencies.size() << " gates)\n";
+}
+
+void benchGateLatency() {
+    simulateGateLatency<MulticastRingBufferSink<registerQueueSize(6)>>("single FIFO", "fifo");
+    simulateGateLatency<PriorityRingBufferSink<registerQueueSize(6)>>("priority lanes", "lanes");
+}
+
+// scheduler: fill the pool with writes due 1 to 10000 ticks ahead, then run the ticks until all are released
+void benchScheduler() {
+    static WriteScheduler<ChecksumSink, 254> scheduler;
+    const uint32_t rounds = 1000;
+    const uint32_t horizon = 10000;
+    uint32_t seed = 11;
+    uint32_t inserted = 0;
+    uint32_t released = 0;
+    double insertNs = 0;
+    double tickNs = 0;
+
+    for(uint32_t round = 0; round < rounds; round++) {
+        insertNs += nsPerOp(1, [&]() {
+            for(uint8_t i = 0; i < 254; i++) {
+                seed = seed * 1103515245 + 12345;
+                inserted += scheduler.scheduleIn(1 + (seed >> 8) % horizon, i % 6, i % 25, (uint8_t) seed);
+            }
+        });
+
+        tickNs += nsPerOp(1, [&]() {
+            for(uint32_t t = 0; t <= horizon; t++) {
+                released += scheduler.tick();
+            }
+        });
+    }
+
+    report.add("scheduler.insert", insertNs / inserted, "ns/insert");
+    report.add("scheduler.tick", tickNs / (rounds * (horizon + 1)), "ns/tick");
+
+    report.text() << "scheduler: " << insertNs / inserted << " ns/insert, " << tickNs / (rounds * (horizon + 1))
+                  << " ns/tick, " << tickNs / released << " ns of ticking per released write including cascades"
+                  << " (checksum " << scheduler.getSink().sum << ")\n";
+}
+
+// program change: decode a patch and load it into 1 or all 6 chips of a SIDArray, alternating between two
+// patches which differ in about half of their registers, then flush; per program change
+template <uint8_t N>
+void benchProgramChange() {
+    static SIDArray<N, ChecksumSink> sidArray;
+    uint8_t data[2][PatchFormat::SIZE];
+    const uint32_t changes = 1000000;
+    uint32_t written = 0;
+
+    for(uint8_t p = 0; p < 2; p++) {
+        SIDPatch patch;
+
+        for(uint8_t reg = 0; reg < SIDLayout::NUM_WO_REGS; reg++) {
+            patch.regs[reg] = (uint8_t) (reg & 1 ? reg * 17 + p : reg * 17);
+        }
+
+        patch.lfos[0] = { PATCH_MOD_PW, LFO_SINE, (uint16_t) (1000 + p), 0x2000 };
+        PatchFormat::encode(patch, data[p]);
+    }
+
+    double ns = nsPerOp(changes, [&]() {
+        SIDPatch patch;
+
+        for(uint32_t i = 0; i < changes; i++) {
+            PatchFormat::decode(data[i & 1], patch);
+            written += loadPatch(sidArray, patch);
+            sidArray.flush();
+        }
+    });
+
+    const std::string key = "patch.program_change_" + std::to_string(N);
+
+    report.add(key, ns, "ns/change");
+    report.add(key + "_writes", (double) written / changes, "writes");
+
+    report.text() << "program change on " << (int) N << " SID" << (N > 1 ? "s" : "") << ": " << ns
+                  << " ns/change including decode and flush, " << (double) written / changes << " register writes"
+                  << " (checksum " << sidArray.getSink().sum << ")\n";
+}
+
+void benchPatch() {
+    uint8_t data[PatchFormat::SIZE];
+    SIDPatch patch;
+    const uint32_t decodes = 10000000;
+    uint32_t sum = 0;
+
+    PatchFormat::encode(patch, data);
+
+    double ns = nsPerOp(decodes, [&]() {
+        for(uint32_t i = 0; i < decodes; i++) {
+            data[4] = (uint8_t) i;
+            PatchFormat::decode(data, patch);
+            sum += patch.regs[SIDVoiceLayout::SIDRegWvCtl];
+        }
+    });
+
+    report.add("patch.decode", ns, "ns/decode");
+    report.text() << "patch decode: " << ns << " ns/decode (checksum " << sum << ")\n";
+
+    benchProgramChange<1>();
+    benchProgramChange<6>();
+}
+
+// offline renderer: the emulator workload with a filter sweep on every chip at 100 Hz, 20 seconds rendered on
+// 1 to 6 worker threads; the speedup is against 1 thread and is bounded by the cores there are
+void benchRenderer() {
+    const uint32_t sampleRate = 44100;
+    const uint64_t frames = 20 * sampleRate;
+    static OfflineRenderer<6> renderer(SIDEmulation::PAL_CLOCK, sampleRate);
+    double single = 0;
+
+    setupEmulatorWorkload(renderer);
+
+    for(uint64_t frame = 0; frame < frames; frame += sampleRate / 100) {
+        renderer.setTime(frame);
+
+        for(uint8_t sid = 0; sid < 6; sid++) {
+            renderer.write(sid, SIDFilterLayout::SIDRegFCHi, (uint8_t) (frame / 441 * 3 + sid * 40));
+        }
+    }
+
+    for(uint8_t threads = 1; threads <= 6; threads++) {
+        int64_t sum = 0;
+
+        double ns = nsPerOp(1, [&]() {
+            renderer.render(frames, threads, [&](const int16_t *samples, const size_t n) {
+                for(size_t i = 0; i < n; i++) {
+                    sum += samples[i];
+                }
+            });
+        });
+
+        const double realtime = (double) frames / sampleRate * 1e9 / ns;
+
+        if(threads == 1) {
+            single = realtime;
+        }
+
+        const std::string key = "render.threads_" + std::to_string(threads);
+
+        report.add(key + ".realtime", realtime, "x");
+        report.add(key + ".speedup", realtime / single, "x");
+
+        report.text() << "offline renderer, 6 chips on " << (int) threads << " thread" << (threads > 1 ? "s" : "")
+                      << ": " << realtime << "x real time, " << realtime / single << "x of 1 thread"
+                      << " (" << std::thread::hardware_concurrency() << " cores, checksum " << sum << ")\n";
+    }
+}
+
+// resampler: output samples per second from one second of noise at the PAL clock for every kernel and target
+// rate, and the worst passband deviation and stopband gain of each quality, measured with sines
+void benchResampler() {
+    static const char *kernels[3] = { "scalar", "sse2", "avx2" };
+    static const char *qualities[3] = { "fast", "good", "best" };
+    static const uint32_t rates[3] = { 44100, 48000, 96000 };
+    const uint32_t clock = Frequency::PAL_CLOCK;
+    std::vector<int16_t> in(clock);
+    uint32_t seed = 1;
+
+    for(int16_t &x : in) {
+        seed = seed * 1103515245 + 12345;
+        x = (int16_t) (seed >> 16);
+    }
+
+    for(uint32_t rate : rates) {
+        for(uint8_t k = SID_KERNEL_SCALAR; k <= SID_KERNEL_AVX2; k++) {
+            SIDResampler resampler(clock, rate, RESAMPLE_GOOD);
+
+            if(!resampler.setKernel((SIDKernel) k)) {
+                continue;
+            }
+
+            std::vector<int16_t> out(resampler.maxOutput(in.size()));
+            size_t written = 0;
+
+            double ns = nsPerOp(1, [&]() {
+                written = resampler.process(in.data(), in.size(), out.data());
+            });
+
+            const std::string key = "resampler." + std::to_string(rate) + "." + kernels[k];
+
+            report.add(key + ".samples", written * 1e9 / ns / 1e6, "M samples/s");
+            report.add(key + ".realtime", 1e9 / ns, "x");
+
+            report.text() << "resampler, PAL to " << rate << " Hz, " << kernels[k] << ", " << resampler.getBank().taps
+                          << " taps: " << written * 1e9 / ns / 1e6 << "M output samples/s, " << clock * 1e9 / ns / 1e6
+                          << "M input samples/s, " << 1e9 / ns << "x real time per chip\n";
+        }
+    }
+
+    for(uint8_t q = RESAMPLE_FAST; q <= RESAMPLE_BEST; q++) {
+        const ResamplerBank &bank = *ResamplerBank::get(clock, 44100, (ResamplerQuality) q);
+        double passband = 0;
+        double stopband = -1000;
+
+        for(double hz = 100; hz <= bank.passband; hz += 1990) {
+            const double gain = SIDResampler::measureGain(clock, 44100, (ResamplerQuality) q, hz);
+
+            passband = fabs(gain) > passband ? fabs(gain) : passband;
+        }
+
+        for(double hz = bank.stopband; hz < clock / 2; hz *= 1.25) {
+            const double gain = SIDResampler::measureGain(clock, 44100, (ResamplerQuality) q, hz);
+
+            stopband = gain > stopband ? gain : stopband;
+        }
+
+        const std::string key = std::string("resampler.") + qualities[q];
+
+        report.add(key + ".passband_error", passband, "dB");
+        report.add(key + ".stopband", stopband, "dB");
+
+        report.text() << "resampler, " << qualities[q] << " quality, PAL to 44100 Hz: " << bank.taps << " taps, "
+                      << bank.taps / 2 * 1000.0 / clock << " ms latency, passband error " << passband
+                      << " dB up to " << bank.passband << " Hz, stopband " << stopband << " dB from "
+                      << bank.stopband << " Hz\n";
+    }
+}
+
+// smoothing: a tick with all 42 parameters of 6 chips gliding, the pitches exponentially and pulse widths and
+// cut-offs linearly, retargeted every 128 ticks so none ever rests; the same with slow cut-off sweeps that only
+// write every few ticks; an idle tick; and, for reference, gliding all of them in float and setting each one on
+// every tick
+void benchSmoothing() {
+    typedef SmoothingEngine<6> Engine;
+    const uint32_t ticks = 128 * 1000;
+    static SIDArray<6, ChecksumSink> sidArray;
+    static Engine engine;
+    uint32_t written = 0;
+
+    auto retarget = [&](const uint32_t t, const uint32_t cutoffTicks) {
+        const bool up = !(t / 128 & 1);
+
+        for(uint8_t sid = 0; sid < 6; sid++) {
+            for(uint8_t v = 0; v < 3; v++) {
+                engine.rampExponential(Engine::fqParam(sid, v), up ? 0x4000 + v : 0x1000 + v, Engine::centsRatio(20));
+                engine.rampLinear(Engine::pwParam(sid, v), up ? 0xf000 : 0x1000, Engine::linearRate(0xe000, 128));
+            }
+
+            engine.rampLinear(Engine::cutoffParam(sid), up ? 0xffe0 : 0, Engine::linearRate(0xffe0, cutoffTicks));
+        }
+    };
+
+    double busyNs = nsPerOp(ticks, [&]() {
+        for(uint32_t t = 0; t < ticks; t++) {
+            if(t % 128 == 0) {
+                retarget(t, 128);
+            }
+
+            written += engine.tick(sidArray);
+        }
+    });
+
+    const double busyWrites = (double) written / ticks;
+
+    written = 0;
+
+    double slowNs = nsPerOp(ticks, [&]() {
+        for(uint32_t t = 0; t < ticks; t++) {
+            if(t % 128 == 0) {
+                retarget(t, 128 * 64);
+            }
+
+            written += engine.tick(sidArray);
+        }
+    });
+
+    const double slowWrites = (double) written / ticks;
+
+    // let everything come to rest
+    while(engine.getActive()) {
+        engine.tick(sidArray);
+    }
+
+    double idleNs = nsPerOp(ticks, [&]() {
+        for(uint32_t t = 0; t < ticks; t++) {
+            written += engine.tick(sidArray);
+        }
+    });
+
+    float values[Engine::NUM_PARAMS];
+    float factors[Engine::NUM_PARAMS];
+
+    double floatNs = nsPerOp(ticks, [&]() {
+        for(uint32_t t = 0; t < ticks; t++) {
+            if(t % 128 == 0) {
+                for(uint8_t i = 0; i < Engine::NUM_PARAMS; i++) {
+                    values[i] = t / 128 & 1 ? 0xf000 : 0x1000;
+                    factors[i] = t / 128 & 1 ? 0.98f : 1.02f;
+                }
+            }
+
+            for(uint8_t sid = 0; sid < 6; sid++) {
+                auto &s = sidArray.getSID(sid);
+                float *value = values + sid * Engine::PARAMS_PER_SID;
+                float *factor = factors + sid * Engine::PARAMS_PER_SID;
+
+                for(uint8_t i = 0; i < Engine::PARAMS_PER_SID; i++) {
+                    value[i] = std::min(std::max(value[i] * factor[i], 4096.0f), 61440.0f);
+                }
+
+                for(uint8_t v = 0; v < 3; v++) {
+                    s.getVoice(v).setFQ((uint16_t) value[v]);
+                    s.getVoice(v).setPW((uint16_t) value[3 + v]);
+                }
+
+                s.getFilter().setFilterFQ((uint16_t) value[6]);
+            }
+        }
+    });
+
+    sidArray.flush();
+
+    report.add("smoothing.tick.42", busyNs, "ns/tick");
+    report.add("smoothing.tick.42.writes", busyWrites, "writes/tick");
+    report.add("smoothing.tick.slow_cutoff", slowNs, "ns/tick");
+    report.add("smoothing.tick.idle", idleNs, "ns/tick");
+    report.add("smoothing.tick.float", floatNs, "ns/tick");
+
+    report.text() << "smoothing, 42 parameters of 6 chips gliding: " << busyNs << " ns/tick, " << busyNs / 42
+                  << " ns/parameter, " << busyWrites << " parameters written/tick\n";
+    report.text() << "smoothing, with 64 times slower cut-off sweeps: " << slowNs << " ns/tick, " << slowWrites
+                  << " parameters written/tick\n";
+    report.text() << "smoothing, idle: " << idleNs << " ns/tick; float glides setting every parameter: " << floatNs
+                  << " ns/tick (checksum " << sidArray.getSink().sum << ")\n";
+}
+
+// mod matrix: 64 slots from 16 sources to the 48 destinations of 6 chips, a tick with all, 4, 1 or none of the
+// sources moving, against evaluating all slots and setting all destinations on every tick
+void benchModMatrix() {
+    typedef ModMatrix<6, 64, 16> Matrix;
+    const uint32_t ticks = 100000;
+    static SIDArray<6, ChecksumSink> sidArray;
+    static Matrix matrix;
+    static const uint8_t moving[4] = { 16, 4, 1, 0 };
+
+    for(uint8_t slot = 0; slot < Matrix::NUM_SLOTS; slot++) {
+        matrix.setSlot(slot, slot % Matrix::NUM_SOURCES, slot % Matrix::NUM_DESTS, (int16_t) (0x0800 + slot * 0x80));
+    }
+
+    for(uint8_t dest = 0; dest < Matrix::NUM_DESTS; dest++) {
+        matrix.setBase(dest, 0x8000);
+    }
+
+    matrix.tick(sidArray);
+
+    for(uint8_t n : moving) {
+        uint32_t written = 0;
+
+        double ns = nsPerOp(ticks, [&]() {
+            for(uint32_t t = 0; t < ticks; t++) {
+                for(uint8_t source = 0; source < n; source++) {
+                    matrix.setSource(source, (int16_t) (t * (source + 1) * 97));
+                }
+
+                written += matrix.tick(sidArray);
+            }
+        });
+
+        // 4 slots per source
+        const uint32_t slots = n * Matrix::NUM_SLOTS / Matrix::NUM_SOURCES;
+        const std::string key = "modmatrix.sources." + std::to_string(n);
+
+        report.add(key, ns, "ns/tick");
+
+        report.text() << "mod matrix, 64 slots, " << (int) n << " of 16 sources moving: " << ns << " ns/tick";
+
+        if(slots) {
+            report.text() << ", " << ns / slots << " ns/active slot, " << (double) written / ticks
+                          << " destinations written/tick";
+        }
+
+        report.text() << "\n";
+    }
+
+    // the same slots in full every tick
+    int16_t values[Matrix::NUM_SOURCES] = {};
+    int32_t sums[Matrix::NUM_DESTS];
+
+    double fullNs = nsPerOp(ticks, [&]() {
+        for(uint32_t t = 0; t < ticks; t++) {
+            for(uint8_t source = 0; source < Matrix::NUM_SOURCES; source++) {
+                values[source] = (int16_t) (t * (source + 1) * 97);
+            }
+
+            for(uint8_t dest = 0; dest < Matrix::NUM_DESTS; dest++) {
+                sums[dest] = 0x8000;
+            }
+
+            for(uint8_t slot = 0; slot < Matrix::NUM_SLOTS; slot++) {
+                sums[slot % Matrix::NUM_DESTS] += (values[slot % Matrix::NUM_SOURCES] * (0x0800 + slot * 0x80)) >> 15;
+            }
+
+            for(uint8_t sid = 0; sid < 6; sid++) {
+                auto &s = sidArray.getSID(sid);
+                const int32_t *sum = sums + sid * Matrix::DESTS_PER_SID;
+                auto clamp = [](const int32_t x) {
+                    return (uint16_t) (x < 0 ? 0 : x > 0xffff ? 0xffff : x);
+                };
+
+                for(uint8_t v = 0; v < 3; v++) {
+                    s.getVoice(v).setFQ(clamp(sum[v]));
+                    s.getVoice(v).setPW(clamp(sum[3 + v]));
+                }
+
+                s.getFilter().setFilterFQ(clamp(sum[6]));
+                s.getFilter().setFilterRes(clamp(sum[7]) >> 8);
+            }
+        }
+    });
+
+    sidArray.flush();
+
+    report.add("modmatrix.full", fullNs, "ns/tick");
+
+    report.text() << "mod matrix, all 64 slots and 48 destinations every tick: " << fullNs << " ns/tick (checksum "
+                  << sidArray.getSink().sum << ")\n";
+}
+
+// filter: the filter runs per chip and output sample whether voices are routed through it or not, so its cost
+// per chip and second of audio is the render time of a mixed 6581/8580 stack less the time the voice kernel
+// takes for the same samples; and a cut-off write, a table lookup and a division, against working out the 6581
+// curve and the filter gain with expf() and tanf()
+void benchFilter() {
+    const uint32_t sampleRate = 44100;
+    const uint32_t seconds = 10;
+    static int16_t buffer[sampleRate];
+    static SIDVoiceLanes lanes;
+    static SIDVoiceOutputs outputs[32];
+    SIDEmulator<6> render(SIDEmulation::PAL_CLOCK, sampleRate);
+
+    setupEmulatorWorkload(render);
+
+    for(uint8_t sid = 0; sid < 6; sid++) {
+        render.setModel(sid, sid & 1 ? SID_MODEL_8580 : SID_MODEL_6581);
+    }
+
+    double renderNs = nsPerOp(seconds, [&]() {
+        for(uint32_t i = 0; i < seconds; i++) {
+            render.render(sampleRate, buffer);
+        }
+    });
+
+    const SIDVoiceKernelFn kernel = sidVoiceKernelFn(render.getKernel());
+
+    double kernelNs = nsPerOp(seconds, [&]() {
+        for(uint32_t i = 0; i < seconds; i++) {
+            for(uint32_t done = 0; done < sampleRate; done += 32) {
+                kernel(lanes, outputs, 32, 6);
+            }
+        }
+    });
+
+    const double perChip = (renderNs - kernelNs) / 6 / 1e6;
+
+    SIDEmulator<6> emu(SIDEmulation::PAL_CLOCK, sampleRate);
+    const uint32_t writes = 10000000;
+    float sum = 0;
+
+    double writeNs = nsPerOp(writes, [&]() {
+        for(uint32_t i = 0; i < writes; i++) {
+            emu.write(i % 6, SIDFilterLayout::SIDRegFCHi, (uint8_t) i);
+        }
+    });
+
+    double curveNs = nsPerOp(writes, [&]() {
+        for(uint32_t i = 0; i < writes; i++) {
+            const float fc = (float) ((i & 0xff) << 3);
+            const float hz = 220.0f + 17780.0f / (1.0f + expf(-(fc - 1100.0f) / 220.0f));
+
+            sum += tanf((float) M_PI * hz / (float) sampleRate);
+        }
+    });
+
+    report.add("filter.per_chip", perChip, "ms/chip/s");
+    report.add("filter.cutoff_write", writeNs, "ns/write");
+    report.add("filter.cutoff_curve", curveNs, "ns/write");
+
+    report.text() << "filter and mix, 6 chips at " << sampleRate << " Hz: " << perChip << " ms per chip and second of "
+                  << "audio, " << perChip * 1e6 / sampleRate << " ns per sample, "
+                  << "cut-off write " << writeNs << " ns, expf and tanf curve " << curveNs << " ns (checksum " << sum << ")\n";
+}
+
+int main(int argc, char **argv) {
+    if(argc > 1 && strcmp(argv[1], "--json") == 0) {
+        report.json = true;
+        argc--;
+        argv++;
+    }
+
+    benchSetters();
+    benchSetterKinds();
+    benchRingBuffer();
+    benchArrayToBus();
+    benchEmulator();
+    benchFilter();
+    benchLFO();
+    benchLFOKernels();
+    benchFrequency();
+    benchVoiceAllocator();
+    benchGateLatency();
+    benchScheduler();
+    benchPatch();
+    benchRenderer();
+    benchResampler();
+    benchSmoothing();
+    benchModMatrix();
+
+    if(argc > 1) {
+        benchTraceDrain(argv[1]);
+    } else {
+        const char *path = "/tmp/arduinosid-bench.trace";
+
+        recordTrace(path);
+        benchTraceDrain(path);
+        remove(path);
+    }
+
+    if(argc > 2) {
+        std::ifstream in(argv[2], std::ios::binary);
+
+        benchMIDI(std::vector<uint8_t>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()));
+    } else {
+        benchMIDI(generateMIDI(1000000));
+    }
+
+    if(report.json) {
+        report.writeJSON(std::cout);
+    }
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+#ifndef ARDUINOSID_BUS_H
+#define ARDUINOSID_BUS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+
+#include "progmem.h"
+
+// SID bus writes as a few masked port stores
+//
+// The address, data and chip select pins of the SIDs are spread over the three ports of an ATmega328. SIDBusMap
+// turns the pin map of a board into tables at compile time: for every address and every data value the bits to
+// set on each port, and per port the bits the bus owns. A register write first deselects all chips, on each port
+// with a chip select line still low, then sets address and data with one read-modify-write per port, and selects
+// the chip with one more:
+//
+//   PORTx |= deselect[x]
+//   PORTx = (PORTx & keep[x]) | address[reg][x] | data[val][x] | deselect[x]
+//   PORTcs &= ~select[sid]
+//
+// The chip selected by the last write stays selected until the next one, so the deselect pass has to come first:
+// otherwise the ports are updated one at a time while it is still selected, and it may latch a mix of old and new
+// address and data lines.
+//
+// The same register can be written to several chips in one bus cycle by pulling all their chip selects, the
+// lines for each set of chips are in a table as well.
+//
+// Ports are policies: any type with uint8_t read(port) and void write(port, uint8_t), so the same code drives
+// the AVR registers and the simulated ports used by the host tests.
+
+enum SIDBusPort : uint8_t {
+    SID_BUS_PORT_B,
+    SID_BUS_PORT_C,
+    SID_BUS_PORT_D,
+    SID_BUS_NUM_PORTS
+};
+
+// port and bit of an Arduino Uno/Nano pin: D0-D7 are PD0-PD7, D8-D13 are PB0-PB5, A0-A5 (14-19) are PC0-PC5
+static constexpr SIDBusPort sidBusPinPort(const uint8_t pin) {
+    return pin < 8 ? SID_BUS_PORT_D : pin < 14 ? SID_BUS_PORT_B : SID_BUS_PORT_C;
+}
+
+static constexpr uint8_t sidBusPinMask(const uint8_t pin) {
+    return (uint8_t) (1 << (pin < 8 ? pin : pin < 14 ? pin - 8 : pin - 14));
+}
+
+template <size_t NUM_AX, size_t NUM_DX, size_t NUM_CS>
+class SIDBusMap {
+public:
+    static const uint8_t NUM_ADDRESSES = 1 << NUM_AX;
+    static const uint16_t NUM_VALUES = 1 << NUM_DX;
+
+    // bits to set per port for each register address and data value
+    uint8_t address[NUM_ADDRESSES][SID_BUS_NUM_PORTS] = {};
+    uint8_t data[NUM_VALUES][SID_BUS_NUM_PORTS] = {};
+
+    // chip select lines, high for all chips and the line to pull low per chip
+    uint8_t deselect[SID_BUS_NUM_PORTS] = {};
+    uint8_t selectPort[NUM_CS] = {};
+    uint8_t select[NUM_CS] = {};
+
+    // lines to pull low per port for each set of chips, one bit per chip
+    uint8_t selectChips[1 << NUM_CS][SID_BUS_NUM_PORTS] = {};
+
+    // bits of each port the bus does not touch
+    uint8_t keep[SID_BUS_NUM_PORTS] = { 0xff, 0xff, 0xff };
+
+    // the chip select pins as a plain array, so a table with too few pins does not compile
+    constexpr SIDBusMap(const std::array<uint8_t, NUM_AX> &ax, const std::array<uint8_t, NUM_DX> &dx,
+                        const uint8_t (&cs)[NUM_CS]) {
+        for(uint16_t v = 0; v < NUM_ADDRESSES; v++) {
+            for(uint8_t i = 0; i < NUM_AX; i++) {
+                if(v & (1 << i)) {
+                    address[v][sidBusPinPort(ax[i])] |= sidBusPinMask(ax[i]);
+                }
+            }
+        }
+
+        for(uint16_t v = 0; v < NUM_VALUES; v++) {
+            for(uint8_t i = 0; i < NUM_DX; i++) {
+                if(v & (1 << i)) {
+                    data[v][sidBusPinPort(dx[i])] |= sidBusPinMask(dx[i]);
+                }
+            }
+        }
+
+        for(uint8_t i = 0; i < NUM_AX; i++) {
+            keep[sidBusPinPort(ax[i])] &= ~sidBusPinMask(ax[i]);
+        }
+
+        for(uint8_t i = 0; i < NUM_DX; i++) {
+            keep[sidBusPinPort(dx[i])] &= ~sidBusPinMask(dx[i]);
+        }
+
+        for(uint8_t i = 0; i < NUM_CS; i++) {
+            deselect[sidBusPinPort(cs[i])] |= sidBusPinMask(cs[i]);
+            keep[sidBusPinPort(cs[i])] &= ~sidBusPinMask(cs[i]);
+            selectPort[i] = sidBusPinPort(cs[i]);
+            select[i] = sidBusPinMask(cs[i]);
+        }
+
+        for(uint8_t chips = 0; chips < (1 << NUM_CS); chips++) {
+            for(uint8_t i = 0; i < NUM_CS; i++) {
+                if(chips & (1 << i)) {
+                    selectChips[chips][sidBusPinPort(cs[i])] |= sidBusPinMask(cs[i]);
+                }
+            }
+        }
+    }
+};
+
+// raise all chip select lines which are low, before address or data lines change
+template <typename Ports, typename Map>
+static inline void sidBusDeselect(Ports &ports, const Map &map) {
+    for(uint8_t p = 0; p < SID_BUS_NUM_PORTS; p++) {
+        const uint8_t deselect = progmemRead(&map.deselect[p]);
+
+        if(deselect) {
+            const uint8_t current = ports.read(p);
+
+            if((current & deselect) != deselect) {
+                ports.write(p, current | deselect);
+            }
+        }
+    }
+}
+
+// write a register through the ports; the map lives in flash on AVR so all of it is read with progmemRead
+template <typename Ports, typename Map>
+static inline void sidBusWrite(Ports &ports, const Map &map, const uint8_t sid, const uint8_t reg, const uint8_t val) {
+    sidBusDeselect(ports, map);
+
+    for(uint8_t p = 0; p < SID_BUS_NUM_PORTS; p++) {
+        const uint8_t keep = progmemRead(&map.keep[p]);
+
+        if(keep != 0xff) {
+            ports.write(p, (ports.read(p) & keep) |
+                           progmemRead(&map.address[reg][p]) |
+                           progmemRead(&map.data[val][p]) |
+                           progmemRead(&map.deselect[p]));
+        }
+    }
+
+    const uint8_t port = progmemRead(&map.selectPort[sid]);
+
+    ports.write(port, ports.read(port) & ~progmemRead(&map.select[sid]));
+}
+
+// write a register of several chips at once by pulling all their chip select lines, one bit per chip
+template <typename Ports, typename Map>
+static inline void sidBusWriteChips(Ports &ports, const Map &map, const uint8_t chips, const uint8_t reg,
+                                    const uint8_t val) {
+    uint8_t select[SID_BUS_NUM_PORTS];
+
+    sidBusDeselect(ports, map);
+
+    for(uint8_t p = 0; p < SID_BUS_NUM_PORTS; p++) {
+        const uint8_t keep = progmemRead(&map.keep[p]);
+
+        select[p] = progmemRead(&map.selectChips[chips][p]);
+
+        if(keep != 0xff) {
+            ports.write(p, (ports.read(p) & keep) |
+                           progmemRead(&map.address[reg][p]) |
+                           progmemRead(&map.data[val][p]) |
+                           progmemRead(&map.deselect[p]));
+        }
+    }
+
+    for(uint8_t p = 0; p < SID_BUS_NUM_PORTS; p++) {
+        if(select[p]) {
+            ports.write(p, ports.read(p) & ~select[p]);
+        }
+    }
+}
+
+#if !defined(ARDUINO)
+
+// ports in memory for host tests, counting the port accesses
+
+class SimulatedPorts {
+public:
+    uint8_t ports[SID_BUS_NUM_PORTS] = {};
+    uint32_t reads = 0;
+    uint32_t writes = 0;
+
+    inline uint8_t read(const uint8_t port) {
+        reads++;
+
+        return ports[port];
+    }
+
+    inline void write(const uint8_t port, const uint8_t val) {
+        writes++;
+        ports[port] = val;
+    }
+
+    // level of an Arduino pin
+    bool pin(const uint8_t pin) const {
+        return ports[sidBusPinPort(pin)] & sidBusPinMask(pin);
+    }
+};
+
+#endif // !ARDUINO
+
+#endif // ARDUINOSID_BUS_H
@@ -5,14 +5,24 @@
 #ifndef ARDUINOSID_FREQ_H
 #define ARDUINOSID_FREQ_H
 
+#include <cstdint>
+#include <cstddef>
 #include <cmath>
+#include <array>
+#include <utility>
+
+#include "progmem.h"
 
 class Frequency {
 private:
-    static const float P_CENT = 1.0005777895;
-    static const float P_HALFTONE = 1.059463094;
+    static constexpr float P_CENT = 1.0005777895;
+    static constexpr float P_HALFTONE = 1.059463094;
 
 public:
+    // phi2 clock frequencies in Hz
+    static constexpr uint32_t PAL_CLOCK = 985248;
+    static constexpr uint32_t NTSC_CLOCK = 1022727;
+
     /**
      * Increase/decrease a given frequency by a number of tempered semitones.
      *
@@ -35,6 +45,134 @@ public:
     inline static float const addCents(const float fq, const int n, const float scale = 1.0) {
         return fq * pow(P_CENT, scale * (float) n);
     }
+
+    /**
+     * 2^x, evaluated as a series so it can be used at compile time.
+     *
+     * @param x the exponent
+     * @return 2 to the power of x
+     */
+    static constexpr double exp2(const double x) {
+        const double ln2 = 0.69314718055994530942;
+
+        // split into an integer power of two and a fraction in [0, 1)
+        int64_t n = (int64_t) x;
+
+        if((double) n > x) {
+            n--;
+        }
+
+        const double r = (x - (double) n) * ln2;
+        double term = 1.0;
+        double sum = 1.0;
+
+        for(int i = 1; i < 20; i++) {
+            term *= r / i;
+            sum += term;
+        }
+
+        for(; n > 0; n--) {
+            sum *= 2.0;
+        }
+
+        for(; n < 0; n++) {
+            sum /= 2.0;
+        }
+
+        return sum;
+    }
+
+    /**
+     * Frequency of a MIDI note in equal temperament with A4 (note 69) at 440 Hz.
+     *
+     * @param note  the MIDI note number
+     * @param cents the detune in cents
+     * @return frequency in Hz
+     */
+    static constexpr double noteToHz(const int note, const double cents = 0) {
+        return 440.0 * exp2((note - 69 + cents / 100.0) / 12.0);
+    }
+
+    /**
+     * SID oscillator register value for a frequency, Fout = FQ * clock / 2^24.
+     *
+     * @param hz    the frequency
+     * @param clock the phi2 clock of the SID
+     * @return the 16 bit FQ register value, saturated at the highest frequency the SID can play
+     */
+    static constexpr uint16_t hzToFQ(const double hz, const uint32_t clock) {
+        return hz * 16777216.0 / clock + 0.5 >= 65535.0 ? 0xffff : (uint16_t) (hz * 16777216.0 / clock + 0.5);
+    }
+};
+
+/**
+ * MIDI note to SID FQ register tables for one phi2 clock, generated at compile time.
+ *
+ * Notes above the SID's range (about B7 at both clocks) saturate at 0xffff.
+ *
+ * @tparam CLOCK the phi2 clock in Hz
+ */
+template <uint32_t CLOCK>
+class SIDFrequencyTable {
+public:
+    static const uint8_t NUM_NOTES = 128;
+
+private:
+    template <size_t... I>
+    static constexpr std::array<uint16_t, sizeof...(I)> noteTable(std::index_sequence<I...>) {
+        return {{ Frequency::hzToFQ(Frequency::noteToHz(I), CLOCK)... }};
+    }
+
+    // where c cents lie between two semitones on the exponential pitch curve, in 1/65536
+    template <size_t... I>
+    static constexpr std::array<uint16_t, sizeof...(I)> centTable(std::index_sequence<I...>) {
+        return {{ (uint16_t) ((Frequency::exp2(I / 1200.0) - 1.0) / (Frequency::exp2(1.0 / 12.0) - 1.0) * 65536.0 + 0.5)... }};
+    }
+
+public:
+    static constexpr std::array<uint16_t, NUM_NOTES> FQ ARDUINOSID_PROGMEM = noteTable(std::make_index_sequence<NUM_NOTES>());
+    static constexpr std::array<uint16_t, 100> CENTS ARDUINOSID_PROGMEM = centTable(std::make_index_sequence<100>());
+
+    /**
+     * FQ register value of a MIDI note detuned by a number of cents, without any floating point.
+     *
+     * @param note  the MIDI note number
+     * @param cents the detune in cents, may span several semitones e.g. for pitch bend
+     * @return the 16 bit FQ register value
+     */
+    static inline uint16_t noteToFQ(const uint8_t note, const int16_t cents = 0) {
+        // floor division, so -1 cent is 99 cents above the next lower note
+        int16_t n = note + (cents >= 0 ? cents / 100 : (cents - 99) / 100);
+        const uint8_t c = (uint8_t) (cents - (n - note) * 100);
+
+        if(n < 0) {
+            return progmemRead(FQ.data());
+        }
+
+        if(n >= NUM_NOTES - 1) {
+            return progmemRead(FQ.data() + NUM_NOTES - 1);
+        }
+
+        const uint16_t a = progmemRead(FQ.data() + n);
+        const uint16_t b = progmemRead(FQ.data() + n + 1);
+
+        return a + (uint16_t) (((uint32_t) (b - a) * progmemRead(CENTS.data() + c) + 0x8000) >> 16);
+    }
 };
 
+typedef SIDFrequencyTable<Frequency::PAL_CLOCK> PALFrequencyTable;
+typedef SIDFrequencyTable<Frequency::NTSC_CLOCK> NTSCFrequencyTable;
+
+/**
+ * FQ register value of a MIDI note detuned by a number of cents, for a PAL or an NTSC SID.
+ *
+ * @param note  the MIDI note number
+ * @param cents the detune in cents
+ * @param ntsc  whether the SID runs at the NTSC clock
+ * @return the 16 bit FQ register value
+ */
+static inline uint16_t noteToFQ(const uint8_t note, const int16_t cents = 0, const bool ntsc = false) {
+    return ntsc ? NTSCFrequencyTable::noteToFQ(note, cents) : PALFrequencyTable::noteToFQ(note, cents);
+}
+
 #endif //ARDUINOSID_FREQ_H
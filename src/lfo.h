@@ -0,0 +1,200 @@
+#pragma once
+
+#ifndef ARDUINOSID_LFO_H
+#define ARDUINOSID_LFO_H
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <utility>
+
+#include "progmem.h"
+
+// fixed point, table driven low frequency oscillators, the integer counterpart of the float prototypes in lfo.c
+//
+// Phases are 32 bit accumulators where 2^32 is one cycle, so they wrap around for free and never lose precision
+// however long the LFO runs. The upper 8 bits index a 256 entry wavetable of Q15 values, the next 8 bits
+// interpolate linearly to the following entry. The rectangle compares the phase against a pulse width instead
+// of looking it up. Advancing an LFO is an add, two table reads and two multiplies, no floating point.
+
+enum LFOShape : uint8_t {
+    LFO_SINE,
+    LFO_TRIANGLE,
+    LFO_SAW_UP,
+    LFO_SAW_DOWN,
+    LFO_RECTANGLE
+};
+
+// Q15 full scale, the tables hold [-LFO_MAX, LFO_MAX]
+static const int16_t LFO_MAX = 32767;
+
+// generates the wavetables at compile time
+class LFOTableBuilder {
+public:
+    static const uint16_t TABLE_SIZE = 256;
+
+    // sin(2 pi x) for x in [0, 1), as a Taylor series so it can be evaluated at compile time
+    static constexpr double sine(double x) {
+        const double pi = 3.14159265358979323846;
+
+        // fold onto [-1/4, 1/4] where the series converges quickly
+        double sign = 1.0;
+
+        if(x >= 0.5) {
+            x -= 0.5;
+            sign = -1.0;
+        }
+
+        if(x > 0.25) {
+            x = 0.5 - x;
+        }
+
+        const double r = 2.0 * pi * x;
+        double term = r;
+        double sum = r;
+
+        for(int n = 1; n < 12; n++) {
+            term *= -r * r / ((2 * n) * (2 * n + 1));
+            sum += term;
+        }
+
+        return sign * sum;
+    }
+
+    static constexpr int16_t round(const double v) {
+        return (int16_t) (v < 0 ? v * LFO_MAX - 0.5 : v * LFO_MAX + 0.5);
+    }
+
+    // the same shapes as lfo.c
+    static constexpr int16_t entry(const LFOShape shape, const uint16_t i) {
+        const double phase = (double) i / TABLE_SIZE;
+
+        return shape == LFO_SINE ? round(sine(phase)) :
+               shape == LFO_TRIANGLE ? round(phase < 0.25 ? phase * 4.0 :
+                                             phase < 0.75 ? 2.0 - phase * 4.0 :
+                                             phase * 4.0 - 4.0) :
+               shape == LFO_SAW_UP ? round(2.0 * phase - 1.0) :
+               round(1.0 - 2.0 * phase);
+    }
+
+    template <size_t... I>
+    static constexpr std::array<int16_t, sizeof...(I)> table(const LFOShape shape, std::index_sequence<I...>) {
+        return {{ entry(shape, I)... }};
+    }
+};
+
+class LFOTables : private LFOTableBuilder {
+public:
+    static const uint16_t TABLE_SIZE = LFOTableBuilder::TABLE_SIZE;
+    static const int16_t MAX = LFO_MAX;
+
+    // one table per shape up to LFO_SAW_DOWN, indexed by shape
+    static constexpr std::array<int16_t, TABLE_SIZE> TABLES[4] ARDUINOSID_PROGMEM = {
+        table(LFO_SINE, std::make_index_sequence<TABLE_SIZE>()),
+        table(LFO_TRIANGLE, std::make_index_sequence<TABLE_SIZE>()),
+        table(LFO_SAW_UP, std::make_index_sequence<TABLE_SIZE>()),
+        table(LFO_SAW_DOWN, std::make_index_sequence<TABLE_SIZE>())
+    };
+
+    // Q15 value of a shape at a phase
+    static inline int16_t lookup(const LFOShape shape, const uint32_t phase, const uint32_t width = 0x80000000) {
+        if(shape == LFO_RECTANGLE) {
+            return phase < width ? MAX : -MAX;
+        }
+
+        const int16_t *table = TABLES[shape].data();
+        const uint8_t i = phase >> 24;
+        const int16_t a = progmemRead(table + i);
+        int16_t b = progmemRead(table + (uint8_t) (i + 1));
+
+        // saws jump back at the end of the table, the last entry continues the slope instead
+        if(i == TABLE_SIZE - 1 && (shape == LFO_SAW_UP || shape == LFO_SAW_DOWN)) {
+            b = a + (a - progmemRead(table + i - 1));
+        }
+
+        return a + (int16_t) (((int32_t) (b - a) * (uint8_t) (phase >> 16)) >> 8);
+    }
+};
+
+// the state of a single LFO
+
+struct LFO {
+    // phase increment per control tick, phase shift and rectangle pulse width, in 2^32 per cycle
+    uint32_t phase = 0;
+    uint32_t rate = 0;
+    uint32_t shift = 0;
+    uint32_t width = 0x80000000;
+
+    // Q15 scale of the output, negative depths invert it
+    int16_t depth = LFOTables::MAX;
+
+    LFOShape shape = LFO_SINE;
+
+    // last output, Q15 scaled by depth
+    int16_t value = 0;
+};
+
+// N LFOs advanced once per control tick
+
+template <uint8_t N>
+class LFOEngine {
+public:
+    static const uint8_t NUM_LFOS = N;
+
+private:
+    const uint16_t tickRate;
+    LFO lfos[N];
+
+public:
+    // tickRate is the number of control ticks per second
+    LFOEngine(const uint16_t tickRate) : tickRate(tickRate) {
+    }
+
+    // rate in mHz; this divides, call it when the rate changes and not per tick
+    void setRate(const uint8_t lfo, const uint32_t mHz) {
+        lfos[lfo].rate = (uint32_t) (((uint64_t) mHz << 32) / ((uint64_t) tickRate * 1000));
+    }
+
+    // shift in 1/65536 of a cycle, as lfo.c's shift but in fixed point
+    void setShift(const uint8_t lfo, const uint16_t shift) {
+        lfos[lfo].shift = (uint32_t) shift << 16;
+    }
+
+    // pulse width of the rectangle in 1/65536 of a cycle
+    void setWidth(const uint8_t lfo, const uint16_t width) {
+        lfos[lfo].width = (uint32_t) width << 16;
+    }
+
+    void setDepth(const uint8_t lfo, const int16_t depth) {
+        lfos[lfo].depth = depth;
+    }
+
+    void setShape(const uint8_t lfo, const LFOShape shape) {
+        lfos[lfo].shape = shape;
+    }
+
+    // restart an LFO at its phase shift, e.g. on a key press
+    void reset(const uint8_t lfo) {
+        lfos[lfo].phase = 0;
+    }
+
+    // advance all LFOs by one control tick
+    void tick() {
+        for(uint8_t i = 0; i < N; i++) {
+            LFO &lfo = lfos[i];
+
+            lfo.value = (int16_t) (((int32_t) LFOTables::lookup(lfo.shape, lfo.phase + lfo.shift, lfo.width) * lfo.depth) >> 15);
+            lfo.phase += lfo.rate;
+        }
+    }
+
+    inline int16_t getValue(const uint8_t lfo) const {
+        return lfos[lfo].value;
+    }
+
+    LFO &getLFO(const uint8_t lfo) {
+        return lfos[lfo];
+    }
+};
+
+#endif // ARDUINOSID_LFO_H
@@ -0,0 +1,344 @@
+#pragma once
+
+#ifndef ARDUINOSID_MIDI_H
+#define ARDUINOSID_MIDI_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include "sid.h"
+#include "freq.h"
+#include "voices.h"
+
+// streaming MIDI 1.0 input
+//
+// MIDIParser takes one byte at a time, e.g. straight from the serial port, and calls a handler for each complete
+// message. It keeps running status, passes SysEx data through byte by byte and handles realtime messages
+// wherever they appear, also in the middle of other messages or SysEx. Its whole state is a few bytes.
+//
+// Handlers are policies like the register sinks in sid.h: any type with the methods of MIDIHandler, which
+// provides empty defaults to derive from.
+
+class MIDIHandler {
+public:
+    inline void noteOff(const uint8_t /* channel */, const uint8_t /* note */, const uint8_t /* velocity */) {}
+    inline void noteOn(const uint8_t /* channel */, const uint8_t /* note */, const uint8_t /* velocity */) {}
+    inline void keyPressure(const uint8_t /* channel */, const uint8_t /* note */, const uint8_t /* pressure */) {}
+    inline void controlChange(const uint8_t /* channel */, const uint8_t /* controller */, const uint8_t /* value */) {}
+    inline void programChange(const uint8_t /* channel */, const uint8_t /* program */) {}
+    inline void channelPressure(const uint8_t /* channel */, const uint8_t /* pressure */) {}
+
+    // bend in [-8192, 8191]
+    inline void pitchBend(const uint8_t /* channel */, const int16_t /* bend */) {}
+
+    // song position, song select, tune request and MTC quarter frames
+    inline void systemCommon(const uint8_t /* status */, const uint8_t /* data1 */, const uint8_t /* data2 */) {}
+
+    // SysEx data bytes between 0xf0 and the end, which is 0xf7 or any other status byte for an aborted message
+    inline void sysExStart() {}
+    inline void sysExData(const uint8_t /* data */) {}
+    inline void sysExEnd(const bool /* complete */) {}
+
+    inline void realtime(const uint8_t /* status */) {}
+};
+
+template <typename Handler>
+class MIDIParser {
+private:
+    Handler &handler;
+
+    // status of the message being received, kept as running status for channel messages; 0 if none
+    uint8_t status = 0;
+    uint8_t data[2] = {};
+    uint8_t count = 0;
+    bool inSysEx = false;
+
+    static inline uint8_t dataLength(const uint8_t status) {
+        switch(status & 0xf0) {
+            case 0xc0:
+            case 0xd0:
+                return 1;
+
+            case 0xf0:
+                return status == 0xf2 ? 2 : (status == 0xf1 || status == 0xf3) ? 1 : 0;
+
+            default:
+                return 2;
+        }
+    }
+
+    inline void dispatch() {
+        const uint8_t channel = status & 0x0f;
+
+        switch(status & 0xf0) {
+            case 0x80:
+                handler.noteOff(channel, data[0], data[1]);
+                break;
+
+            case 0x90:
+                // note on with velocity 0 is a note off, commonly used with running status
+                if(data[1]) {
+                    handler.noteOn(channel, data[0], data[1]);
+                } else {
+                    handler.noteOff(channel, data[0], 0x40);
+                }
+                break;
+
+            case 0xa0:
+                handler.keyPressure(channel, data[0], data[1]);
+                break;
+
+            case 0xb0:
+                handler.controlChange(channel, data[0], data[1]);
+                break;
+
+            case 0xc0:
+                handler.programChange(channel, data[0]);
+                break;
+
+            case 0xd0:
+                handler.channelPressure(channel, data[0]);
+                break;
+
+            case 0xe0:
+                handler.pitchBend(channel, (int16_t) ((data[1] << 7 | data[0]) - 8192));
+                break;
+
+            default:
+                handler.systemCommon(status, data[0], data[1]);
+
+                // system common messages cancel running status
+                status = 0;
+                break;
+        }
+    }
+
+public:
+    MIDIParser(Handler &handler) : handler(handler) {
+    }
+
+    inline void parse(const uint8_t byte) {
+        // realtime messages may appear anywhere and do not touch the state
+        if(byte >= 0xf8) {
+            handler.realtime(byte);
+            return;
+        }
+
+        if(!(byte & 0x80)) {
+            if(inSysEx) {
+                handler.sysExData(byte);
+            } else if(status) {
+                data[count++] = byte;
+
+                if(count == dataLength(status)) {
+                    count = 0;
+                    dispatch();
+                }
+            }
+
+            return;
+        }
+
+        // any other status byte ends a SysEx
+        if(inSysEx) {
+            inSysEx = false;
+            handler.sysExEnd(byte == 0xf7);
+        }
+
+        count = 0;
+        status = 0;
+        data[0] = data[1] = 0;
+
+        if(byte == 0xf0) {
+            inSysEx = true;
+            handler.sysExStart();
+        } else if(byte != 0xf7) {
+            status = byte;
+
+            if(dataLength(status) == 0) {
+                dispatch();
+            }
+        }
+    }
+
+    inline void parse(const uint8_t *bytes, const size_t length) {
+        for(size_t i = 0; i < length; i++) {
+            parse(bytes[i]);
+        }
+    }
+};
+
+// plays MIDI on the voices of a SIDArray
+//
+// Notes are assigned to voices by a VoiceAllocator; channels 1 to N prefer the voices of the corresponding chip,
+// so their filter and volume controllers apply to the notes they play, higher channels play on any chip and
+// control all of them. A note held on two channels at once shares one voice. Per channel:
+//
+// - program change selects the waveform: program % 4 is triangle, sawtooth, pulse, noise
+// - pitch bend over +-2 semitones
+// - CC 1 pulse width, CC 72 release, CC 73 attack, CC 75 decay, CC 79 sustain
+// - CC 7 volume, CC 71 resonance, CC 74 cutoff of the chip(s)
+// - CC 120 and 123 release all notes of the channel
+
+template <uint8_t N, typename Sink>
+class SIDMIDIHandler : public MIDIHandler {
+public:
+    static const uint8_t NUM_CHANNELS = 16;
+    static const uint8_t BEND_RANGE = 2;
+
+    using Voices = VoiceAllocator<N>;
+
+private:
+    struct Channel {
+        int16_t bend = 0;
+        uint16_t pw = 0x8000;
+        uint8_t wave = SIDVoiceLayout::SIDWavSaw;
+        uint8_t AD = 0x09;
+        uint8_t SR = 0x00;
+    };
+
+    SIDArray<N, Sink> &sids;
+    Voices voices;
+    const bool ntsc;
+    Channel channels[NUM_CHANNELS];
+    uint8_t voiceChannel[Voices::NUM_VOICES] = {};
+
+    inline typename SIDArray<N, Sink>::SIDType::SIDVoice voice(const uint8_t v) {
+        return sids.getSID(Voices::getSIDNo(v)).getVoice(Voices::getVoiceNo(v));
+    }
+
+    inline uint16_t fq(const uint8_t note, const int16_t bend) {
+        return noteToFQ(note, (int16_t) ((int32_t) bend * BEND_RANGE * 100 / 8192), ntsc);
+    }
+
+    // call f(voice) for the sounding voices of a channel
+    template <typename F>
+    void forChannel(const uint8_t channel, F f) {
+        for(uint8_t v = 0; v < Voices::NUM_VOICES; v++) {
+            if(voices.isSounding(v) && voiceChannel[v] == channel) {
+                f(v);
+            }
+        }
+    }
+
+    // call f(filter) for the chip of a channel, or all chips for the higher channels
+    template <typename F>
+    void forChips(const uint8_t channel, F f) {
+        for(uint8_t sid = 0; sid < N; sid++) {
+            if(channel >= N || channel == sid) {
+                f(sids.getSID(sid).getFilter());
+            }
+        }
+    }
+
+public:
+    SIDMIDIHandler(SIDArray<N, Sink> &sids, const VoiceStealPolicy policy = STEAL_OLDEST, const bool ntsc = false)
+        : sids(sids), voices(policy), ntsc(ntsc) {
+    }
+
+    inline void noteOn(const uint8_t channel, const uint8_t note, const uint8_t /* velocity */) {
+        const Channel &c = channels[channel];
+        const uint8_t v = voices.noteOn(note, channel < N ? channel : Voices::NONE);
+        auto sidVoice = voice(v);
+
+        // a voice taken over from a sounding note is retriggered, SIDArray queues the gate edge
+        sidVoice.setGate(false);
+        voiceChannel[v] = channel;
+
+        sidVoice.setFQ(fq(note, c.bend));
+        sidVoice.setPW(c.pw);
+        sidVoice.setAD(c.AD);
+        sidVoice.setSR(c.SR);
+        sidVoice.setWave(c.wave);
+        sidVoice.setGate(true);
+    }
+
+    inline void noteOff(const uint8_t channel, const uint8_t note, const uint8_t /* velocity */) {
+        const uint8_t v = voices.getVoice(note);
+
+        // a note only ends on the channel which played it
+        if(v != Voices::NONE && voiceChannel[v] == channel) {
+            voices.noteOff(note);
+            voice(v).setGate(false);
+        }
+    }
+
+    inline void pitchBend(const uint8_t channel, const int16_t bend) {
+        channels[channel].bend = bend;
+
+        forChannel(channel, [&](const uint8_t v) {
+            voice(v).setFQ(fq(voices.getNote(v), bend));
+        });
+    }
+
+    inline void programChange(const uint8_t channel, const uint8_t program) {
+        static const uint8_t waves[4] = {
+            SIDVoiceLayout::SIDWavTri, SIDVoiceLayout::SIDWavSaw, SIDVoiceLayout::SIDWavSqu, SIDVoiceLayout::SIDWavNse
+        };
+
+        channels[channel].wave = waves[program & 3];
+    }
+
+    void controlChange(const uint8_t channel, const uint8_t controller, const uint8_t value) {
+        Channel &c = channels[channel];
+
+        switch(controller) {
+            case 1:
+                c.pw = (uint16_t) value << 9;
+                forChannel(channel, [&](const uint8_t v) { voice(v).setPW(c.pw); });
+                break;
+
+            case 72:
+                c.SR = (c.SR & 0xf0) | value >> 3;
+                forChannel(channel, [&](const uint8_t v) { voice(v).setSR(c.SR); });
+                break;
+
+            case 73:
+                c.AD = (c.AD & 0x0f) | (value >> 3) << 4;
+                forChannel(channel, [&](const uint8_t v) { voice(v).setAD(c.AD); });
+                break;
+
+            case 75:
+                c.AD = (c.AD & 0xf0) | value >> 3;
+                forChannel(channel, [&](const uint8_t v) { voice(v).setAD(c.AD); });
+                break;
+
+            case 79:
+                c.SR = (c.SR & 0x0f) | (value >> 3) << 4;
+                forChannel(channel, [&](const uint8_t v) { voice(v).setSR(c.SR); });
+                break;
+
+            case 7:
+                forChips(channel, [&](typename SIDArray<N, Sink>::SIDType::SIDFilter filter) {
+                    filter.setVolume(value >> 3);
+                });
+                break;
+
+            case 71:
+                forChips(channel, [&](typename SIDArray<N, Sink>::SIDType::SIDFilter filter) {
+                    filter.setFilterRes((value >> 3) << 4);
+                });
+                break;
+
+            case 74:
+                forChips(channel, [&](typename SIDArray<N, Sink>::SIDType::SIDFilter filter) {
+                    filter.setFilterFQ((uint16_t) value << 9);
+                });
+                break;
+
+            case 120:
+            case 123:
+                forChannel(channel, [&](const uint8_t v) {
+                    voices.noteOff(voices.getNote(v));
+                    voice(v).setGate(false);
+                });
+                break;
+        }
+    }
+
+    Voices &getVoices() {
+        return voices;
+    }
+};
+
+#endif // ARDUINOSID_MIDI_H
@@ -0,0 +1,292 @@
+#pragma once
+
+#ifndef ARDUINOSID_MODMATRIX_H
+#define ARDUINOSID_MODMATRIX_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+
+#include "sid.h"
+#include "lfo.h"
+
+// modulation matrix, evaluated incrementally once per control tick
+//
+// Sources are SOURCES signed Q15 values the sketch feeds in, LFO outputs, envelopes, velocity, MIDI controllers,
+// whatever the numbers stand for. Destinations are the frequency and pulse width of every voice and the cut-off
+// and resonance of every filter of N chips, in the units of the setters; the resonance, whose register holds 4
+// bits, is scaled like the others to 16 bits with the register value at the top. A slot of the fixed table routes
+// a source to a destination with a signed amount, the offset at full scale source.
+//
+// Every destination holds a base value and the sum of the contributions of its slots. Setting a source to a new
+// value marks it, and tick() only goes through the slots of marked sources, adding the change of their
+// contributions to the sums and marking the destinations they feed. Only those are then clamped and written
+// through their setter, once however many slots feed them, and only if the bits the chip register holds change.
+// A tick thus costs in proportion to the slots whose sources moved, nothing for an idle matrix of any size.
+
+template <uint8_t N, uint8_t SLOTS = 64, uint8_t SOURCES = 16>
+class ModMatrix {
+public:
+    static const uint8_t NUM_SIDS = N;
+    static const uint8_t NUM_SLOTS = SLOTS;
+    static const uint8_t NUM_SOURCES = SOURCES;
+
+    // per chip: FQ and PW of the three voices, then cut-off and resonance
+    static const uint8_t DESTS_PER_SID = 2 * SIDLayout::NUM_VOICES + 2;
+    static const uint8_t NUM_DESTS = N * DESTS_PER_SID;
+    static const uint8_t NONE = 0xff;
+
+    static_assert(SLOTS < NONE && SOURCES < NONE && NUM_DESTS < NONE, "ModMatrix too large");
+
+    static inline uint8_t fqDest(const uint8_t sid, const uint8_t voice) {
+        return sid * DESTS_PER_SID + voice;
+    }
+
+    static inline uint8_t pwDest(const uint8_t sid, const uint8_t voice) {
+        return sid * DESTS_PER_SID + SIDLayout::NUM_VOICES + voice;
+    }
+
+    static inline uint8_t cutoffDest(const uint8_t sid) {
+        return sid * DESTS_PER_SID + 2 * SIDLayout::NUM_VOICES;
+    }
+
+    static inline uint8_t resDest(const uint8_t sid) {
+        return sid * DESTS_PER_SID + 2 * SIDLayout::NUM_VOICES + 1;
+    }
+
+private:
+    struct Slot {
+        uint8_t source = NONE;
+        uint8_t dest = NONE;
+        int16_t amount = 0;
+
+        // what the slot adds to its destination now
+        int32_t contribution = 0;
+
+        // next slot of the same source or NONE
+        uint8_t next = NONE;
+    };
+
+    struct Source {
+        int16_t value = 0;
+        uint8_t first = NONE;
+        bool dirty = false;
+    };
+
+    struct Dest {
+        uint16_t base = 0;
+        bool dirty = false;
+
+        // low bits of the setter value which the chip register does not hold
+        uint8_t shift = 0;
+
+        // sum of the contributions of all slots
+        int32_t offset = 0;
+
+        // register bits last written, above 0xffff before the first write
+        uint32_t written = 0xffffffff;
+    };
+
+    Slot slots[SLOTS];
+    Source sources[SOURCES];
+    Dest dests[NUM_DESTS];
+
+    uint8_t dirtySources[SOURCES];
+    uint8_t numDirtySources = 0;
+    uint8_t dirtyDests[NUM_DESTS];
+    uint8_t numDirtyDests = 0;
+    uint8_t numSlots = 0;
+
+    void markSource(const uint8_t source) {
+        if(!sources[source].dirty) {
+            sources[source].dirty = true;
+            dirtySources[numDirtySources++] = source;
+        }
+    }
+
+    void markDest(const uint8_t dest) {
+        if(!dests[dest].dirty) {
+            dests[dest].dirty = true;
+            dirtyDests[numDirtyDests++] = dest;
+        }
+    }
+
+    static inline int32_t contribution(const int16_t value, const int16_t amount) {
+        return ((int32_t) value * amount) >> 15;
+    }
+
+    // take a slot out of its source's list and its contribution out of its destination
+    void unlink(const uint8_t slot) {
+        Slot &s = slots[slot];
+
+        if(s.source == NONE) {
+            return;
+        }
+
+        uint8_t *link = &sources[s.source].first;
+
+        while(*link != slot) {
+            link = &slots[*link].next;
+        }
+
+        *link = s.next;
+        dests[s.dest].offset -= s.contribution;
+        markDest(s.dest);
+
+        s = Slot();
+        numSlots--;
+    }
+
+    template <typename S>
+    static inline void apply(S &sid, const uint8_t kind, const uint16_t value) {
+        if(kind < SIDLayout::NUM_VOICES) {
+            sid.getVoice(kind).setFQ(value);
+        } else if(kind < 2 * SIDLayout::NUM_VOICES) {
+            sid.getVoice(kind - SIDLayout::NUM_VOICES).setPW(value);
+        } else if(kind == 2 * SIDLayout::NUM_VOICES) {
+            sid.getFilter().setFilterFQ(value);
+        } else {
+            sid.getFilter().setFilterRes(value >> 8);
+        }
+    }
+
+public:
+    ModMatrix() {
+        for(uint8_t dest = 0; dest < NUM_DESTS; dest++) {
+            const uint8_t kind = dest % DESTS_PER_SID;
+
+            dests[dest].shift = kind < SIDLayout::NUM_VOICES ? 0 : kind < 2 * SIDLayout::NUM_VOICES ? 4 :
+                                kind == 2 * SIDLayout::NUM_VOICES ? 5 : 12;
+        }
+    }
+
+    // route a source to a destination, replacing what the slot did before; amount is the offset in setter units
+    // at full scale source, negative amounts invert the source
+    void setSlot(const uint8_t slot, const uint8_t source, const uint8_t dest, const int16_t amount) {
+        assert(slot < SLOTS && source < SOURCES && dest < NUM_DESTS);
+
+        unlink(slot);
+
+        Slot &s = slots[slot];
+
+        s.source = source;
+        s.dest = dest;
+        s.amount = amount;
+        s.contribution = contribution(sources[source].value, amount);
+        s.next = sources[source].first;
+        sources[source].first = slot;
+
+        dests[dest].offset += s.contribution;
+        markDest(dest);
+        numSlots++;
+    }
+
+    // change the amount of a slot in use, e.g. from a mod wheel
+    void setAmount(const uint8_t slot, const int16_t amount) {
+        assert(slot < SLOTS && slots[slot].source != NONE);
+
+        slots[slot].amount = amount;
+        markSource(slots[slot].source);
+    }
+
+    void clearSlot(const uint8_t slot) {
+        assert(slot < SLOTS);
+
+        unlink(slot);
+    }
+
+    // value of a destination without modulation, in setter units
+    void setBase(const uint8_t dest, const uint16_t value) {
+        assert(dest < NUM_DESTS);
+
+        if(dests[dest].base != value) {
+            dests[dest].base = value;
+            markDest(dest);
+        }
+    }
+
+    // new Q15 value of a source, the slots it feeds are only looked at if it changed
+    inline void setSource(const uint8_t source, const int16_t value) {
+        assert(source < SOURCES);
+
+        if(sources[source].value != value) {
+            sources[source].value = value;
+            markSource(source);
+        }
+    }
+
+    // take the outputs of the LFOs of an engine as the sources first, first + 1, ...
+    template <uint8_t M>
+    void setSources(const LFOEngine<M> &engine, const uint8_t first = 0) {
+        for(uint8_t i = 0; i < M && first + i < SOURCES; i++) {
+            setSource(first + i, engine.getValue(i));
+        }
+    }
+
+    // bring the contributions of changed sources into their destinations and write the destinations whose
+    // register bits changed through the setters of a SIDArray; returns the number of destinations written
+    template <typename Array>
+    uint8_t tick(Array &sidArray) {
+        for(uint8_t i = 0; i < numDirtySources; i++) {
+            Source &source = sources[dirtySources[i]];
+
+            for(uint8_t slot = source.first; slot != NONE; slot = slots[slot].next) {
+                Slot &s = slots[slot];
+                const int32_t c = contribution(source.value, s.amount);
+
+                if(c != s.contribution) {
+                    dests[s.dest].offset += c - s.contribution;
+                    s.contribution = c;
+                    markDest(s.dest);
+                }
+            }
+
+            source.dirty = false;
+        }
+
+        numDirtySources = 0;
+
+        uint8_t written = 0;
+
+        for(uint8_t i = 0; i < numDirtyDests; i++) {
+            const uint8_t dest = dirtyDests[i];
+            Dest &d = dests[dest];
+            const int32_t sum = d.base + d.offset;
+            const uint16_t value = (uint16_t) (sum < 0 ? 0 : sum > 0xffff ? 0xffff : sum);
+
+            d.dirty = false;
+
+            if((uint32_t) (value >> d.shift) != d.written) {
+                d.written = value >> d.shift;
+                apply(sidArray.getSID(dest / DESTS_PER_SID), dest % DESTS_PER_SID, value);
+                written++;
+            }
+        }
+
+        numDirtyDests = 0;
+
+        return written;
+    }
+
+    // modulated value of a destination in setter units, sources changed since the last tick still at their old values
+    uint16_t getValue(const uint8_t dest) const {
+        assert(dest < NUM_DESTS);
+
+        const int32_t sum = dests[dest].base + dests[dest].offset;
+
+        return (uint16_t) (sum < 0 ? 0 : sum > 0xffff ? 0xffff : sum);
+    }
+
+    int16_t getSource(const uint8_t source) const {
+        assert(source < SOURCES);
+
+        return sources[source].value;
+    }
+
+    // number of slots in use
+    uint8_t getSlots() const {
+        return numSlots;
+    }
+};
+
+#endif // ARDUINOSID_MODMATRIX_H
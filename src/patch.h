@@ -0,0 +1,274 @@
+#pragma once
+
+#ifndef ARDUINOSID_PATCH_H
+#define ARDUINOSID_PATCH_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include "sid.h"
+#include "lfo.h"
+#include "progmem.h"
+
+#if !defined(ARDUINO)
+#include <fstream>
+#endif
+
+// sound presets as compact binary patches
+//
+// A patch holds everything about a sound of one chip which does not depend on the note played: waveform and
+// control bits except the gate, pulse width and envelope of the three voices, filter cutoff, resonance, routing,
+// mode and volume, and the settings of two LFOs. Encoded it takes 35 bytes, all multi-byte values little endian:
+//
+//   header:     'S', 'P', uint8 version, uint8 length of the body
+//   per voice:  WvCtl without the gate, PWLo, PWHi, AD, SR
+//   filter:     FCLo, FCHi, ResFilt, ModVol
+//   per LFO:    destination, shape, uint16 rate in mHz, int16 depth
+//
+// Later versions only append to the body, so a reader takes any version whose body is at least as long as the
+// one it knows; LFO destinations and shapes it does not know are read as none and sine. Encoded patches may live
+// in flash on AVR or in a file on the host.
+//
+// loadPatch() compares a patch against the register image of a chip and only writes what differs, the voice
+// frequencies and gate bits are left alone so held notes keep sounding with the new sound.
+
+// what a patch LFO modulates; the patch only stores it, routing is up to the sketch
+enum PatchModDestination : uint8_t {
+    PATCH_MOD_NONE,
+    PATCH_MOD_PITCH,
+    PATCH_MOD_PW,
+    PATCH_MOD_CUTOFF,
+    PATCH_MOD_VOLUME
+};
+
+struct PatchLFO {
+    PatchModDestination destination = PATCH_MOD_NONE;
+    LFOShape shape = LFO_SINE;
+    uint16_t rate = 0;
+    int16_t depth = 0;
+};
+
+struct SIDPatch {
+    static const uint8_t NUM_LFOS = 2;
+
+    // register image of the chip, the frequency registers and gate bits are not part of the patch
+    uint8_t regs[SIDLayout::NUM_WO_REGS] = {};
+
+    PatchLFO lfos[NUM_LFOS];
+
+    // one bit per register a patch sets
+    static const uint32_t REGS = ((1UL << SIDLayout::NUM_WO_REGS) - 1) &
+                                 ~(0x3UL << SIDVoiceLayout::SIDRegFQLo) &
+                                 ~(0x3UL << (SIDLayout::NUM_VOICE_REGS + SIDVoiceLayout::SIDRegFQLo)) &
+                                 ~(0x3UL << (2 * SIDLayout::NUM_VOICE_REGS + SIDVoiceLayout::SIDRegFQLo));
+};
+
+class PatchFormat {
+public:
+    static constexpr char MAGIC[2] = { 'S', 'P' };
+    static const uint8_t VERSION = 1;
+    static const uint8_t HEADER_SIZE = 4;
+    static const uint8_t VOICE_SIZE = 5;
+    static const uint8_t LFO_SIZE = 6;
+    static const uint8_t BODY_SIZE = SIDLayout::NUM_VOICES * VOICE_SIZE + SIDLayout::NUM_FILTER_REGS +
+                                     SIDPatch::NUM_LFOS * LFO_SIZE;
+    static const uint8_t SIZE = HEADER_SIZE + BODY_SIZE;
+
+private:
+    // patch registers in the order they are stored
+    static constexpr uint8_t VOICE_REGS[VOICE_SIZE] = {
+        SIDVoiceLayout::SIDRegWvCtl, SIDVoiceLayout::SIDRegPWLo, SIDVoiceLayout::SIDRegPWHi,
+        SIDVoiceLayout::SIDRegAD, SIDVoiceLayout::SIDRegSR
+    };
+
+    // reads RAM or, on AVR, flash
+    class Reader {
+    private:
+        const uint8_t *p;
+        const bool flash;
+
+    public:
+        Reader(const uint8_t *p, const bool flash) : p(p), flash(flash) {
+        }
+
+        inline uint8_t byte() {
+            return flash ? progmemRead(p++) : *p++;
+        }
+
+        inline uint16_t word() {
+            const uint8_t lo = byte();
+
+            return (uint16_t) (lo | (uint16_t) byte() << 8);
+        }
+    };
+
+public:
+    // writes SIZE bytes, returns their number
+    static size_t encode(const SIDPatch &patch, uint8_t *out) {
+        uint8_t *p = out;
+
+        *p++ = MAGIC[0];
+        *p++ = MAGIC[1];
+        *p++ = VERSION;
+        *p++ = BODY_SIZE;
+
+        for(uint8_t v = 0; v < SIDLayout::NUM_VOICES; v++) {
+            for(uint8_t i = 0; i < VOICE_SIZE; i++) {
+                const uint8_t reg = v * SIDLayout::NUM_VOICE_REGS + VOICE_REGS[i];
+
+                *p++ = VOICE_REGS[i] == SIDVoiceLayout::SIDRegWvCtl ?
+                       patch.regs[reg] & ~SIDVoiceLayout::SIDCtlGat : patch.regs[reg];
+            }
+        }
+
+        for(uint8_t reg = SIDFilterLayout::SIDRegFCLo; reg <= SIDFilterLayout::SIDRegModVol; reg++) {
+            *p++ = patch.regs[reg];
+        }
+
+        for(const PatchLFO &lfo : patch.lfos) {
+            *p++ = lfo.destination;
+            *p++ = lfo.shape;
+            *p++ = (uint8_t) lfo.rate;
+            *p++ = (uint8_t) (lfo.rate >> 8);
+            *p++ = (uint8_t) lfo.depth;
+            *p++ = (uint8_t) ((uint16_t) lfo.depth >> 8);
+        }
+
+        return p - out;
+    }
+
+    // decode a patch from RAM or from flash; false if it is no patch or one of an older, shorter version. An LFO
+    // destination or shape this version does not know, e.g. one added by a later version, is read as
+    // PATCH_MOD_NONE or LFO_SINE.
+    static bool decode(const uint8_t *data, SIDPatch &patch, const bool flash = false) {
+        Reader in(data, flash);
+
+        if(in.byte() != MAGIC[0] || in.byte() != MAGIC[1] || in.byte() < 1 || in.byte() < BODY_SIZE) {
+            return false;
+        }
+
+        patch = SIDPatch();
+
+        for(uint8_t v = 0; v < SIDLayout::NUM_VOICES; v++) {
+            for(uint8_t i = 0; i < VOICE_SIZE; i++) {
+                patch.regs[v * SIDLayout::NUM_VOICE_REGS + VOICE_REGS[i]] = in.byte();
+            }
+
+            patch.regs[v * SIDLayout::NUM_VOICE_REGS + SIDVoiceLayout::SIDRegWvCtl] &= ~SIDVoiceLayout::SIDCtlGat;
+        }
+
+        for(uint8_t reg = SIDFilterLayout::SIDRegFCLo; reg <= SIDFilterLayout::SIDRegModVol; reg++) {
+            patch.regs[reg] = in.byte();
+        }
+
+        for(PatchLFO &lfo : patch.lfos) {
+            const uint8_t destination = in.byte();
+            const uint8_t shape = in.byte();
+
+            // the LFO engine indexes its tables by shape
+            lfo.destination = destination <= PATCH_MOD_VOLUME ? (PatchModDestination) destination : PATCH_MOD_NONE;
+            lfo.shape = shape <= LFO_RECTANGLE ? (LFOShape) shape : LFO_SINE;
+            lfo.rate = in.word();
+            lfo.depth = (int16_t) in.word();
+        }
+
+        return true;
+    }
+
+#if !defined(ARDUINO)
+
+    static bool save(const char *path, const SIDPatch &patch) {
+        uint8_t data[SIZE];
+        std::ofstream out(path, std::ios::binary);
+
+        out.write((const char *) data, encode(patch, data));
+
+        return out.good();
+    }
+
+    // reads a patch of this or a later version
+    static bool load(const char *path, SIDPatch &patch) {
+        std::ifstream in(path, std::ios::binary);
+        uint8_t header[HEADER_SIZE];
+
+        if(!in.read((char *) header, HEADER_SIZE) || header[3] < BODY_SIZE) {
+            return false;
+        }
+
+        uint8_t data[HEADER_SIZE + 255];
+
+        memcpy(data, header, HEADER_SIZE);
+
+        return in.read((char *) data + HEADER_SIZE, header[3]) && decode(data, patch);
+    }
+
+#endif // !ARDUINO
+};
+
+// take the patch registers of a chip, e.g. one set up with the setters, the LFOs are left as they are
+template <typename S>
+void capturePatch(const S &sid, SIDPatch &patch) {
+    const uint8_t *regs = sid.getRegisters();
+
+    for(uint8_t reg = 0; reg < SIDLayout::NUM_WO_REGS; reg++) {
+        patch.regs[reg] = SIDPatch::REGS & (1UL << reg) ? regs[reg] : 0;
+    }
+
+    for(uint8_t v = 0; v < SIDLayout::NUM_VOICES; v++) {
+        patch.regs[v * SIDLayout::NUM_VOICE_REGS + SIDVoiceLayout::SIDRegWvCtl] &= ~SIDVoiceLayout::SIDCtlGat;
+    }
+}
+
+// set a chip to a patch, writing only the registers which differ; returns the number of registers written
+template <typename S>
+uint8_t loadPatch(S &sid, const SIDPatch &patch) {
+    const uint8_t *current = sid.getRegisters();
+    uint32_t regs = SIDPatch::REGS;
+    uint8_t n = 0;
+
+    for(uint8_t reg = 0; regs; reg++, regs >>= 1) {
+        if(!(regs & 1)) {
+            continue;
+        }
+
+        uint8_t val = patch.regs[reg];
+
+        if(reg < SIDFilterLayout::SIDRegFCLo && reg % SIDLayout::NUM_VOICE_REGS == SIDVoiceLayout::SIDRegWvCtl) {
+            val = (val & ~SIDVoiceLayout::SIDCtlGat) | (current[reg] & SIDVoiceLayout::SIDCtlGat);
+        }
+
+        if(val != current[reg]) {
+            sid.setRegister(reg, val);
+            n++;
+        }
+    }
+
+    return n;
+}
+
+// load a patch into the chips of a SIDArray, one bit per chip; returns the number of registers written
+template <uint8_t N, typename Sink>
+uint8_t loadPatch(SIDArray<N, Sink> &sidArray, const SIDPatch &patch, const uint8_t chips = 0xff) {
+    uint8_t n = 0;
+
+    for(uint8_t sid = 0; sid < N; sid++) {
+        if(chips & (1 << sid)) {
+            n += loadPatch(sidArray.getSID(sid), patch);
+        }
+    }
+
+    return n;
+}
+
+// set up LFOs first and first + 1 of an engine from a patch
+template <uint8_t N>
+void loadPatchLFOs(LFOEngine<N> &engine, const uint8_t first, const SIDPatch &patch) {
+    for(uint8_t i = 0; i < SIDPatch::NUM_LFOS && first + i < N; i++) {
+        engine.setShape(first + i, patch.lfos[i].shape);
+        engine.setRate(first + i, patch.lfos[i].rate);
+        engine.setDepth(first + i, patch.lfos[i].depth);
+    }
+}
+
+#endif // ARDUINOSID_PATCH_H
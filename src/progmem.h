@@ -0,0 +1,47 @@
+#pragma once
+
+#ifndef ARDUINOSID_PROGMEM_H
+#define ARDUINOSID_PROGMEM_H
+
+#include <cstdint>
+
+// constant tables live in flash on AVR and have to be read with the pgm_read functions there; on other targets
+// they are plain arrays
+
+#if defined(__AVR__)
+
+#include <avr/pgmspace.h>
+
+#define ARDUINOSID_PROGMEM PROGMEM
+
+static inline uint8_t progmemRead(const uint8_t *p) {
+    return pgm_read_byte(p);
+}
+
+static inline uint16_t progmemRead(const uint16_t *p) {
+    return pgm_read_word(p);
+}
+
+static inline int16_t progmemRead(const int16_t *p) {
+    return (int16_t) pgm_read_word(p);
+}
+
+#else
+
+#define ARDUINOSID_PROGMEM
+
+static inline uint8_t progmemRead(const uint8_t *p) {
+    return *p;
+}
+
+static inline uint16_t progmemRead(const uint16_t *p) {
+    return *p;
+}
+
+static inline int16_t progmemRead(const int16_t *p) {
+    return *p;
+}
+
+#endif
+
+#endif // ARDUINOSID_PROGMEM_H
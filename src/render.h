@@ -0,0 +1,304 @@
+#pragma once
+
+#ifndef ARDUINOSID_RENDER_H
+#define ARDUINOSID_RENDER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "sid.h"
+#include "sidemu.h"
+#include "ringbuffer.h"
+#include "trace.h"
+
+// host side offline rendering of register write streams for a whole SIDArray, with the chips on worker threads
+//
+// The renderer is a register sink like SIDEmulator, but it only records the writes, split by chip and stamped
+// with the output frame set by setTime(), or it takes them from a trace. render() then emulates every chip on
+// its own SIDEmulator<1>, the chips spread round robin over the worker threads, and mixes them in the calling
+// thread.
+//
+// Each chip has a pool of QUEUE_BLOCKS blocks of BLOCK_FRAMES samples which go round between its worker and the
+// mixer through two SPSCRingBuffers, one for rendered blocks and one for free ones. A worker can thus run up to
+// QUEUE_BLOCKS blocks ahead of the mixer, and the mixer waits for the slowest chip for one block at most before
+// the others stall. Writes take effect at their exact frame, not at block boundaries.
+//
+// The mix is the same as SIDEmulator<N>::render() gives for the same writes, as long as no single chip clips.
+
+// output file formats of OfflineRenderer::renderFile()
+enum RenderFormat : uint8_t {
+    // 16 bit mono PCM WAV file
+    RENDER_WAV,
+
+    // headerless 16 bit little endian mono samples
+    RENDER_RAW
+};
+
+template <uint8_t N, size_t BLOCK_FRAMES = 1024, uint8_t QUEUE_BLOCKS = 8>
+class OfflineRenderer {
+    static_assert(N >= 1 && N <= 6, "unsupported number of SIDs");
+    static_assert(QUEUE_BLOCKS >= 2 && (QUEUE_BLOCKS & (QUEUE_BLOCKS - 1)) == 0,
+                  "OfflineRenderer queue must be a power of two blocks");
+
+public:
+    static const uint8_t NUM_SIDS = N;
+
+private:
+    struct Write {
+        uint64_t frame;
+        uint8_t reg;
+        uint8_t val;
+    };
+
+    // one chip while rendering: the emulator, its blocks and the queues they go round in; twice the pool so
+    // neither queue ever fills up
+    struct Lane {
+        SIDEmulator<1> emu;
+        int16_t blocks[QUEUE_BLOCKS][BLOCK_FRAMES];
+        SPSCRingBuffer<uint8_t, QUEUE_BLOCKS * 2> rendered;
+        SPSCRingBuffer<uint8_t, QUEUE_BLOCKS * 2> free;
+
+        // next write to apply and the frame the emulator is at
+        size_t next = 0;
+        uint64_t frame = 0;
+
+        Lane(const uint32_t clock, const uint32_t sampleRate) : emu(clock, sampleRate) {
+            for(uint8_t i = 0; i < QUEUE_BLOCKS; i++) {
+                free.put(i);
+            }
+        }
+    };
+
+    const uint32_t clock;
+    const uint32_t sampleRate;
+
+    std::vector<Write> writes[N];
+    uint64_t now = 0;
+
+    SIDModel models[N] = {};
+
+    // render the next frames of a chip, applying its writes on the way
+    void renderLane(Lane &lane, const std::vector<Write> &w, int16_t *out, const size_t frames) {
+        const uint64_t end = lane.frame + frames;
+
+        while(lane.frame < end) {
+            while(lane.next < w.size() && w[lane.next].frame <= lane.frame) {
+                lane.emu.write(0, w[lane.next].reg, w[lane.next].val);
+                lane.next++;
+            }
+
+            const uint64_t until = lane.next < w.size() && w[lane.next].frame < end ? w[lane.next].frame : end;
+
+            lane.emu.render((size_t) (until - lane.frame), out);
+            out += until - lane.frame;
+            lane.frame = until;
+        }
+    }
+
+    // worker thread: render all blocks of the chips first, first + step, ...
+    void work(Lane **lanes, const uint8_t first, const uint8_t step, const uint64_t frames) {
+        for(uint64_t start = 0; start < frames; start += BLOCK_FRAMES) {
+            const size_t n = (size_t) (frames - start < BLOCK_FRAMES ? frames - start : BLOCK_FRAMES);
+
+            for(uint8_t sid = first; sid < N; sid += step) {
+                Lane &lane = *lanes[sid];
+                uint8_t block;
+
+                while(!lane.free.pop(block)) {
+                    ringBufferPause();
+                }
+
+                renderLane(lane, writes[sid], lane.blocks[block], n);
+                lane.rendered.put(block);
+            }
+        }
+    }
+
+public:
+    OfflineRenderer(const uint32_t clock = SIDEmulation::PAL_CLOCK, const uint32_t sampleRate = 44100)
+        : clock(clock), sampleRate(sampleRate) {
+    }
+
+    OfflineRenderer(const OfflineRenderer&) = delete;
+
+    uint32_t getSampleRate() const {
+        return sampleRate;
+    }
+
+    // chip model of one chip for the following renders
+    void setModel(const uint8_t sid, const SIDModel model) {
+        assert(sid < N);
+
+        models[sid] = model;
+    }
+
+    // sink interface, records a write at the current frame
+    bool write(const uint8_t sid, const uint8_t reg, const uint8_t val) {
+        if(sid >= N || reg >= SIDLayout::NUM_WO_REGS) {
+            return false;
+        }
+
+        writes[sid].push_back({ now, reg, val });
+
+        return true;
+    }
+
+    // frame the following writes take effect at; time never runs backwards
+    void setTime(const uint64_t frame) {
+        now = frame < now ? now : frame;
+    }
+
+    uint64_t getTime() const {
+        return now;
+    }
+
+    // record the writes of a trace at the frames its ticks fall on; returns the number of writes taken, writes
+    // to chips beyond N are left out
+    size_t load(TraceReader &trace) {
+        const uint64_t rate = trace.getTickRate() ? trace.getTickRate() : sampleRate;
+        size_t taken = 0;
+        uint64_t ticks;
+        uint8_t sid, reg, val;
+
+        trace.rewind();
+
+        while(trace.next(ticks, sid, reg, val)) {
+            setTime(ticks / rate * sampleRate + ticks % rate * sampleRate / rate);
+            taken += write(sid, reg, val);
+        }
+
+        return taken;
+    }
+
+    void clear() {
+        for(std::vector<Write> &w : writes) {
+            w.clear();
+        }
+
+        now = 0;
+    }
+
+    size_t getWrites() const {
+        size_t n = 0;
+
+        for(const std::vector<Write> &w : writes) {
+            n += w.size();
+        }
+
+        return n;
+    }
+
+    // render frames samples from reset with the chips spread over 1 to N worker threads; out is called with the
+    // mixed samples block by block as out(const int16_t *samples, size_t n)
+    template <typename Out>
+    void render(const uint64_t frames, uint8_t threads, Out out) {
+        std::unique_ptr<Lane> owned[N];
+        Lane *lanes[N];
+
+        threads = threads < 1 ? 1 : threads > N ? N : threads;
+
+        for(uint8_t sid = 0; sid < N; sid++) {
+            owned[sid].reset(new Lane(clock, sampleRate));
+            owned[sid]->emu.setModel(0, models[sid]);
+            lanes[sid] = owned[sid].get();
+        }
+
+        std::vector<std::thread> workers;
+
+        for(uint8_t t = 0; t < threads; t++) {
+            workers.emplace_back(&OfflineRenderer::work, this, lanes, t, threads, frames);
+        }
+
+        int16_t mixed[BLOCK_FRAMES];
+        int32_t sum[BLOCK_FRAMES];
+
+        for(uint64_t start = 0; start < frames; start += BLOCK_FRAMES) {
+            const size_t n = (size_t) (frames - start < BLOCK_FRAMES ? frames - start : BLOCK_FRAMES);
+
+            for(size_t i = 0; i < n; i++) {
+                sum[i] = 0;
+            }
+
+            for(uint8_t sid = 0; sid < N; sid++) {
+                Lane &lane = *lanes[sid];
+                uint8_t block;
+
+                while(!lane.rendered.pop(block)) {
+                    ringBufferPause();
+                }
+
+                for(size_t i = 0; i < n; i++) {
+                    sum[i] += lane.blocks[block][i];
+                }
+
+                lane.free.put(block);
+            }
+
+            for(size_t i = 0; i < n; i++) {
+                const int32_t sample = sum[i] / N;
+
+                mixed[i] = (int16_t) (sample > 32767 ? 32767 : sample < -32768 ? -32768 : sample);
+            }
+
+            out((const int16_t *) mixed, n);
+        }
+
+        for(std::thread &worker : workers) {
+            worker.join();
+        }
+    }
+
+    // 44 byte header of a 16 bit mono PCM WAV file
+    static void writeWAVHeader(uint8_t *header, const uint32_t sampleRate, const uint64_t frames) {
+        const uint32_t dataSize = (uint32_t) (frames * 2);
+
+        auto put32 = [&](const size_t pos, const uint32_t v) {
+            for(uint8_t i = 0; i < 4; i++) {
+                header[pos + i] = (uint8_t) (v >> (i * 8));
+            }
+        };
+
+        memcpy(header, "RIFF", 4);
+        put32(4, 36 + dataSize);
+        memcpy(header + 8, "WAVEfmt ", 8);
+        put32(16, 16);
+        put32(20, 1 | 1 << 16);           // PCM, mono
+        put32(24, sampleRate);
+        put32(28, sampleRate * 2);        // bytes per second
+        put32(32, 2 | 16 << 16);          // bytes per frame, bits per sample
+        memcpy(header + 36, "data", 4);
+        put32(40, dataSize);
+    }
+
+    // render into a file, returns false if it cannot be written
+    bool renderFile(const char *path, const uint64_t frames, const uint8_t threads,
+                    const RenderFormat format = RENDER_WAV) {
+        std::ofstream file(path, std::ios::binary);
+
+        if(format == RENDER_WAV) {
+            uint8_t header[44];
+
+            writeWAVHeader(header, sampleRate, frames);
+            file.write((const char *) header, sizeof(header));
+        }
+
+        render(frames, threads, [&](const int16_t *samples, const size_t n) {
+            uint8_t bytes[BLOCK_FRAMES * 2];
+
+            for(size_t i = 0; i < n; i++) {
+                bytes[2 * i] = (uint8_t) samples[i];
+                bytes[2 * i + 1] = (uint8_t) ((uint16_t) samples[i] >> 8);
+            }
+
+            file.write((const char *) bytes, n * 2);
+        });
+
+        return file.good();
+    }
+};
+
+#endif // ARDUINOSID_RENDER_H
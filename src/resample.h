@@ -0,0 +1,430 @@
+#pragma once
+
+#ifndef ARDUINOSID_RESAMPLE_H
+#define ARDUINOSID_RESAMPLE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+#include "freq.h"
+#include "sidemu_kernels.h"
+
+// host side band-limited resampling from the phi2 clock rate to audio rates
+//
+// A model of the chip that runs once per phi2 cycle, e.g. SIDEmulator constructed with the clock as its sample
+// rate, produces about 1 MHz of samples, which have to be decimated by about 20 for 44.1 or 48 kHz output.
+//
+// SIDResampler is a polyphase FIR resampler. Its prototype is a Kaiser windowed sinc sampled at PHASES times
+// the input rate and stored as PHASES + 1 rows of taps, one row per fractional position of an output sample
+// between two input samples. Each output sample takes the dot products of the input with the two rows around
+// its position and interpolates linearly between them, which keeps the bank small at any ratio.
+//
+// The passband ends at 0.45 of the output rate, at most at 20 kHz, and the stopband starts at the output rate
+// minus the passband edge: whatever lies between the two aliases to above the passband, where nobody
+// hears it, and the transition band is twice as wide as with the stopband at half the output rate. The
+// quality sets the stopband attenuation, and with it the number of taps, the cost and the latency.
+//
+// Banks are computed once per clock, rate and quality and shared by all resamplers, precompute() builds them
+// for the PAL and NTSC clocks and 44.1, 48 and 96 kHz up front. The dot products run in one kernel written
+// against GCC vector types like the voice kernels in sidemu_kernels.h, as scalar, SSE2 and AVX2 code; the
+// vector kernels sum in a different order, so they match the scalar kernel only to float precision.
+
+enum ResamplerQuality : uint8_t {
+    // 60 dB stopband, the fewest taps
+    RESAMPLE_FAST,
+
+    // 90 dB stopband
+    RESAMPLE_GOOD,
+
+    // 120 dB stopband, about twice the taps and latency of RESAMPLE_FAST
+    RESAMPLE_BEST
+};
+
+class ResamplerBank {
+public:
+    // rows of taps per input sample
+    static const uint16_t PHASES = 64;
+
+    // taps are a multiple of the widest kernel
+    static const uint8_t TAP_ALIGN = 8;
+
+    const uint32_t inputRate;
+    const uint32_t outputRate;
+    const ResamplerQuality quality;
+
+    // passband and stopband edges in Hz
+    const double passband;
+    const double stopband;
+
+    // stopband attenuation in dB
+    const double attenuation;
+
+    // taps per row
+    const size_t taps;
+
+private:
+    // PHASES + 1 rows of taps
+    std::vector<float> coeffs;
+
+    static double attenuationOf(const ResamplerQuality quality) {
+        return quality == RESAMPLE_FAST ? 60.0 : quality == RESAMPLE_GOOD ? 90.0 : 120.0;
+    }
+
+    static double passbandOf(const uint32_t outputRate) {
+        return outputRate * 0.45 < 20000.0 ? outputRate * 0.45 : 20000.0;
+    }
+
+    // Kaiser's estimate of the filter length for an attenuation and transition width, which falls a little
+    // short right at the stopband edge, so with a margin of 10%
+    static size_t tapsFor(const uint32_t inputRate, const double attenuation, const double transition) {
+        const size_t n = (size_t) ceil((attenuation - 7.95) / (2.285 * 2.0 * M_PI * 0.9 * transition / inputRate)) + 1;
+
+        return (n + TAP_ALIGN - 1) / TAP_ALIGN * TAP_ALIGN;
+    }
+
+    // modified Bessel function of the first kind, order 0
+    static double besselI0(const double x) {
+        double sum = 1.0;
+        double term = 1.0;
+
+        for(int k = 1; k < 64 && term > sum * 1e-17; k++) {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+        }
+
+        return sum;
+    }
+
+public:
+    ResamplerBank(const uint32_t inputRate, const uint32_t outputRate, const ResamplerQuality quality)
+        : inputRate(inputRate),
+          outputRate(outputRate),
+          quality(quality),
+          passband(passbandOf(outputRate)),
+          stopband(outputRate - passbandOf(outputRate)),
+          attenuation(attenuationOf(quality)),
+          taps(tapsFor(inputRate, attenuationOf(quality), stopband - passband)),
+          coeffs((PHASES + 1) * taps) {
+        const double a = attenuation;
+        const double beta = a > 50.0 ? 0.1102 * (a - 8.7) : 0.5842 * pow(a - 21.0, 0.4) + 0.07886 * (a - 21.0);
+        const double cutoff = (passband + stopband) / 2.0 / inputRate;
+        const double half = taps / 2.0;
+
+        // row p holds the taps for an output sample p / PHASES of an input sample after the input sample
+        // taps / 2 - 1 of the window
+        for(uint16_t p = 0; p <= PHASES; p++) {
+            float *row = &coeffs[p * taps];
+            double sum = 0.0;
+
+            for(size_t j = 0; j < taps; j++) {
+                const double t = (double) p / PHASES + half - 1.0 - (double) j;
+                const double x = t / half;
+                const double sinc = t == 0.0 ? 1.0 : sin(2.0 * M_PI * cutoff * t) / (2.0 * M_PI * cutoff * t);
+                const double window = x * x < 1.0 ? besselI0(beta * sqrt(1.0 - x * x)) / besselI0(beta) : 0.0;
+                const double c = 2.0 * cutoff * sinc * window;
+
+                row[j] = (float) c;
+                sum += c;
+            }
+
+            // unity gain at DC for every position
+            for(size_t j = 0; j < taps; j++) {
+                row[j] = (float) (row[j] / sum);
+            }
+        }
+    }
+
+    ResamplerBank(const ResamplerBank&) = delete;
+
+    inline const float *row(const uint16_t phase) const {
+        return &coeffs[phase * taps];
+    }
+
+    // the shared bank for a clock, rate and quality, built on first use
+    static std::shared_ptr<const ResamplerBank> get(const uint32_t inputRate, const uint32_t outputRate,
+                                                    const ResamplerQuality quality) {
+        static std::mutex mutex;
+        static std::map<std::tuple<uint32_t, uint32_t, uint8_t>, std::shared_ptr<const ResamplerBank>> banks;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        std::shared_ptr<const ResamplerBank> &bank = banks[std::make_tuple(inputRate, outputRate, (uint8_t) quality)];
+
+        if(!bank) {
+            bank = std::make_shared<const ResamplerBank>(inputRate, outputRate, quality);
+        }
+
+        return bank;
+    }
+
+    // build the banks for the PAL and NTSC clocks and 44.1, 48 and 96 kHz
+    static void precompute(const ResamplerQuality quality = RESAMPLE_GOOD) {
+        static const uint32_t clocks[2] = { Frequency::PAL_CLOCK, Frequency::NTSC_CLOCK };
+        static const uint32_t rates[3] = { 44100, 48000, 96000 };
+
+        for(uint32_t clock : clocks) {
+            for(uint32_t rate : rates) {
+                get(clock, rate, quality);
+            }
+        }
+    }
+};
+
+// the resampler kernel: dot products of the input with two rows of taps at once
+
+typedef float SIDVec1f __attribute__((vector_size(4)));
+typedef float SIDVec4f __attribute__((vector_size(16)));
+typedef float SIDVec8f __attribute__((vector_size(32)));
+
+template <typename V>
+static inline __attribute__((always_inline))
+void resamplerKernel(const float *x, const float *c0, const float *c1, const size_t taps, float &s0, float &s1) {
+    const uint8_t WIDTH = sizeof(V) / sizeof(float);
+
+    // two accumulators per row hide the latency of the adds
+    V a0 = V{}, a1 = V{}, b0 = V{}, b1 = V{};
+    size_t j = 0;
+
+    for(; j + 2 * WIDTH <= taps; j += 2 * WIDTH) {
+        V x0, x1, u0, u1, v0, v1;
+
+        memcpy(&x0, x + j, sizeof(V));
+        memcpy(&x1, x + j + WIDTH, sizeof(V));
+        memcpy(&u0, c0 + j, sizeof(V));
+        memcpy(&u1, c0 + j + WIDTH, sizeof(V));
+        memcpy(&v0, c1 + j, sizeof(V));
+        memcpy(&v1, c1 + j + WIDTH, sizeof(V));
+
+        a0 += x0 * u0;
+        a1 += x1 * u1;
+        b0 += x0 * v0;
+        b1 += x1 * v1;
+    }
+
+    for(; j + WIDTH <= taps; j += WIDTH) {
+        V x0, u0, v0;
+
+        memcpy(&x0, x + j, sizeof(V));
+        memcpy(&u0, c0 + j, sizeof(V));
+        memcpy(&v0, c1 + j, sizeof(V));
+
+        a0 += x0 * u0;
+        b0 += x0 * v0;
+    }
+
+    a0 += a1;
+    b0 += b1;
+    s0 = 0.0f;
+    s1 = 0.0f;
+
+    for(uint8_t i = 0; i < WIDTH; i++) {
+        s0 += a0[i];
+        s1 += b0[i];
+    }
+}
+
+typedef void (*ResamplerKernelFn)(const float *x, const float *c0, const float *c1, size_t taps, float &s0, float &s1);
+
+static inline void resamplerKernelScalar(const float *x, const float *c0, const float *c1, const size_t taps,
+                                         float &s0, float &s1) {
+    resamplerKernel<SIDVec1f>(x, c0, c1, taps, s0, s1);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse2")))
+static inline void resamplerKernelSSE2(const float *x, const float *c0, const float *c1, const size_t taps,
+                                       float &s0, float &s1) {
+    resamplerKernel<SIDVec4f>(x, c0, c1, taps, s0, s1);
+}
+
+__attribute__((target("avx2")))
+static inline void resamplerKernelAVX2(const float *x, const float *c0, const float *c1, const size_t taps,
+                                       float &s0, float &s1) {
+    resamplerKernel<SIDVec8f>(x, c0, c1, taps, s0, s1);
+}
+
+static inline ResamplerKernelFn resamplerKernelFn(const SIDKernel kernel) {
+    switch(kernel) {
+        case SID_KERNEL_SSE2:
+            return resamplerKernelSSE2;
+
+        case SID_KERNEL_AVX2:
+            return resamplerKernelAVX2;
+
+        default:
+            return resamplerKernelScalar;
+    }
+}
+
+#else
+
+static inline ResamplerKernelFn resamplerKernelFn(const SIDKernel) {
+    return resamplerKernelScalar;
+}
+
+#endif
+
+class SIDResampler {
+private:
+    // input samples taken per round
+    static const size_t CHUNK = 4096;
+
+    std::shared_ptr<const ResamplerBank> bank;
+
+    SIDKernel kernel;
+    ResamplerKernelFn kernelFn;
+
+    // input position of the next output sample in the buffer, 32.32 fixed point, and the step per output sample
+    uint64_t pos;
+    const uint64_t step;
+
+    // input samples not used up yet, the window of the next output sample starts at the beginning
+    std::vector<float> buffer;
+    size_t fill;
+
+public:
+    SIDResampler(const uint32_t inputRate = Frequency::PAL_CLOCK, const uint32_t outputRate = 44100,
+                 const ResamplerQuality quality = RESAMPLE_GOOD)
+        : bank(ResamplerBank::get(inputRate, outputRate, quality)),
+          step(((uint64_t) inputRate << 32) / outputRate),
+          buffer(bank->taps + CHUNK) {
+        setKernel(sidBestKernel());
+        reset();
+    }
+
+    // back to silence, the first output sample falls on the next input sample
+    void reset() {
+        const size_t half = bank->taps / 2;
+
+        memset(buffer.data(), 0, half * sizeof(float));
+        fill = half;
+        pos = (uint64_t) half << 32;
+    }
+
+    // select the dot product kernel, returns false if the CPU does not support it
+    bool setKernel(const SIDKernel kernel) {
+        if(!sidKernelSupported(kernel)) {
+            return false;
+        }
+
+        this->kernel = kernel;
+        kernelFn = resamplerKernelFn(kernel);
+
+        return true;
+    }
+
+    SIDKernel getKernel() const {
+        return kernel;
+    }
+
+    const ResamplerBank &getBank() const {
+        return *bank;
+    }
+
+    // delay of the output in output samples
+    double getLatency() const {
+        return (double) bank->taps / 2 * bank->outputRate / bank->inputRate;
+    }
+
+    // most output samples process() can return for n input samples
+    size_t maxOutput(const size_t n) const {
+        return (size_t) (((uint64_t) n << 32) / step) + 2;
+    }
+
+    // resample n input samples, returns the number of output samples written to out, which must have room for
+    // maxOutput(n) of them
+    template <typename In, typename Out>
+    size_t process(const In *in, size_t n, Out *out) {
+        const size_t taps = bank->taps;
+        size_t written = 0;
+
+        while(n) {
+            const size_t take = n < CHUNK ? n : CHUNK;
+
+            for(size_t i = 0; i < take; i++) {
+                buffer[fill + i] = (float) in[i];
+            }
+
+            fill += take;
+            in += take;
+            n -= take;
+
+            // the window of an output sample at input position p covers [p - taps / 2 + 1, p + taps / 2]
+            while((pos >> 32) + taps / 2 < fill) {
+                const size_t start = (size_t) (pos >> 32) + 1 - taps / 2;
+                const uint32_t frac = (uint32_t) pos;
+                const uint16_t phase = (uint16_t) (((uint64_t) frac * ResamplerBank::PHASES) >> 32);
+                const float weight = (float) ((uint32_t) (frac * ResamplerBank::PHASES)) * (1.0f / 4294967296.0f);
+                float s0, s1;
+
+                kernelFn(&buffer[start], bank->row(phase), bank->row(phase + 1), taps, s0, s1);
+                store(out[written++], s0 + weight * (s1 - s0));
+                pos += step;
+            }
+
+            // keep what the next window needs
+            size_t used = (size_t) (pos >> 32) + 1 - taps / 2;
+
+            used = used < fill ? used : fill;
+
+            memmove(buffer.data(), buffer.data() + used, (fill - used) * sizeof(float));
+            fill -= used;
+            pos -= (uint64_t) used << 32;
+        }
+
+        return written;
+    }
+
+    // gain in dB at a frequency, from the RMS of the output for a full scale sine in the input once the
+    // filter has settled, over whole periods; above half the output rate it is what aliases back
+    static double measureGain(const uint32_t inputRate, const uint32_t outputRate, const ResamplerQuality quality,
+                              const double hz, const SIDKernel kernel = sidBestKernel()) {
+        SIDResampler resampler(inputRate, outputRate, quality);
+        const size_t n = inputRate / 5;
+        std::vector<float> in(n);
+        std::vector<float> out(resampler.maxOutput(n));
+
+        resampler.setKernel(kernel);
+
+        for(size_t i = 0; i < n; i++) {
+            in[i] = (float) sin(2.0 * M_PI * hz * (double) i / inputRate);
+        }
+
+        // the frequency the sine comes out at
+        double alias = fmod(hz, (double) outputRate);
+
+        alias = alias > outputRate / 2.0 ? outputRate - alias : alias;
+
+        const size_t written = resampler.process(in.data(), n, out.data());
+        const size_t settled = (size_t) resampler.getLatency() * 2 + 16;
+        const double period = alias > 0.0 ? outputRate / alias : 1.0;
+        const size_t length = (size_t) (floor((written - settled) / period) * period + 0.5);
+        double sum = 0.0;
+
+        for(size_t i = settled; i < settled + length; i++) {
+            sum += (double) out[i] * out[i];
+        }
+
+        return 10.0 * log10(sum / length / 0.5 + 1e-30);
+    }
+
+private:
+    static inline void store(float &out, const float v) {
+        out = v;
+    }
+
+    static inline void store(int16_t &out, const float v) {
+        const float r = v < 0.0f ? v - 0.5f : v + 0.5f;
+
+        out = (int16_t) (r > 32767.0f ? 32767.0f : r < -32768.0f ? -32768.0f : r);
+    }
+};
+
+#endif // ARDUINOSID_RESAMPLE_H
@@ -4,6 +4,13 @@
 #define ARDUINOSID_RINGBUFFER_H
 
 #include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#if !defined(__AVR__)
+#include <atomic>
+#include <thread>
+#endif
 
 // a flaky ring buffer implementation
 
@@ -71,4 +78,233 @@ public:
     }
 };
 
+// index shared between producer and consumer of a SPSCRingBuffer, only one side ever stores it
+
+#if defined(__AVR__)
+
+// single byte loads and stores are atomic on AVR, so a compiler barrier is all that is needed
+
+template <typename I>
+class RingBufferIndex {
+private:
+    volatile I value = 0;
+
+public:
+    // the barrier after the read keeps later buffer reads from moving above it
+    inline I load() const {
+        const I v = value;
+
+        __asm__ __volatile__("" ::: "memory");
+
+        return v;
+    }
+
+    inline void store(const I v) {
+        __asm__ __volatile__("" ::: "memory");
+
+        value = v;
+    }
+};
+
+#else
+
+template <typename I>
+class RingBufferIndex {
+private:
+    std::atomic<I> value{0};
+
+public:
+    inline I load() const {
+        return value.load(std::memory_order_acquire);
+    }
+
+    inline void store(const I v) {
+        value.store(v, std::memory_order_release);
+    }
+};
+
+#endif
+
+// short critical section between the main loop and an ISR or another thread, for queues whose producer also
+// touches entries the consumer owns; on AVR it disables interrupts, elsewhere it is a spin lock
+
+#if defined(__AVR__)
+
+// called while waiting for the other side of a queue; the ISR preempts the main loop on AVR, elsewhere the other
+// thread may need the cpu
+static inline void ringBufferPause() {
+}
+
+class RingBufferLock {
+private:
+    uint8_t sreg;
+
+public:
+    inline void lock() {
+        __asm__ __volatile__("in %0, __SREG__\n\tcli" : "=r" (sreg) :: "memory");
+    }
+
+    inline void unlock() {
+        __asm__ __volatile__("out __SREG__, %0" :: "r" (sreg) : "memory");
+    }
+};
+
+#else
+
+static inline void ringBufferPause() {
+    std::this_thread::yield();
+}
+
+class RingBufferLock {
+private:
+    std::atomic_flag flag = ATOMIC_FLAG_INIT;
+
+public:
+    inline void lock() {
+        while(flag.test_and_set(std::memory_order_acquire)) {
+            ringBufferPause();
+        }
+    }
+
+    inline void unlock() {
+        flag.clear(std::memory_order_release);
+    }
+};
+
+#endif
+
+// holds a RingBufferLock for the scope it lives in
+
+class RingBufferGuard {
+private:
+    RingBufferLock &l;
+
+public:
+    inline RingBufferGuard(RingBufferLock &l) : l(l) {
+        l.lock();
+    }
+
+    inline ~RingBufferGuard() {
+        l.unlock();
+    }
+
+    RingBufferGuard(const RingBufferGuard&) = delete;
+};
+
+// lock-free single producer/single consumer ring buffer
+//
+// The producer (main loop) only ever writes tail, the consumer (timer ISR) only ever writes head, so no
+// read-modify-write of shared state is needed. The size must be a power of two so that indices wrap with
+// a mask instead of a division, which AVR does not have in hardware. One slot is kept free to tell a full
+// buffer from an empty one, so at most _size - 1 elements can be stored.
+
+template <typename T, size_t _size>
+class SPSCRingBuffer {
+    static_assert(_size >= 2 && (_size & (_size - 1)) == 0, "SPSCRingBuffer size must be a power of two");
+    static_assert(_size <= 65536, "SPSCRingBuffer indices must fit into 16 bits");
+#if defined(__AVR__)
+    static_assert(_size <= 256, "SPSCRingBuffer indices must fit into a single byte on AVR");
+#endif
+
+public:
+    using index_t = typename std::conditional<(_size <= 256), uint8_t, uint16_t>::type;
+
+    static const index_t MASK = (index_t) (_size - 1);
+
+private:
+    T values[_size];
+    RingBufferIndex<index_t> head; // next element to pop, written by the consumer only
+    RingBufferIndex<index_t> tail; // next free slot, written by the producer only
+
+public:
+    static constexpr size_t capacity() {
+        return _size - 1;
+    }
+
+    // must only be called while neither producer nor consumer are active
+    void clear() {
+        head.store(0);
+        tail.store(0);
+    }
+
+    bool empty() const {
+        return head.load() == tail.load();
+    }
+
+    bool full() const {
+        return ((tail.load() + 1) & MASK) == head.load();
+    }
+
+    size_t size() const {
+        return (tail.load() - head.load()) & MASK;
+    }
+
+    // producer side
+
+    bool put(const T& elem) {
+        const index_t t = tail.load();
+        const index_t next = (t + 1) & MASK;
+
+        if(next == head.load()) {
+            return false;
+        }
+
+        values[t] = elem;
+        tail.store(next);
+
+        return true;
+    }
+
+    // put up to n elements, returns the number of elements actually stored
+    size_t put_n(const T *elems, size_t n) {
+        const index_t t = tail.load();
+        const size_t space = (head.load() - t - 1) & MASK;
+
+        if(n > space) {
+            n = space;
+        }
+
+        for(size_t i = 0; i < n; i++) {
+            values[(t + i) & MASK] = elems[i];
+        }
+
+        tail.store((t + n) & MASK);
+
+        return n;
+    }
+
+    // consumer side
+
+    bool pop(T& elem) {
+        const index_t h = head.load();
+
+        if(h == tail.load()) {
+            return false;
+        }
+
+        elem = values[h];
+        head.store((h + 1) & MASK);
+
+        return true;
+    }
+
+    // pop up to n elements, returns the number of elements actually read
+    size_t pop_n(T *elems, size_t n) {
+        const index_t h = head.load();
+        const size_t avail = (tail.load() - h) & MASK;
+
+        if(n > avail) {
+            n = avail;
+        }
+
+        for(size_t i = 0; i < n; i++) {
+            elems[i] = values[(h + i) & MASK];
+        }
+
+        head.store((h + n) & MASK);
+
+        return n;
+    }
+};
+
 #endif // ARDUINOSID_RINGBUFFER_H
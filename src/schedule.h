@@ -0,0 +1,232 @@
+#pragma once
+
+#ifndef ARDUINOSID_SCHEDULE_H
+#define ARDUINOSID_SCHEDULE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+
+#include "sid.h"
+
+// register writes scheduled for a future tick
+//
+// WriteScheduler holds writes until their tick comes and then passes them on to a register sink, e.g. the
+// shadow register file of a SIDArray through SIDArrayTarget, so they are flushed with that tick. What a tick is
+// is up to the caller, typically the timer tick which also flushes the SIDArray.
+//
+// Pending writes sit in a hierarchical timer wheel of three levels with 64 slots each: level 0 holds writes
+// due within 64 ticks, one slot per tick, level 1 within 4096 ticks, one slot per 64 ticks, level 2 within 2^18
+// ticks. When level 0 wraps around, the next slot of level 1 is spread out over level 0, and likewise for
+// level 2. Writes further ahead wait in the last slot of level 2 and are placed again when it comes round.
+// Scheduling a write and releasing it are constant time; a write moves down at most twice.
+//
+// Entries come from a fixed pool linked by index. Each slot is a circular list kept by its tail, so writes
+// scheduled for the same tick at the same time, e.g. the writes of one frame, are released in order.
+
+template <typename Array>
+class SIDArrayTarget {
+private:
+    Array &array;
+
+public:
+    SIDArrayTarget(Array &array) : array(array) {
+    }
+
+    inline bool write(const uint8_t sid, const uint8_t reg, const uint8_t val) {
+        array.getSID(sid).setRegister(reg, val);
+
+        return true;
+    }
+};
+
+template <typename Sink, uint8_t POOL_SIZE = 32>
+class WriteScheduler {
+public:
+    static const uint8_t LEVELS = 3;
+    static const uint8_t SLOT_BITS = 6;
+    static const uint8_t SLOTS = 1 << SLOT_BITS;
+    static const uint8_t NONE = 0xff;
+
+    static_assert(POOL_SIZE > 0 && POOL_SIZE < NONE, "pool size must be 1 to 254 entries");
+
+private:
+    static const uint8_t SLOT_MASK = SLOTS - 1;
+
+    struct Entry {
+        uint32_t tick;
+        uint8_t next;
+        uint8_t sid;
+        uint8_t reg;
+        uint8_t val;
+    };
+
+    Sink sink;
+    Entry pool[POOL_SIZE];
+    uint8_t freeList = NONE;
+    uint8_t available = POOL_SIZE;
+
+    // tail of the circular list of each slot, or NONE
+    uint8_t tails[LEVELS][SLOTS];
+
+    // next tick to be processed
+    uint32_t now = 0;
+
+    inline void append(uint8_t &tail, const uint8_t e) {
+        if(tail == NONE) {
+            pool[e].next = e;
+        } else {
+            pool[e].next = pool[tail].next;
+            pool[tail].next = e;
+        }
+
+        tail = e;
+    }
+
+    // detach the list of a slot, returns its head or NONE
+    inline uint8_t take(uint8_t &tail) {
+        if(tail == NONE) {
+            return NONE;
+        }
+
+        const uint8_t head = pool[tail].next;
+
+        pool[tail].next = NONE;
+        tail = NONE;
+
+        return head;
+    }
+
+    inline void place(const uint8_t e) {
+        const uint32_t tick = pool[e].tick;
+        const uint32_t delta = tick - now;
+
+        if(delta < SLOTS) {
+            append(tails[0][tick & SLOT_MASK], e);
+        } else if(delta < (1UL << (2 * SLOT_BITS))) {
+            append(tails[1][(tick >> SLOT_BITS) & SLOT_MASK], e);
+        } else if(delta < (1UL << (3 * SLOT_BITS))) {
+            append(tails[2][(tick >> (2 * SLOT_BITS)) & SLOT_MASK], e);
+        } else {
+            append(tails[2][((now >> (2 * SLOT_BITS)) - 1) & SLOT_MASK], e);
+        }
+    }
+
+    // place all entries of a slot again, relative to the current tick
+    void cascade(uint8_t &tail) {
+        for(uint8_t e = take(tail); e != NONE;) {
+            const uint8_t next = pool[e].next;
+
+            place(e);
+            e = next;
+        }
+    }
+
+public:
+    template <typename... SinkArgs>
+    WriteScheduler(SinkArgs&&... sinkArgs) : sink(std::forward<SinkArgs>(sinkArgs)...) {
+        for(uint8_t level = 0; level < LEVELS; level++) {
+            for(uint8_t slot = 0; slot < SLOTS; slot++) {
+                tails[level][slot] = NONE;
+            }
+        }
+
+        for(uint8_t e = 0; e < POOL_SIZE; e++) {
+            pool[e].next = e + 1 < POOL_SIZE ? e + 1 : NONE;
+        }
+
+        freeList = 0;
+    }
+
+    WriteScheduler(const WriteScheduler&) = delete;
+
+    // schedule a write for a tick, ticks which have passed already mean the next tick processed; returns false
+    // if the pool is exhausted
+    bool schedule(const uint32_t tick, const uint8_t sid, const uint8_t reg, const uint8_t val) {
+        if(freeList == NONE) {
+            return false;
+        }
+
+        const uint8_t e = freeList;
+
+        freeList = pool[e].next;
+        available--;
+
+        pool[e].tick = (int32_t) (tick - now) < 0 ? now : tick;
+        pool[e].sid = sid;
+        pool[e].reg = reg;
+        pool[e].val = val;
+
+        place(e);
+
+        return true;
+    }
+
+    // schedule a write a number of ticks after the next one, 0 for the next tick
+    inline bool scheduleIn(const uint32_t ticks, const uint8_t sid, const uint8_t reg, const uint8_t val) {
+        return schedule(now + ticks, sid, reg, val);
+    }
+
+    // process the next tick: pass the writes due on to the sink in order; from the first write the sink does not
+    // accept on, the writes are retried on the following tick ahead of those due then. Returns the number of writes
+    // passed on.
+    uint8_t tick() {
+        if(!(now & SLOT_MASK)) {
+            if(!((now >> SLOT_BITS) & SLOT_MASK)) {
+                cascade(tails[2][(now >> (2 * SLOT_BITS)) & SLOT_MASK]);
+            }
+
+            cascade(tails[1][(now >> SLOT_BITS) & SLOT_MASK]);
+        }
+
+        uint8_t n = 0;
+        const uint8_t last = tails[0][now & SLOT_MASK];
+        uint8_t e = take(tails[0][now & SLOT_MASK]);
+
+        now++;
+
+        while(e != NONE) {
+            const uint8_t next = pool[e].next;
+
+            if(!sink.write(pool[e].sid, pool[e].reg, pool[e].val)) {
+                // the rest of the list goes in front of the next slot, so nothing released after it, from this
+                // slot or the next, can be overwritten by it
+                uint8_t &tail = tails[0][now & SLOT_MASK];
+
+                if(tail == NONE) {
+                    pool[last].next = e;
+                    tail = last;
+                } else {
+                    pool[last].next = pool[tail].next;
+                    pool[tail].next = e;
+                }
+
+                break;
+            }
+
+            pool[e].next = freeList;
+            freeList = e;
+            available++;
+            n++;
+
+            e = next;
+        }
+
+        return n;
+    }
+
+    // the next tick to be processed
+    uint32_t getTime() const {
+        return now;
+    }
+
+    uint8_t getAvailable() const {
+        return available;
+    }
+
+    Sink &getSink() {
+        return sink;
+    }
+};
+
+#endif // ARDUINOSID_SCHEDULE_H
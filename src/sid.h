@@ -4,17 +4,20 @@
 #define ARDUINOSID_SID_H
 
 #include <array>
-#include <functional>
 #include <cstdint>
 #include <cstddef>
 #include <cassert>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 
 #include "ringbuffer.h"
 
 
-// representation of a SID chip with 3 voices and filter/vol and misc registers
+// register layout of a SID chip, independent of where register writes go
 
-class SID {
+class SIDLayout {
 
 public:
     static const uint8_t NUM_VOICES = 3;
@@ -23,68 +26,159 @@ public:
     static const uint8_t NUM_WO_REGS = NUM_VOICES * NUM_VOICE_REGS + NUM_FILTER_REGS;
     static const uint8_t NUM_RO_REGS = 4;
     static const uint8_t NUM_REGS = NUM_WO_REGS + NUM_RO_REGS;
+};
 
-protected:
+// register numbers and bits of a voice, relative to the first register of the voice
 
-    // registers for a single voice of a SID chip
+class SIDVoiceLayout {
+public:
+    // register numbers
+    static const uint8_t SIDRegFQLo  = 0;
+    static const uint8_t SIDRegFQHi  = 1;
+    static const uint8_t SIDRegPWLo  = 2;
+    static const uint8_t SIDRegPWHi  = 3;
+    static const uint8_t SIDRegWvCtl = 4;
+    static const uint8_t SIDRegAD    = 5;
+    static const uint8_t SIDRegSR    = 6;
+
+    // waveform bits
+
+    static const uint8_t SIDWavNse = 0x80;
+    static const uint8_t SIDWavSqu = 0x40;
+    static const uint8_t SIDWavSaw = 0x20;
+    static const uint8_t SIDWavTri = 0x10;
+
+    // control bits
+
+    static const uint8_t SIDCtlTst = 0x08;
+    static const uint8_t SIDCtlRMd = 0x04;
+    static const uint8_t SIDCtlSyn = 0x02;
+    static const uint8_t SIDCtlGat = 0x01;
+};
 
-    class SIDVoice {
+// register numbers and bits of the filter and volume registers
 
-    public:
-        // register numbers
-        static const uint8_t SIDRegFQLo  = 0;
-        static const uint8_t SIDRegFQHi  = 1;
-        static const uint8_t SIDRegPWLo  = 2;
-        static const uint8_t SIDRegPWHi  = 3;
-        static const uint8_t SIDRegWvCtl = 4;
-        static const uint8_t SIDRegAD    = 5;
-        static const uint8_t SIDRegSR    = 6;
-
-        // waveform bits
-
-        static const uint8_t SIDWavNse = 0x80;
-        static const uint8_t SIDWavSqu = 0x40;
-        static const uint8_t SIDWavSaw = 0x20;
-        static const uint8_t SIDWavTri = 0x10;
+class SIDFilterLayout {
+public:
+    // register numbers
+    static const uint8_t SIDRegFCLo    = SIDLayout::NUM_VOICES * SIDLayout::NUM_VOICE_REGS + 0;
+    static const uint8_t SIDRegFCHi    = SIDLayout::NUM_VOICES * SIDLayout::NUM_VOICE_REGS + 1;
+    static const uint8_t SIDRegResFilt = SIDLayout::NUM_VOICES * SIDLayout::NUM_VOICE_REGS + 2;
+    static const uint8_t SIDRegModVol  = SIDLayout::NUM_VOICES * SIDLayout::NUM_VOICE_REGS + 3;
+
+    static const uint8_t SIDFilt1  = 0x01;
+    static const uint8_t SIDFilt2  = 0x02;
+    static const uint8_t SIDFilt3  = 0x04;
+    static const uint8_t SIDFiltEx = 0x08;
+
+    static const uint8_t SIDFModLP = 0x10;
+    static const uint8_t SIDFModBP = 0x20;
+    static const uint8_t SIDFModHP = 0x40;
+};
 
-        // control bits
+// register numbers of the read only registers
 
-        static const uint8_t SIDCtlTst = 0x08;
-        static const uint8_t SIDCtlRMd = 0x04;
-        static const uint8_t SIDCtlSyn = 0x02;
-        static const uint8_t SIDCtlGat = 0x01;
+class SIDMiscLayout {
+public:
+    // register numbers
+    static const uint8_t SIDRegPotX = SIDLayout::NUM_WO_REGS + 0;
+    static const uint8_t SIDRegPotY = SIDLayout::NUM_WO_REGS + 1;
+    static const uint8_t SIDRegOsc3 = SIDLayout::NUM_WO_REGS + 2;
+    static const uint8_t SIDRegEnv3 = SIDLayout::NUM_WO_REGS + 3;
+};
+
+// representation of a SID chip with 3 voices and filter/vol and misc registers
+//
+// Register writes go to a sink policy, any type with a method
+//
+//     bool write(const uint8_t sid, const uint8_t reg, const uint8_t val);
+//
+// returning false if the write could not be accepted right now. The sink is called directly, so writes are
+// inlined into the setters instead of going through a type erased callback.
+//
+// A sink which can write the same register of several chips in one bus cycle additionally has
+//
+//     bool writeMulticast(const uint8_t chips, const uint8_t reg, const uint8_t val);
+//
+// with one bit per chip, which SIDArray::flush() then uses for all writes, merging identical ones pending on
+// several chips. A queueing sink may have
+//
+//     size_t size() const;
+//
+// returning the number of writes waiting in it, which the SIDArray statistics track. A queueing sink which may
+// discard a write it already accepted has
+//
+//     void setEvicted(void (*evicted)(void *context, const uint8_t sid, const uint8_t reg), void *context);
+//
+// which SIDArray uses to learn about such writes and write their registers again with the next flush.
+
+template <typename Sink, typename = void>
+struct SinkHasMulticast : std::false_type {
+};
+
+template <typename Sink>
+struct SinkHasMulticast<Sink, decltype((void) std::declval<Sink&>().writeMulticast(uint8_t(), uint8_t(), uint8_t()))>
+    : std::true_type {
+};
+
+template <typename Sink, typename = void>
+struct SinkHasSize : std::false_type {
+};
+
+template <typename Sink>
+struct SinkHasSize<Sink, decltype((void) std::declval<const Sink&>().size())> : std::true_type {
+};
+
+template <typename Sink, typename = void>
+struct SinkHasEvicted : std::false_type {
+};
+
+template <typename Sink>
+struct SinkHasEvicted<Sink, decltype((void) std::declval<Sink&>().setEvicted(nullptr, nullptr))> : std::true_type {
+};
+
+template <typename Sink>
+class SID : public SIDLayout {
+
+public:
+
+    // registers for a single voice of a SID chip
+
+    class SIDVoice : public SIDVoiceLayout {
 
     private:
-        const uint8_t SIDNo;
+        // registers of this voice in the register image of the SID:
+        //
+        // FQLo  low byte of frequency
+        // FQHi  high byte of frequency
+        // PWLo  low byte of pulse width
+        // PWHi  high byte of pulse width (only lower nybble used)
+        // WvCtl wave and control register
+        // AD    attack and decay
+        // SR    sustain and release
+        SID &sid;
         const uint8_t voiceNo;
         const uint8_t regOffset;
 
-        uint8_t FQLo  = 0; // low byte of frequency
-        uint8_t FQHi  = 0; // high byte of frequency
-        uint8_t PWLo  = 0; // low byte of pulse width
-        uint8_t PWHi  = 0; // high byte of pulse width (only lower nybble used)
-        uint8_t WvCtl = 0; // wave and control register
-        uint8_t AD    = 0; // attack and decay
-        uint8_t SR    = 0; // sustain and release
+        inline uint8_t reg(const uint8_t reg) const {
+            return sid.getRegister(regOffset + reg);
+        }
 
-        // callback function for register write actions
-        std::function<void(const uint8_t, const uint8_t, const uint8_t)> registerWriteCallback = [](const uint8_t, const uint8_t, const uint8_t) {};
+        inline void write(const uint8_t reg, const uint8_t val) {
+            sid.setRegister(regOffset + reg, val);
+        }
 
     public:
-        SIDVoice(const uint8_t SIDNo, const uint8_t voiceNo)
-            : SIDNo(SIDNo),
+        SIDVoice(SID &sid, const uint8_t voiceNo)
+            : sid(sid),
               voiceNo(voiceNo),
-              regOffset((voiceNo & 0xf) * NUM_VOICES)) {
+              regOffset((voiceNo & 0xf) * NUM_VOICE_REGS) {
         }
 
         inline uint8_t const getVoiceNo() {
             return voiceNo;
         }
 
-        const void setRegisterWriteCallback(const std::function<void(const uint8_t, const uint8_t, const uint8_t)> cb) {
-            registerWriteCallback = cb;
-        }
-
         inline uint8_t const getRegNo(const uint8_t reg) {
             assert(reg < NUM_VOICE_REGS);
 
@@ -94,493 +188,902 @@ protected:
         // frequency
 
         inline uint16_t const getFQ() {
-            return (((uint16_t) FQHi) << 8) | FQLo;
+            return (((uint16_t) reg(SIDRegFQHi)) << 8) | reg(SIDRegFQLo);
         }
 
         inline void setFQ(const uint16_t FQ) {
-            FQLo = (uint8_t) (FQ & 0xff);
-            FQHi = (uint8_t) (FQ >> 8);
-
-            registerWriteCallback(SIDNo, getRegNo(SIDRegFQLo), FQLo);
-            registerWriteCallback(SIDNo, getRegNo(SIDRegFQHi), FQHi);
+            write(SIDRegFQLo, (uint8_t) (FQ & 0xff));
+            write(SIDRegFQHi, (uint8_t) (FQ >> 8));
         }
 
         // pulse width
 
         inline uint16_t const getPW() {
-            return (((uint16_t) PWHi) << 12) | (((uint16_t) PWLo) << 4);
+            return (((uint16_t) reg(SIDRegPWHi)) << 12) | (((uint16_t) reg(SIDRegPWLo)) << 4);
         }
 
         inline void setPW(const uint16_t PW) {
-            PWLo = (uint8_t) ((PW >> 4) & 0xff);
-            PWHi = (uint8_t) (PW >> 12);
-
-            registerWriteCallback(SIDNo, getRegNo(SIDRegPWLo), PWLo);
-            registerWriteCallback(SIDNo, getRegNo(SIDRegPWHi), PWHi);
+            write(SIDRegPWLo, (uint8_t) ((PW >> 4) & 0xff));
+            write(SIDRegPWHi, (uint8_t) (PW >> 12));
         }
 
         // waveforms
 
         inline uint8_t const getWave() {
-            return WvCtl & 0xf0;
+            return reg(SIDRegWvCtl) & 0xf0;
         }
 
         inline void setWave(const uint8_t wave) {
-            WvCtl = (WvCtl & 0x0f) | (wave & 0xf0);
-
-            registerWriteCallback(SIDNo, getRegNo(SIDRegWvCtl), WvCtl);
+            write(SIDRegWvCtl, (reg(SIDRegWvCtl) & 0x0f) | (wave & 0xf0));
         }
 
         inline bool const getNoise() {
-            return WvCtl & SIDWavNse;
+            return reg(SIDRegWvCtl) & SIDWavNse;
         }
 
         inline void setNoise(const bool onOff) {
-            WvCtl = (WvCtl & ~SIDWavNse) | (onOff ? SIDWavNse : 0);
-
-            registerWriteCallback(SIDNo, getRegNo(SIDRegWvCtl), WvCtl);
+            write(SIDRegWvCtl, (reg(SIDRegWvCtl) & ~SIDWavNse) | (onOff ? SIDWavNse : 0));
         }
 
         inline bool const getSquare() {
-            return WvCtl & SIDWavSqu;
+            return reg(SIDRegWvCtl) & SIDWavSqu;
         }
 
         inline void setSquare(const bool onOff) {
-            WvCtl = (WvCtl & ~SIDWavSqu) | (onOff ? SIDWavSqu : 0);
-
-            registerWriteCallback(SIDNo, getRegNo(SIDRegWvCtl), WvCtl);
+            write(SIDRegWvCtl, (reg(SIDRegWvCtl) & ~SIDWavSqu) | (onOff ? SIDWavSqu : 0));
         }
 
         inline bool const getSawtooth() {
-            return WvCtl & SIDWavSaw;
+            return reg(SIDRegWvCtl) & SIDWavSaw;
         }
 
         inline void setSawtooth(const bool onOff) {
-            WvCtl = (WvCtl & ~SIDWavSaw) | (onOff ? SIDWavSaw : 0);
-
-            registerWriteCallback(SIDNo, getRegNo(SIDRegWvCtl), WvCtl);
+            write(SIDRegWvCtl, (reg(SIDRegWvCtl) & ~SIDWavSaw) | (onOff ? SIDWavSaw : 0));
         }
 
         inline bool const getTriangle() {
-            return WvCtl & SIDWavTri;
+            return reg(SIDRegWvCtl) & SIDWavTri;
         }
 
         inline void setTriangle(const bool onOff) {
-            WvCtl = (WvCtl & ~SIDWavTri) | (onOff ? SIDWavTri : 0);
-
-            registerWriteCallback(SIDNo, getRegNo(SIDRegWvCtl), WvCtl);
+            write(SIDRegWvCtl, (reg(SIDRegWvCtl) & ~SIDWavTri) | (onOff ? SIDWavTri : 0));
         }
 
         // control bits
 
         inline uint8_t const getControl() {
-            return WvCtl & 0x0f;
+            return reg(SIDRegWvCtl) & 0x0f;
         }
 
         inline void setControl(const uint8_t control) {
-            WvCtl = (WvCtl & 0xf0) | (control & 0x0f);
-
-            registerWriteCallback(SIDNo, getRegNo(SIDRegWvCtl), WvCtl);
+            write(SIDRegWvCtl, (reg(SIDRegWvCtl) & 0xf0) | (control & 0x0f));
         }
 
         inline bool const getTest() {
-            return WvCtl & SIDCtlTst;
+            return reg(SIDRegWvCtl) & SIDCtlTst;
         }
 
         inline void setTest(const bool test) {
-            WvCtl = (WvCtl & ~SIDCtlTst) | (test ? SIDCtlTst : 0);
-
-            registerWriteCallback(SIDNo, getRegNo(SIDRegWvCtl), WvCtl);
+            write(SIDRegWvCtl, (reg(SIDRegWvCtl) & ~SIDCtlTst) | (test ? SIDCtlTst : 0));
         }
 
         inline bool const getRingMod() {
-            return WvCtl & SIDCtlRMd;
+            return reg(SIDRegWvCtl) & SIDCtlRMd;
         }
 
         inline void setRingMod(const bool ringMod) {
-            WvCtl = (WvCtl & ~SIDCtlRMd) | (ringMod ? SIDCtlRMd : 0);
-
-            registerWriteCallback(SIDNo, getRegNo(SIDRegWvCtl), WvCtl);
+            write(SIDRegWvCtl, (reg(SIDRegWvCtl) & ~SIDCtlRMd) | (ringMod ? SIDCtlRMd : 0));
         }
 
         inline bool const getSync() {
-            return WvCtl & SIDCtlSyn;
+            return reg(SIDRegWvCtl) & SIDCtlSyn;
         }
 
         inline void setSync(const bool sync) {
-            WvCtl = (WvCtl & ~SIDCtlSyn) | (sync ? SIDCtlSyn : 0);
-
-            registerWriteCallback(SIDNo, getRegNo(SIDRegWvCtl), WvCtl);
+            write(SIDRegWvCtl, (reg(SIDRegWvCtl) & ~SIDCtlSyn) | (sync ? SIDCtlSyn : 0));
         }
 
         inline bool const getGate() {
-            return WvCtl & SIDCtlGat;
+            return reg(SIDRegWvCtl) & SIDCtlGat;
         }
 
         inline void setGate(const bool gate) {
-            WvCtl = (WvCtl & ~SIDCtlGat) | (gate ? SIDCtlGat : 0);
-
-            registerWriteCallback(SIDNo, getRegNo(SIDRegWvCtl), WvCtl);
+            write(SIDRegWvCtl, (reg(SIDRegWvCtl) & ~SIDCtlGat) | (gate ? SIDCtlGat : 0));
         }
 
         // envelope
 
         inline uint8_t const getAD() {
-            return AD;
+            return reg(SIDRegAD);
         }
 
         inline void setAD(const uint8_t AD) {
-            this->AD = AD;
-
-            registerWriteCallback(SIDNo, getRegNo(SIDRegAD), this->AD);
+            write(SIDRegAD, AD);
         }
 
         inline uint8_t const getSR() {
-            return SR;
+            return reg(SIDRegSR);
         }
 
         inline void setSR(const uint8_t SR) {
-            this->SR = SR;
-
-            registerWriteCallback(SIDNo, getRegNo(SIDRegSR), this->SR);
+            write(SIDRegSR, SR);
         }
 
         inline uint16_t const getADSR() {
-            return ((uint16_t) AD << 8) | (uint16_t) SR;
+            return ((uint16_t) reg(SIDRegAD) << 8) | (uint16_t) reg(SIDRegSR);
         }
 
         inline void setADSR(const uint16_t ADSR) {
-            AD = (uint8_t) (ADSR >> 8);
-            SR = (uint8_t) (ADSR & 0xff);
-
-            registerWriteCallback(SIDNo, getRegNo(SIDRegAD), AD);
-            registerWriteCallback(SIDNo, getRegNo(SIDRegSR), SR);
+            write(SIDRegAD, (uint8_t) (ADSR >> 8));
+            write(SIDRegSR, (uint8_t) (ADSR & 0xff));
         }
 
         inline uint8_t const getAttack() {
-            return (AD & 0xf0) >> 4;
+            return (reg(SIDRegAD) & 0xf0) >> 4;
         }
 
         inline void setAttack(const uint8_t attack) {
             assert(attack <= 0x0f);
 
-            AD = (AD & 0x0f) | (attack << 4);
-
-            registerWriteCallback(SIDNo, getRegNo(SIDRegAD), AD);
+            write(SIDRegAD, (reg(SIDRegAD) & 0x0f) | (attack << 4));
         }
 
         inline uint8_t const getDecay() {
-            return (AD & 0x0f);
+            return (reg(SIDRegAD) & 0x0f);
         }
 
         inline void setDecay(const uint8_t decay) {
             assert(decay <= 0x0f);
 
-            AD = (AD & 0xf0) | decay;
-
-            registerWriteCallback(SIDNo, getRegNo(SIDRegAD), AD);
+            write(SIDRegAD, (reg(SIDRegAD) & 0xf0) | decay);
         }
 
         inline uint8_t const getSustain() {
-            return (AD & 0xf0) >> 4;
+            return (reg(SIDRegSR) & 0xf0) >> 4;
         }
 
         inline void setSustain(const uint8_t sustain) {
             assert(sustain <= 0x0f);
 
-            SR = (SR & 0x0f) | (sustain << 4);
-
-            registerWriteCallback(SIDNo, getRegNo(SIDRegSR), SR);
+            write(SIDRegSR, (reg(SIDRegSR) & 0x0f) | (sustain << 4));
         }
 
         inline uint8_t const getRelease() {
-            return (SR & 0x0f);
+            return (reg(SIDRegSR) & 0x0f);
         }
 
         inline void setRelease(const uint8_t release) {
             assert(release <= 0x0f);
 
-            SR = (SR & 0xf0) | release;
-
-            registerWriteCallback(SIDNo, getRegNo(SIDRegSR), SR);
+            write(SIDRegSR, (reg(SIDRegSR) & 0xf0) | release);
         }
     };
 
     // filter and volume registers of a SID chip
 
-    class SIDFilter {
-    public:
-        // register numbers
-        static const uint8_t SIDRegFCLo    = NUM_VOICES * NUM_VOICE_REGS + 0;
-        static const uint8_t SIDRegFCHi    = NUM_VOICES * NUM_VOICE_REGS + 1;
-        static const uint8_t SIDRegResFilt = NUM_VOICES * NUM_VOICE_REGS + 2;
-        static const uint8_t SIDRegModVol  = NUM_VOICES * NUM_VOICE_REGS + 3;
-
-        static const uint8_t SIDFilt1  = 0x01;
-        static const uint8_t SIDFilt2  = 0x02;
-        static const uint8_t SIDFilt3  = 0x04;
-        static const uint8_t SIDFiltEx = 0x08;
-
-        static const uint8_t SIDFModLP = 0x10;
-        static const uint8_t SIDFModBP = 0x20;
-        static const uint8_t SIDFModHP = 0x40;
-
+    class SIDFilter : public SIDFilterLayout {
     private:
-        const uint8_t SIDNo;
+        // registers of the filter in the register image of the SID:
+        //
+        // FCLo    low byte filter cut-off frequency, only bits 0 to 2 are used
+        // FCHi    high byte filter cut-off frequency
+        // ResFilt filter resonance and control register
+        // ModVol  filter mode and chip volume
+        SID &sid;
 
-        uint8_t FCLo    = 0; // low byte filter cut-off frequency, only bits 1 to 3 are used
-        uint8_t FCHi    = 0; // high byte filter cut-off frequency
-        uint8_t ResFilt = 0; // filter resonance and control register
-        uint8_t ModVol  = 0; // filter mode and chip volume
-
-        // callback function for register write actions
-        std::function<void(const uint8_t, const uint8_t, const uint8_t)> registerWriteCallback = [](const uint8_t, const uint8_t, const uint8_t) {};
+        inline uint8_t reg(const uint8_t reg) const {
+            return sid.getRegister(reg);
+        }
 
-    public:
-        SIDFilter(const uint8_t SIDNo) : SIDNo(SIDNo) {
+        inline void write(const uint8_t reg, const uint8_t val) {
+            sid.setRegister(reg, val);
         }
 
-        void const setRegisterWriteCallback(std::function<void(const uint8_t, const uint8_t, const uint8_t)> cb) {
-            registerWriteCallback = cb;
+    public:
+        SIDFilter(SID &sid) : sid(sid) {
         }
 
         // filter frequency
 
         inline uint16_t const getFilterFQ() {
-            return ((uint16_t) FCLo << 5) | ((uint16_t) FCHi << 8);
+            return ((uint16_t) reg(SIDRegFCLo) << 5) | ((uint16_t) reg(SIDRegFCHi) << 8);
         }
 
         inline void setFilterFQ(const uint16_t FQ) {
-            FCHi = FQ & 0xff00;
-            FCLo = (FQ & 0x00ff) >> 5;
-
-            registerWriteCallback(SIDNo, SIDRegFCHi, FCHi);
-            registerWriteCallback(SIDNo, SIDRegFCLo, FCLo);
+            write(SIDRegFCHi, (uint8_t) (FQ >> 8));
+            write(SIDRegFCLo, (uint8_t) ((FQ & 0x00ff) >> 5));
         }
 
         // filter resonance
 
         inline uint16_t const getFilterRes() {
-            return ResFilt & 0xf0;
+            return reg(SIDRegResFilt) & 0xf0;
         }
 
         inline void setFilterRes(const uint8_t res) {
-            ResFilt = (ResFilt & 0x0f) | (res & 0xf0);
-
-            registerWriteCallback(SIDNo, SIDRegResFilt, ResFilt);
+            write(SIDRegResFilt, (reg(SIDRegResFilt) & 0x0f) | (res & 0xf0));
         }
 
         // filter on/off flags
 
         inline bool const getFilter1() {
-            return ResFilt & SIDFilt1;
+            return reg(SIDRegResFilt) & SIDFilt1;
         }
 
         inline void setFilter1(const bool onOff) {
-            ResFilt = (ResFilt & ~SIDFilt1) | (onOff ? SIDFilt1 : 0);
-
-            registerWriteCallback(SIDNo, SIDRegResFilt, ResFilt);
+            write(SIDRegResFilt, (reg(SIDRegResFilt) & ~SIDFilt1) | (onOff ? SIDFilt1 : 0));
         }
 
         inline bool const getFilter2() {
-            return ResFilt & SIDFilt2;
+            return reg(SIDRegResFilt) & SIDFilt2;
         }
 
         inline void setFilter2(const bool onOff) {
-            ResFilt = (ResFilt & ~SIDFilt2) | (onOff ? SIDFilt2 : 0);
-
-            registerWriteCallback(SIDNo, SIDRegResFilt, ResFilt);
+            write(SIDRegResFilt, (reg(SIDRegResFilt) & ~SIDFilt2) | (onOff ? SIDFilt2 : 0));
         }
 
         inline bool const getFilter3() {
-            return ResFilt & SIDFilt3;
+            return reg(SIDRegResFilt) & SIDFilt3;
         }
 
         inline void setFilter3(const bool onOff) {
-            ResFilt = (ResFilt & ~SIDFilt3) | (onOff ? SIDFilt3 : 0);
-
-            registerWriteCallback(SIDNo, SIDRegResFilt, ResFilt);
+            write(SIDRegResFilt, (reg(SIDRegResFilt) & ~SIDFilt3) | (onOff ? SIDFilt3 : 0));
         }
 
         inline bool const getFilterEx() {
-            return ResFilt & SIDFiltEx;
+            return reg(SIDRegResFilt) & SIDFiltEx;
         }
 
         inline void setFilterEx(const bool onOff) {
-            ResFilt = (ResFilt & ~SIDFiltEx) | (onOff ? SIDFiltEx : 0);
-
-            registerWriteCallback(SIDNo, SIDRegResFilt, ResFilt);
+            write(SIDRegResFilt, (reg(SIDRegResFilt) & ~SIDFiltEx) | (onOff ? SIDFiltEx : 0));
         }
 
         inline bool const getFilter(const uint8_t voice) {
             assert(voice < 3);
 
-            return ResFilt & (1 << voice);
+            return reg(SIDRegResFilt) & (1 << voice);
         }
 
         inline void setFilter(const uint8_t voice, const bool onOff) {
             assert(voice < 3);
 
             uint8_t bit = (1 << voice);
-            ResFilt = (ResFilt & ~bit) | (onOff ? bit : 0);
-
-            registerWriteCallback(SIDNo, SIDRegResFilt, ResFilt);
+            write(SIDRegResFilt, (reg(SIDRegResFilt) & ~bit) | (onOff ? bit : 0));
         }
 
         // filter modes
 
         inline uint8_t const getFilterMode() {
-            return ModVol & 0x70;
+            return reg(SIDRegModVol) & 0x70;
         }
 
         inline void setFilterMode(const uint8_t mode) {
-            ModVol = (ModVol & 0x0f) | (mode & 0x70);
-
-            registerWriteCallback(SIDNo, SIDRegModVol, ModVol);
+            write(SIDRegModVol, (reg(SIDRegModVol) & 0x0f) | (mode & 0x70));
         }
 
         inline void setFilterMode(const uint8_t mode, const bool onOff) {
             assert(mode == SIDFModHP || mode == SIDFModBP || mode == SIDFModLP);
 
-            ModVol = (ModVol & ~mode) | (onOff ? mode : 0);
-
-            registerWriteCallback(SIDNo, SIDRegModVol, ModVol);
+            write(SIDRegModVol, (reg(SIDRegModVol) & ~mode) | (onOff ? mode : 0));
         }
 
         // volume
 
         inline uint8_t const getVolume() {
-            return ModVol & 0x0f;
+            return reg(SIDRegModVol) & 0x0f;
         }
 
         inline void setVolume(const uint8_t volume) {
             assert(volume <= 0x0f);
 
-            ModVol = (ModVol & 0xf0) | volume;
-
-            registerWriteCallback(SIDNo, SIDRegModVol, ModVol);
+            write(SIDRegModVol, (reg(SIDRegModVol) & 0xf0) | volume);
         }
     };
 
     // read only registers of a SID chip, not implemented
 
-    class SIDMisc {
+    class SIDMisc : public SIDMiscLayout {
 
     private:
-        const uint8_t SIDNo;
-
-        uint8_t PotX = 0;
-        uint8_t PotY = 0;
-        uint8_t Osc3 = 0;
-        uint8_t Env3 = 0;
+        SID &sid;
 
     public:
-        SIDMisc(const uint8_t SIDNo) : SIDNo(SIDNo) {
+        SIDMisc(SID &sid) : sid(sid) {
         }
 
         inline uint8_t const getPotX() {
-            return PotX;
+            return sid.roRegs[SIDRegPotX - NUM_WO_REGS];
         }
 
         inline uint8_t const getPotY() {
-            return PotY;
+            return sid.roRegs[SIDRegPotY - NUM_WO_REGS];
         }
 
         inline uint8_t const getOsc3() {
-            return Osc3;
+            return sid.roRegs[SIDRegOsc3 - NUM_WO_REGS];
         }
 
         inline uint8_t const getEnv3() {
-            return Env3;
+            return sid.roRegs[SIDRegEnv3 - NUM_WO_REGS];
         }
     };
 
 private:
+    // sink for register write actions
+    Sink &sink;
+
     const uint8_t SIDNo;
 
-    std::array<SIDVoice, NUM_VOICES> voices = { SIDVoice(SIDNo, 0), SIDVoice(SIDNo, 1), SIDVoice(SIDNo, 2) };
-    SIDFilter filter = SIDFilter(SIDNo);
-    SIDMisc misc = SIDMisc(SIDNo);
+    // register image of the write only registers, the voices, filter and misc objects are views into it
+    alignas(4) uint8_t regs[NUM_WO_REGS] = {};
+
+    // read only registers, not implemented
+    uint8_t roRegs[NUM_RO_REGS] = {};
 
 public:
-    SID(const uint8_t SIDNo) : SIDNo(SIDNo) {
+    SID(Sink &sink, const uint8_t SIDNo) : sink(sink), SIDNo(SIDNo) {
     }
 
     inline uint8_t const getSIDNo() {
         return SIDNo;
     }
 
-    inline SIDVoice& getVoice(const uint8_t voiceNo) {
+    inline SIDVoice getVoice(const uint8_t voiceNo) {
         assert(voiceNo < NUM_VOICES);
 
-        return voices[voiceNo];
+        return SIDVoice(*this, voiceNo);
+    }
+
+    inline SIDFilter getFilter() {
+        return SIDFilter(*this);
+    }
+
+    inline SIDMisc getMisc() {
+        return SIDMisc(*this);
+    }
+
+    // raw register access; the sink sees the write before it is stored, so it can still read the old value
+
+    inline uint8_t getRegister(const uint8_t reg) const {
+        assert(reg < NUM_WO_REGS);
+
+        return regs[reg];
+    }
+
+    inline void setRegister(const uint8_t reg, const uint8_t val) {
+        assert(reg < NUM_WO_REGS);
+
+        sink.write(SIDNo, reg, val);
+        regs[reg] = val;
+    }
+
+    inline const uint8_t *getRegisters() const {
+        return regs;
+    }
+};
+
+// smallest power of two register queue size which holds a write to every register of numSIDs chips
+
+constexpr size_t registerQueueSize(const uint8_t numSIDs, const size_t size = 2) {
+    return size > (size_t) numSIDs * SIDLayout::NUM_WO_REGS ? size : registerQueueSize(numSIDs, size * 2);
+}
+
+// statistics of the register pipeline of a SIDArray
+//
+// Counting is compiled in by defining ARDUINOSID_STATS as 1, otherwise all counters are empty inline functions
+// and SIDArray::stats() returns zeros. SIDArray counts on the producer side; the consumer of the queue, e.g. the
+// timer ISR, reports the number of writes it took out in one go through SIDArray::drained(). All counters wrap.
+
+#ifndef ARDUINOSID_STATS
+#define ARDUINOSID_STATS 0
+#endif
+
+#if defined(__AVR__)
+typedef uint16_t SIDStatsCount;
+#else
+typedef uint32_t SIDStatsCount;
+#endif
+
+template <uint8_t N>
+struct SIDArrayStats {
+    // drain batch sizes by powers of two: 0, 1, 2-3, 4-7, ..., 128-255
+    static const uint8_t NUM_BATCH_BUCKETS = 9;
+
+    // writes the sink accepted per chip and register, a multicast write counts for each of its chips
+    SIDStatsCount writes[N][SIDLayout::NUM_WO_REGS] = {};
+
+    // most writes seen waiting in the sink after a flush, for sinks with size()
+    uint16_t highWatermark = 0;
+
+    // retries of writes the sink rejected in busy wait mode
+    SIDStatsCount spins = 0;
+
+    // gate or test bit edges lost because the sink rejected them
+    SIDStatsCount drops = 0;
+
+    // flushes which stopped at a full sink and left registers dirty for the next one
+    SIDStatsCount stalls = 0;
+
+    SIDStatsCount flushes = 0;
+
+    // number of drains per batch size bucket
+    SIDStatsCount drainBatches[NUM_BATCH_BUCKETS] = {};
+
+    static inline uint8_t batchBucket(const uint8_t n) {
+        uint8_t bucket = 0;
+
+        for(uint8_t m = n; m; m >>= 1) {
+            bucket++;
+        }
+
+        return bucket;
+    }
+};
+
+template <uint8_t N, bool ENABLED = ARDUINOSID_STATS>
+class SIDStatsCounters {
+private:
+    SIDArrayStats<N> counts;
+
+    // written by the consumer only
+    volatile SIDStatsCount drainBatches[SIDArrayStats<N>::NUM_BATCH_BUCKETS] = {};
+
+    template <typename Sink>
+    inline void depth(const Sink &sink, std::true_type) {
+        const size_t size = sink.size();
+
+        if(size > counts.highWatermark) {
+            counts.highWatermark = (uint16_t) size;
+        }
+    }
+
+    template <typename Sink>
+    inline void depth(const Sink &, std::false_type) {
+    }
+
+public:
+    static const bool IS_ENABLED = true;
+
+    inline void write(const uint8_t chips, const uint8_t reg) {
+        for(uint8_t sid = 0; sid < N; sid++) {
+            if(chips & (1 << sid)) {
+                counts.writes[sid][reg]++;
+            }
+        }
+    }
+
+    inline void spin() {
+        counts.spins++;
+    }
+
+    inline void drop() {
+        counts.drops++;
+    }
+
+    inline void stall() {
+        counts.stalls++;
+    }
+
+    template <typename Sink>
+    inline void flushed(const Sink &sink) {
+        counts.flushes++;
+        depth(sink, SinkHasSize<Sink>());
     }
 
-    inline SIDFilter& getFilter() {
-        return filter;
+    inline void drained(const uint8_t n) {
+        const uint8_t bucket = SIDArrayStats<N>::batchBucket(n);
+
+        drainBatches[bucket] = drainBatches[bucket] + 1;
     }
 
-    inline SIDMisc& getMisc() {
-        return misc;
+    // the drain counters may change while they are copied and are not read atomically on AVR, so they are
+    // copied until two copies agree
+    void get(SIDArrayStats<N> &stats) const {
+        stats = counts;
+
+        for(uint8_t i = 0; i < SIDArrayStats<N>::NUM_BATCH_BUCKETS; i++) {
+            SIDStatsCount count;
+
+            do {
+                count = drainBatches[i];
+            } while(count != drainBatches[i]);
+
+            stats.drainBatches[i] = count;
+        }
+    }
+
+    // only while the consumer is not draining
+    void reset() {
+        counts = SIDArrayStats<N>();
+
+        for(uint8_t i = 0; i < SIDArrayStats<N>::NUM_BATCH_BUCKETS; i++) {
+            drainBatches[i] = 0;
+        }
     }
 };
 
-// an array of SID chips
+template <uint8_t N>
+class SIDStatsCounters<N, false> {
+public:
+    static const bool IS_ENABLED = false;
+
+    inline void write(const uint8_t, const uint8_t) {}
+    inline void spin() {}
+    inline void drop() {}
+    inline void stall() {}
+
+    template <typename Sink>
+    inline void flushed(const Sink &) {}
+
+    inline void drained(const uint8_t) {}
+
+    void get(SIDArrayStats<N> &stats) const {
+        stats = SIDArrayStats<N>();
+    }
+
+    void reset() {}
+};
 
+// an array of N SID chips, storage is only allocated for the chips actually populated
+//
+// The voices and filters of all SIDs write into a shadow register file, flush() passes the registers which
+// changed since the last flush on to the sink policy, e.g. a RingBufferSink drained by the Arduino timer. The
+// wave and control registers, which carry the gates, go out after the other registers of their voice, so a note
+// starts with its new frequency and envelope.
+
+template <uint8_t N, typename Sink>
 class SIDArray {
 public:
     static const uint8_t MAX_NUM_SIDS = 6;
+    static const uint8_t NUM_SIDS = N;
+
+    static_assert(N >= 1 && N <= MAX_NUM_SIDS, "unsupported number of SIDs");
+
+    using SIDType = SID<SIDArray>;
+
+    using RegisterWrite = std::tuple<uint8_t, uint8_t, uint8_t>;
+
+    // register images of all SIDs, each padded to whole 32 bit words
+    static const uint8_t SNAPSHOT_STRIDE = (SIDLayout::NUM_WO_REGS + 3) & ~3;
+
+    struct Snapshot {
+        alignas(4) uint8_t regs[N][SNAPSHOT_STRIDE];
+    };
+
+    // maximum number of writes diff() can return
+    static const size_t MAX_DIFF = N * SIDLayout::NUM_WO_REGS;
 
 private:
-    // ring buffer for saving register write actions to be processed by Arduino timer
-    RingBuffer<std::tuple<uint8_t, uint8_t, uint8_t>, MAX_NUM_SIDS * SID::NUM_WO_REGS> buffer;
+    // wave and control registers of all voices, and the bits in them which must not be coalesced away
+    static const uint32_t WVCTL_REGS = (1UL << SIDType::SIDVoice::SIDRegWvCtl) |
+                                       (1UL << (SIDLayout::NUM_VOICE_REGS + SIDType::SIDVoice::SIDRegWvCtl)) |
+                                       (1UL << (2 * SIDLayout::NUM_VOICE_REGS + SIDType::SIDVoice::SIDRegWvCtl));
+    static const uint8_t WVCTL_EDGE_BITS = SIDType::SIDVoice::SIDCtlGat | SIDType::SIDVoice::SIDCtlTst;
+
+    // sink for register writes leaving the shadow register file
+    Sink sink;
+
+    // loop until the sink accepts a write which cannot be deferred, otherwise the write is dropped
+    const bool busyWait;
 
     // array of SID chips
-    std::array<SID, MAX_NUM_SIDS> SIDs = { 0, 1, 2, 3, 4, 5 };
+    std::array<SIDType, N> SIDs;
+
+    // shadow register file: the register images of the SIDs hold the values as set by the voices and filters,
+    // this holds the values as last written to the chips
+    uint8_t busRegs[N][SIDLayout::NUM_WO_REGS] = {};
+
+    // one bit per register whose shadow value differs from the value last written to the chip
+    uint32_t dirty[N] = {};
 
-    // callback function for register writes
-    static const void
-    ringBufferCallback(RingBuffer<std::tuple<uint8_t, uint8_t, uint8_t>, MAX_NUM_SIDS * SID::NUM_WO_REGS> &buffer,
-            const int busyWait, const int uint8_t sid, const uint8_t reg, const uint8_t val) {
-        // if busyWait flag is true, loop until buffer is not full
+    // one bit per register whose last write the sink discarded, the chip holds an unknown value
+    uint32_t stale[N] = {};
+
+    SIDStatsCounters<N> counters;
+
+    bool queueWrite(const uint8_t sid, const uint8_t reg, const uint8_t val) {
         if(busyWait) {
-            while(buffer.full()) {
+            while(!sink.write(sid, reg, val)) {
+                counters.spin();
+            }
+        } else if(!sink.write(sid, reg, val)) {
+            counters.drop();
+
+            return false;
+        }
+
+        counters.write(1 << sid, reg);
+
+        return true;
+    }
+
+    // call f(reg, val) for every register which differs between two register images, comparing a word at a time
+    template <typename F>
+    static void diffRegisters(const uint8_t *from, const uint8_t *to, F f) {
+        uint8_t reg = 0;
+
+        for(; reg + 4 <= SIDLayout::NUM_WO_REGS; reg += 4) {
+            uint32_t a, b;
+
+            memcpy(&a, from + reg, 4);
+            memcpy(&b, to + reg, 4);
+
+            if(a == b) {
+                continue;
+            }
+
+            for(uint8_t i = reg; i < reg + 4; i++) {
+                if(from[i] != to[i]) {
+                    f(i, to[i]);
+                }
+            }
+        }
+
+        for(; reg < SIDLayout::NUM_WO_REGS; reg++) {
+            if(from[reg] != to[reg]) {
+                f(reg, to[reg]);
+            }
+        }
+    }
+
+    // queue the dirty frequency, pulse width and envelope registers of the voice of a wave and control register
+    bool queueVoice(const uint8_t sid, const uint8_t wvCtl) {
+        const uint8_t first = wvCtl - SIDType::SIDVoice::SIDRegWvCtl;
+
+        for(uint8_t reg = first; reg < first + SIDLayout::NUM_VOICE_REGS; reg++) {
+            const uint32_t bit = 1UL << reg;
+
+            if(reg == wvCtl || !(dirty[sid] & bit)) {
+                continue;
+            }
+
+            const uint8_t val = SIDs[sid].getRegister(reg);
+
+            if(!queueWrite(sid, reg, val)) {
+                return false;
+            }
+
+            busRegs[sid][reg] = val;
+            dirty[sid] &= ~bit;
+            stale[sid] &= ~bit;
+        }
+
+        return true;
+    }
+
+    // one write per dirty register, the wave and control registers last so a gate goes out after the frequency,
+    // pulse width and envelope of its voice
+    uint8_t flush(std::false_type) {
+        uint8_t n = 0;
+
+        for(uint8_t sid = 0; sid < N; sid++) {
+            for(uint8_t wvCtl = 0; wvCtl < 2; wvCtl++) {
+                uint32_t mask = dirty[sid] & (wvCtl ? WVCTL_REGS : ~WVCTL_REGS);
+
+                for(uint8_t reg = 0; mask; reg++, mask >>= 1) {
+                    if(!(mask & 1)) {
+                        continue;
+                    }
+
+                    const uint8_t val = SIDs[sid].getRegister(reg);
+
+                    if(!sink.write(sid, reg, val)) {
+                        counters.stall();
+
+                        return n;
+                    }
+
+                    counters.write(1 << sid, reg);
+
+                    busRegs[sid][reg] = val;
+                    dirty[sid] &= ~(1UL << reg);
+                    stale[sid] &= ~(1UL << reg);
+                    n++;
+                }
             }
         }
 
-        buffer.put(std::tuple<uint_t, uint8_t, uint8_t>(reg, val));
+        return n;
+    }
+
+    // one multicast write per register and value, covering all chips on which it is pending; the wave and
+    // control registers last as above
+    uint8_t flush(std::true_type) {
+        uint8_t n = 0;
+
+        for(uint8_t i = 0; i < 2 * SIDLayout::NUM_WO_REGS; i++) {
+            const uint8_t reg = i % SIDLayout::NUM_WO_REGS;
+            const uint32_t bit = 1UL << reg;
+
+            if(!(bit & WVCTL_REGS) != (i < SIDLayout::NUM_WO_REGS)) {
+                continue;
+            }
+
+            for(uint8_t sid = 0; sid < N; sid++) {
+                if(!(dirty[sid] & bit)) {
+                    continue;
+                }
+
+                const uint8_t val = SIDs[sid].getRegister(reg);
+                uint8_t chips = 1 << sid;
+
+                for(uint8_t other = sid + 1; other < N; other++) {
+                    if((dirty[other] & bit) && SIDs[other].getRegister(reg) == val) {
+                        chips |= 1 << other;
+                    }
+                }
+
+                if(!sink.writeMulticast(chips, reg, val)) {
+                    counters.stall();
+
+                    return n;
+                }
+
+                counters.write(chips, reg);
+
+                for(uint8_t other = sid; other < N; other++) {
+                    if(chips & (1 << other)) {
+                        busRegs[other][reg] = val;
+                        dirty[other] &= ~bit;
+                        stale[other] &= ~bit;
+                    }
+                }
+
+                n++;
+            }
+        }
+
+        return n;
+    }
+
+    static void evicted(void *context, const uint8_t sid, const uint8_t reg) {
+        ((SIDArray *) context)->invalidate(sid, reg);
+    }
+
+    inline void hookEvicted(std::true_type) {
+        sink.setEvicted(&SIDArray::evicted, this);
+    }
+
+    inline void hookEvicted(std::false_type) {}
+
+    template <size_t... I, typename... SinkArgs>
+    SIDArray(std::index_sequence<I...>, bool busyWait, SinkArgs&&... sinkArgs)
+        : sink(sinkArgs...),
+          busyWait(busyWait),
+          SIDs({ SIDType(*this, I)... }) {
+        hookEvicted(SinkHasEvicted<Sink>());
     }
 
 public:
-    SIDArray(bool busyWait = false) {
-        // set up fixed parameters for register write callback
-        auto cb = std::bind(ringBufferCallback,
-                buffer,
-                busyWait,
-                std::placeholders::_1,
-                std::placeholders::_2,
-                std::placeholders::_3);
-
-        // initialize register write callback for all SIDs and their voices
-        for(uint8_t i = 0; i < MAX_NUM_SIDS; i++) {
-            SID& sid = getSID(i);
-
-            sid.getFilter().setRegisterWriteCallback(cb);
-
-            for(uint8_t j = 0; j < SID::NUM_VOICES; j++) {
-                sid.getVoice(j).setRegisterWriteCallback(cb);
+    template <typename... SinkArgs>
+    SIDArray(bool busyWait = false, SinkArgs&&... sinkArgs)
+        : SIDArray(std::make_index_sequence<N>(), busyWait, sinkArgs...) {
+    }
+
+    // the SIDs point back to this object
+    SIDArray(const SIDArray&) = delete;
+    SIDArray& operator=(const SIDArray&) = delete;
+
+    // sink interface for the SIDs, only updates the shadow register file; the SID stores the value afterwards
+    bool write(const uint8_t sid, const uint8_t reg, const uint8_t val) {
+        const uint32_t bit = 1UL << reg;
+        const uint8_t shadow = SIDs[sid].getRegister(reg);
+        uint8_t &bus = busRegs[sid][reg];
+
+        // a gate or test bit edge which has not reached the chip yet would be lost when overwritten,
+        // e.g. when retriggering a note within one tick, so it is queued right away, behind the registers of
+        // its voice set before it
+        if((bit & WVCTL_REGS) && (dirty[sid] & bit) &&
+           ((shadow ^ val) & WVCTL_EDGE_BITS) && ((shadow ^ bus) & WVCTL_EDGE_BITS)) {
+            if(queueVoice(sid, reg) && queueWrite(sid, reg, shadow)) {
+                bus = shadow;
+                stale[sid] &= ~bit;
             }
         }
+
+        if(val != bus || (stale[sid] & bit)) {
+            dirty[sid] |= bit;
+        } else {
+            dirty[sid] &= ~bit;
+        }
+
+        return true;
+    }
+
+    // pass all registers which changed since the last flush on to the sink, to be called once per timer tick;
+    // never blocks, registers the sink does not accept stay dirty until the next flush
+    uint8_t flush() {
+        const uint8_t n = flush(SinkHasMulticast<Sink>());
+
+        counters.flushed(sink);
+
+        return n;
+    }
+
+    // a write of a register the sink accepted never reached the chip, write the register again with the next
+    // flush whatever it is set to until then
+    void invalidate(const uint8_t sid, const uint8_t reg) {
+        assert(sid < N && reg < SIDLayout::NUM_WO_REGS);
+
+        dirty[sid] |= 1UL << reg;
+        stale[sid] |= 1UL << reg;
+    }
+
+    // to be called by the consumer of the sink's queue with the number of writes it took out in one go
+    inline void drained(const uint8_t n) {
+        counters.drained(n);
+    }
+
+    // snapshot of the pipeline statistics, all zero unless compiled with ARDUINOSID_STATS
+    SIDArrayStats<N> stats() const {
+        SIDArrayStats<N> s;
+
+        counters.get(s);
+
+        return s;
+    }
+
+    void resetStats() {
+        counters.reset();
+    }
+
+    bool const isDirty() {
+        for(uint8_t sid = 0; sid < N; sid++) {
+            if(dirty[sid]) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // copy the register images of all SIDs
+    void snapshot(Snapshot &snapshot) const {
+        for(uint8_t sid = 0; sid < N; sid++) {
+            memcpy(snapshot.regs[sid], SIDs[sid].getRegisters(), SIDLayout::NUM_WO_REGS);
+            memset(snapshot.regs[sid] + SIDLayout::NUM_WO_REGS, 0, SNAPSHOT_STRIDE - SIDLayout::NUM_WO_REGS);
+        }
+    }
+
+    // set the registers of all SIDs to a snapshot; only registers which differ from the current state are
+    // written, returns their number
+    size_t restore(const Snapshot &snapshot) {
+        size_t n = 0;
+
+        for(uint8_t sid = 0; sid < N; sid++) {
+            SIDType &s = SIDs[sid];
+
+            diffRegisters(s.getRegisters(), snapshot.regs[sid], [&](const uint8_t reg, const uint8_t val) {
+                s.setRegister(reg, val);
+                n++;
+            });
+        }
+
+        return n;
+    }
+
+    // minimal list of register writes which turns state from into state to, writes must hold MAX_DIFF entries;
+    // returns the number of writes
+    static size_t diff(const Snapshot &from, const Snapshot &to, RegisterWrite *writes) {
+        size_t n = 0;
+
+        for(uint8_t sid = 0; sid < N; sid++) {
+            diffRegisters(from.regs[sid], to.regs[sid], [&](const uint8_t reg, const uint8_t val) {
+                writes[n++] = RegisterWrite(sid, reg, val);
+            });
+        }
+
+        return n;
     }
 
-    SID& getSID(uint8_t SIDNo) {
-        assert(SIDNo < MAX_NUM_SIDS);
+    SIDType& getSID(uint8_t SIDNo) {
+        assert(SIDNo < N);
 
         return SIDs[SIDNo];
     }
 
-    auto &getRingBuffer() {
-        return buffer;
+    Sink &getSink() {
+        return sink;
     }
 };
 
@@ -0,0 +1,440 @@
+#pragma once
+
+#ifndef ARDUINOSID_SIDEMU_H
+#define ARDUINOSID_SIDEMU_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include <cmath>
+
+#include "sid.h"
+#include "freq.h"
+#include "sidemu_kernels.h"
+
+// host side software emulation of N SID 6581 or 8580 chips
+//
+// The emulator is a register sink, it consumes the same (sid, reg, val) write stream as the Arduino timer ISR
+// and renders PCM from it. It is not cycle exact: oscillators and envelopes are advanced by the number of phi2
+// cycles per output sample at once, and the filter runs once per output sample, all in integer arithmetic.
+//
+// Oscillators are 24 bit phase accumulators kept in the upper 24 bits of a 32 bit word, so the fractional
+// cycles per sample add up correctly and wrap around for free. Envelopes are 8.16 fixed point levels.
+// Voices are advanced by the kernels in sidemu_kernels.h, the filter and mixing run per chip.
+//
+// The filter is a state variable filter with trapezoidal integration in fixed point with 24 fraction bits. Its
+// cut-off comes from a table per chip model, built for the sample rate when the emulator is constructed: the 6581
+// curve is flat at the bottom, steep in the middle and saturates at the top, the 8580 one is linear. Each chip can
+// be set to either model, so a mixed stack renders each chip with its own curve.
+
+// chip models, they differ in the filter
+enum SIDModel : uint8_t {
+    SID_MODEL_6581,
+    SID_MODEL_8580
+};
+
+class SIDEmulation {
+public:
+    // phi2 clock frequencies in Hz
+    static constexpr uint32_t PAL_CLOCK = Frequency::PAL_CLOCK;
+    static constexpr uint32_t NTSC_CLOCK = Frequency::NTSC_CLOCK;
+
+    // envelope states
+    static const uint8_t ENV_ATTACK = 0;
+    static const uint8_t ENV_DECAY_SUSTAIN = 1;
+    static const uint8_t ENV_RELEASE = 2;
+
+    // maximum envelope level in 8.16 fixed point
+    static const uint32_t ENV_MAX = 0xff0000;
+
+    // number of 11 bit cut-off values
+    static const uint16_t NUM_CUTOFFS = 2048;
+
+    // cut-off frequency in Hz of a chip model for an 11 bit cut-off value
+    static inline float cutoffHz(const SIDModel model, const uint16_t fc) {
+        if(model == SID_MODEL_8580) {
+            return 30.0f + 12470.0f * (float) fc / (NUM_CUTOFFS - 1);
+        }
+
+        return 220.0f + 17780.0f / (1.0f + expf(-((float) fc - 1100.0f) / 220.0f));
+    }
+
+    // damping 1 / Q of a chip model for a 4 bit resonance, the 8580 resonates more
+    static inline float damping(const SIDModel model, const uint8_t res) {
+        return 1.0f / (0.707f + (model == SID_MODEL_8580 ? 3.0f : 1.7f) * (float) res / 15.0f);
+    }
+
+    // cycles per envelope step for the 16 attack/decay/release rates
+    static constexpr uint16_t RATE_PERIOD[16] = {
+        9, 32, 63, 95, 149, 220, 267, 313, 392, 977, 1954, 3126, 3907, 11720, 19532, 31251
+    };
+
+    // 12 bit noise waveform from the shift register taps
+    static inline uint32_t noiseOutput(const uint32_t noise) {
+        return ((noise & 0x400000) >> 11) |
+               ((noise & 0x100000) >> 10) |
+               ((noise & 0x010000) >> 7) |
+               ((noise & 0x002000) >> 5) |
+               ((noise & 0x000800) >> 4) |
+               ((noise & 0x000080) >> 1) |
+               ((noise & 0x000010) << 1) |
+               ((noise & 0x000004) << 2);
+    }
+
+    // 12 bit waveform output of a voice, combined waveforms are approximated by and-ing them
+    static inline uint32_t waveOutput(const uint32_t acc, const uint32_t sourceAcc, const uint8_t wvCtl,
+                                      const uint32_t pw, const uint32_t noise) {
+        const uint32_t acc24 = acc >> 8;
+        uint32_t msb = acc & 0x80000000;
+
+        if(wvCtl & SIDVoiceLayout::SIDCtlRMd) {
+            msb ^= sourceAcc & 0x80000000;
+        }
+
+        uint32_t out = 0xfff;
+
+        if(wvCtl & SIDVoiceLayout::SIDWavTri) {
+            out &= ((msb ? ~acc24 : acc24) >> 11) & 0xfff;
+        }
+
+        if(wvCtl & SIDVoiceLayout::SIDWavSaw) {
+            out &= acc24 >> 12;
+        }
+
+        if(wvCtl & SIDVoiceLayout::SIDWavSqu) {
+            out &= ((acc24 >> 12) >= pw || (wvCtl & SIDVoiceLayout::SIDCtlTst)) ? 0xfff : 0;
+        }
+
+        if(wvCtl & SIDVoiceLayout::SIDWavNse) {
+            out &= noiseOutput(noise);
+        }
+
+        return (wvCtl & 0xf0) ? out : 0;
+    }
+};
+
+template <uint8_t N>
+class SIDEmulator : public SIDEmulation {
+public:
+    static const uint8_t NUM_SIDS = N;
+
+private:
+    using Voice = SIDVoiceLayout;
+    using Filter = SIDFilterLayout;
+
+    // fraction bits of the filter coefficients, enough for a low cut-off at the phi2 clock rate, and of the
+    // filter state, so the integrators do not stall on rounding at low cut-offs
+    static const uint8_t FILTER_BITS = 24;
+    static const uint8_t STATE_BITS = 8;
+
+    // filter state with STATE_BITS and coefficients with FILTER_BITS fraction bits
+    struct FilterState {
+        int64_t ic1eq = 0;
+        int64_t ic2eq = 0;
+        int64_t g = 0;
+        int64_t a1 = 1LL << FILTER_BITS;
+        int64_t a2 = 0;
+        int64_t k = 1LL << FILTER_BITS;
+    };
+
+    struct Chip {
+        uint8_t regs[SIDLayout::NUM_WO_REGS] = {};
+        SIDModel model = SID_MODEL_6581;
+        FilterState filter;
+    };
+
+    static_assert(N <= SIDVoiceLanes::LANES, "too many SIDs for the voice kernels");
+
+    // output samples per kernel call
+    static const size_t BLOCK_SIZE = 32;
+
+    const uint32_t clock;
+    const uint32_t sampleRate;
+
+    // phi2 cycles per output sample, 24.8 fixed point
+    const uint32_t cyclesPerSample;
+
+    // envelope increments per output sample for the 16 rates
+    uint32_t rateInc[16];
+
+    // per chip model, the filter gain tan(pi * cut-off / sample rate) for every cut-off value and the damping
+    // for every resonance, with FILTER_BITS fraction bits
+    uint32_t cutoffGain[2][NUM_CUTOFFS];
+    uint32_t resDamping[2][16];
+
+    Chip chips[N];
+
+    // voice state of all chips, one lane per chip
+    SIDVoiceLanes lanes;
+
+    SIDKernel kernel;
+    SIDVoiceKernelFn kernelFn;
+
+    SIDVoiceOutputs outputs[BLOCK_SIZE];
+
+    void buildFilterTables() {
+        const double nyquist = 0.45 * sampleRate;
+        const double one = (double) (1L << FILTER_BITS);
+
+        for(uint8_t model = SID_MODEL_6581; model <= SID_MODEL_8580; model++) {
+            for(uint16_t fc = 0; fc < NUM_CUTOFFS; fc++) {
+                const double hz = cutoffHz((SIDModel) model, fc);
+
+                cutoffGain[model][fc] = (uint32_t) (tan(M_PI * (hz > nyquist ? nyquist : hz) / sampleRate) * one);
+            }
+
+            for(uint8_t res = 0; res < 16; res++) {
+                resDamping[model][res] = (uint32_t) (damping((SIDModel) model, res) * one);
+            }
+        }
+    }
+
+    // a table lookup and one division per cut-off or resonance change
+    void updateFilter(Chip &chip) {
+        const uint16_t fc = ((uint16_t) chip.regs[Filter::SIDRegFCHi] << 3) | (chip.regs[Filter::SIDRegFCLo] & 0x07);
+        const uint8_t res = chip.regs[Filter::SIDRegResFilt] >> 4;
+
+        FilterState &f = chip.filter;
+        const int64_t g = cutoffGain[chip.model][fc];
+
+        f.g = g;
+        f.k = resDamping[chip.model][res];
+        f.a1 = (1LL << (2 * FILTER_BITS)) / ((1LL << FILTER_BITS) + ((g * (g + f.k)) >> FILTER_BITS));
+        f.a2 = (g * f.a1) >> FILTER_BITS;
+    }
+
+    void updateVoice(const uint8_t sid, const uint8_t voiceNo, const uint8_t reg) {
+        const uint8_t *regs = chips[sid].regs + voiceNo * SIDLayout::NUM_VOICE_REGS;
+        const uint8_t i = voiceNo;
+        SIDVoiceLanes &v = lanes;
+
+        switch(reg) {
+            case Voice::SIDRegFQLo:
+            case Voice::SIDRegFQHi:
+                v.step[i][sid] = (((uint32_t) regs[Voice::SIDRegFQHi] << 8) | regs[Voice::SIDRegFQLo]) *
+                                 cyclesPerSample;
+                break;
+
+            case Voice::SIDRegPWLo:
+            case Voice::SIDRegPWHi:
+                v.pw[i][sid] = ((uint32_t) (regs[Voice::SIDRegPWHi] & 0x0f) << 8) | regs[Voice::SIDRegPWLo];
+                break;
+
+            case Voice::SIDRegWvCtl: {
+                const uint8_t val = regs[Voice::SIDRegWvCtl];
+
+                if((val & Voice::SIDCtlGat) && !(v.wvCtl[i][sid] & Voice::SIDCtlGat)) {
+                    v.envState[i][sid] = ENV_ATTACK;
+                } else if(!(val & Voice::SIDCtlGat) && (v.wvCtl[i][sid] & Voice::SIDCtlGat)) {
+                    v.envState[i][sid] = ENV_RELEASE;
+                }
+
+                if(val & Voice::SIDCtlTst) {
+                    v.acc[i][sid] = 0;
+                    v.noise[i][sid] = 0x7ffff8;
+                }
+
+                v.wvCtl[i][sid] = val;
+                break;
+            }
+
+            case Voice::SIDRegAD:
+                v.attackInc[i][sid] = rateInc[regs[Voice::SIDRegAD] >> 4];
+                v.decayInc[i][sid] = rateInc[regs[Voice::SIDRegAD] & 0x0f];
+                break;
+
+            case Voice::SIDRegSR:
+                v.sustain[i][sid] = (uint32_t) ((regs[Voice::SIDRegSR] >> 4) * 0x11) << 16;
+                v.releaseInc[i][sid] = rateInc[regs[Voice::SIDRegSR] & 0x0f];
+                break;
+        }
+    }
+
+    // route the voice outputs of one sample through the filter of a chip
+    int32_t mixChip(const uint8_t sid, const SIDVoiceOutputs &voices) {
+        const uint8_t resFilt = chips[sid].regs[Filter::SIDRegResFilt];
+        const uint8_t modVol = chips[sid].regs[Filter::SIDRegModVol];
+        int32_t direct = 0;
+        int32_t filtered = 0;
+
+        for(uint8_t i = 0; i < SIDLayout::NUM_VOICES; i++) {
+            const int32_t out = voices.out[i][sid];
+
+            if(resFilt & (1 << i)) {
+                filtered += out;
+            } else if(i != 2 || !(modVol & 0x80)) {
+                // voice 3 can be switched off unless it is routed through the filter
+                direct += out;
+            }
+        }
+
+        return mix(chips[sid], direct, filtered);
+    }
+
+    // run the filter and apply the volume, returns a sample scaled to 16 bits
+    int32_t mix(Chip &chip, const int32_t direct, const int32_t filtered) {
+        const uint8_t modVol = chip.regs[Filter::SIDRegModVol];
+        FilterState &f = chip.filter;
+
+        // 3 voices of +-0x800 * 0xff fit into 21 bits, with the state fraction and resonance into 33, so the
+        // products with the coefficients fit into 64; products are rounded to nearest
+        const int64_t half = 1LL << (FILTER_BITS - 1);
+        const int64_t v0 = (int64_t) filtered << STATE_BITS;
+        const int64_t v3 = v0 - f.ic2eq;
+        const int64_t v1 = (f.a1 * f.ic1eq + f.a2 * v3 + half) >> FILTER_BITS;
+        const int64_t v2 = f.ic2eq + ((f.g * v1 + half) >> FILTER_BITS);
+
+        f.ic1eq = 2 * v1 - f.ic1eq;
+        f.ic2eq = 2 * v2 - f.ic2eq;
+
+        int64_t out = 0;
+
+        if(modVol & Filter::SIDFModLP) {
+            out += v2;
+        }
+
+        if(modVol & Filter::SIDFModBP) {
+            out += v1;
+        }
+
+        if(modVol & Filter::SIDFModHP) {
+            out += v0 - ((f.k * v1 + half) >> FILTER_BITS) - v2;
+        }
+
+        return (((int32_t) (out >> STATE_BITS) + direct) * (int32_t) (modVol & 0x0f)) / (15 * 32);
+    }
+
+public:
+    SIDEmulator(const uint32_t clock = PAL_CLOCK, const uint32_t sampleRate = 44100)
+        : clock(clock),
+          sampleRate(sampleRate),
+          cyclesPerSample((uint32_t) (((uint64_t) clock << 8) / sampleRate)) {
+        setKernel(sidBestKernel());
+
+        // one envelope step is 1 << 16 in 8.16 fixed point
+        for(uint8_t i = 0; i < 16; i++) {
+            rateInc[i] = (uint32_t) (((uint64_t) cyclesPerSample << 8) / RATE_PERIOD[i]);
+        }
+
+        buildFilterTables();
+
+        // derive the voice and filter state from the all zero registers after reset
+        for(uint8_t i = 0; i < N; i++) {
+            for(uint8_t j = 0; j < SIDLayout::NUM_VOICES; j++) {
+                lanes.noise[j][i] = 0x7ffff8;
+                lanes.envState[j][i] = ENV_RELEASE;
+
+                updateVoice(i, j, Voice::SIDRegAD);
+                updateVoice(i, j, Voice::SIDRegSR);
+            }
+
+            updateFilter(chips[i]);
+        }
+    }
+
+    uint32_t getClock() const {
+        return clock;
+    }
+
+    uint32_t getSampleRate() const {
+        return sampleRate;
+    }
+
+    // chip model of one chip, all chips start out as 6581
+    void setModel(const uint8_t sid, const SIDModel model) {
+        assert(sid < N);
+
+        chips[sid].model = model;
+        updateFilter(chips[sid]);
+    }
+
+    SIDModel getModel(const uint8_t sid) const {
+        assert(sid < N);
+
+        return chips[sid].model;
+    }
+
+    // cut-off frequency in Hz a chip is set to
+    float getCutoff(const uint8_t sid) const {
+        assert(sid < N);
+
+        const uint8_t *regs = chips[sid].regs;
+
+        return cutoffHz(chips[sid].model,
+                        ((uint16_t) regs[Filter::SIDRegFCHi] << 3) | (regs[Filter::SIDRegFCLo] & 0x07));
+    }
+
+    // select the voice kernel, returns false if the CPU does not support it
+    bool setKernel(const SIDKernel kernel) {
+        if(!sidKernelSupported(kernel)) {
+            return false;
+        }
+
+        this->kernel = kernel;
+        kernelFn = sidVoiceKernelFn(kernel);
+
+        return true;
+    }
+
+    SIDKernel getKernel() const {
+        return kernel;
+    }
+
+    // sink interface
+    bool write(const uint8_t sid, const uint8_t reg, const uint8_t val) {
+        assert(sid < N && reg < SIDLayout::NUM_WO_REGS);
+
+        Chip &chip = chips[sid];
+
+        chip.regs[reg] = val;
+
+        if(reg < SIDLayout::NUM_VOICES * SIDLayout::NUM_VOICE_REGS) {
+            updateVoice(sid, reg / SIDLayout::NUM_VOICE_REGS, reg % SIDLayout::NUM_VOICE_REGS);
+        } else if(reg != Filter::SIDRegModVol) {
+            updateFilter(chip);
+        }
+
+        return true;
+    }
+
+    // render frames mono samples of all chips mixed together
+    void render(const size_t frames, int16_t *buffer) {
+        for(size_t done = 0; done < frames; done += BLOCK_SIZE) {
+            const size_t block = frames - done < BLOCK_SIZE ? frames - done : BLOCK_SIZE;
+
+            kernelFn(lanes, outputs, block, N);
+
+            for(size_t i = 0; i < block; i++) {
+                int32_t sample = 0;
+
+                for(uint8_t j = 0; j < N; j++) {
+                    sample += mixChip(j, outputs[i]);
+                }
+
+                sample /= N;
+
+                buffer[done + i] = (int16_t) (sample > 32767 ? 32767 : sample < -32768 ? -32768 : sample);
+            }
+        }
+    }
+
+    // envelope level 0 to 255 of a voice, as the ENV3 register reads it for voice 3
+    uint8_t getEnvelope(const uint8_t sid, const uint8_t voiceNo) const {
+        assert(sid < N && voiceNo < SIDLayout::NUM_VOICES);
+
+        return (uint8_t) (lanes.env[voiceNo][sid] >> 16);
+    }
+
+    // upper 8 bits of a voice's waveform, as the OSC3 register reads it for voice 3
+    uint8_t getOscillator(const uint8_t sid, const uint8_t voiceNo) const {
+        assert(sid < N && voiceNo < SIDLayout::NUM_VOICES);
+
+        const uint8_t i = voiceNo;
+        const uint8_t src = (voiceNo + 2) % SIDLayout::NUM_VOICES;
+
+        return (uint8_t) (waveOutput(lanes.acc[i][sid], lanes.acc[src][sid], (uint8_t) lanes.wvCtl[i][sid],
+                                     lanes.pw[i][sid], lanes.noise[i][sid]) >> 4);
+    }
+};
+
+#endif // ARDUINOSID_SIDEMU_H
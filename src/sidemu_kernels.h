@@ -0,0 +1,266 @@
+#pragma once
+
+#ifndef ARDUINOSID_SIDEMU_KERNELS_H
+#define ARDUINOSID_SIDEMU_KERNELS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include "sid.h"
+
+// voice kernels of the software SID, see sidemu.h
+//
+// The oscillator, waveform and envelope state of all voices is stored as structure of arrays: one array per
+// field and voice number, with one lane per chip. Voice n of every chip syncs to and ring modulates with voice
+// (n + 2) % 3 of the same chip, which is the same lane in another array, so no shuffles are needed.
+//
+// There is a single kernel, written once against GCC vector types. It is instantiated with one lane as the
+// scalar fallback, and with four and eight lanes compiled for SSE2 and AVX2, so all variants produce bit
+// identical output by construction. The vector variants are picked at run time.
+
+class SIDVoiceLanes {
+public:
+    // lanes of the widest kernel, one per chip
+    static const uint8_t LANES = 8;
+
+    alignas(32) uint32_t acc[SIDLayout::NUM_VOICES][LANES] = {};        // phase accumulator, 24 bits in the upper bits
+    alignas(32) uint32_t step[SIDLayout::NUM_VOICES][LANES] = {};       // accumulator increment per output sample
+    alignas(32) uint32_t noise[SIDLayout::NUM_VOICES][LANES] = {};      // noise shift register
+    alignas(32) uint32_t pw[SIDLayout::NUM_VOICES][LANES] = {};         // 12 bit pulse width
+    alignas(32) uint32_t wvCtl[SIDLayout::NUM_VOICES][LANES] = {};      // wave and control register
+    alignas(32) uint32_t env[SIDLayout::NUM_VOICES][LANES] = {};        // envelope level, 8.16 fixed point
+    alignas(32) uint32_t envState[SIDLayout::NUM_VOICES][LANES] = {};   // envelope state
+    alignas(32) uint32_t attackInc[SIDLayout::NUM_VOICES][LANES] = {};  // envelope increments per output sample
+    alignas(32) uint32_t decayInc[SIDLayout::NUM_VOICES][LANES] = {};
+    alignas(32) uint32_t releaseInc[SIDLayout::NUM_VOICES][LANES] = {};
+    alignas(32) uint32_t sustain[SIDLayout::NUM_VOICES][LANES] = {};    // sustain level, 8.16 fixed point
+};
+
+// voice outputs of one output sample, signed wave times envelope
+struct SIDVoiceOutputs {
+    alignas(32) int32_t out[SIDLayout::NUM_VOICES][SIDVoiceLanes::LANES];
+};
+
+// GCC vector types of one, four and eight lanes; the single lane type compiles to plain integer code, and the
+// instruction set used for the wider ones is chosen by the target of the function the kernel is inlined into.
+// Vector compares yield all ones or all zeros per lane, which the kernel uses as select masks.
+
+typedef uint32_t SIDVec1u __attribute__((vector_size(4)));
+typedef int32_t SIDVec1i __attribute__((vector_size(4)));
+typedef uint32_t SIDVec4u __attribute__((vector_size(16)));
+typedef int32_t SIDVec4i __attribute__((vector_size(16)));
+typedef uint32_t SIDVec8u __attribute__((vector_size(32)));
+typedef int32_t SIDVec8i __attribute__((vector_size(32)));
+
+// the voice kernel: advance lanes [0, lanes) of all voices by frames output samples
+
+template <typename V, typename VS>
+static inline __attribute__((always_inline))
+void sidVoiceKernel(SIDVoiceLanes &s, SIDVoiceOutputs *outputs, const size_t frames, const uint8_t lanes) {
+    using Voice = SIDVoiceLayout;
+
+    const uint8_t NV = SIDLayout::NUM_VOICES;
+    const uint8_t WIDTH = sizeof(V) / sizeof(uint32_t);
+
+    const V zero = V{};
+    const V envMax = zero + 0xff0000;
+
+    for(uint8_t lane = 0; lane < lanes; lane += WIDTH) {
+        V acc[NV], step[NV], noise[NV], pw[NV], env[NV], envState[NV];
+        V attackInc[NV], decayInc[NV], releaseInc[NV], sustain[NV];
+        V tstSel[NV], rmdSel[NV], synSel[NV], triSel[NV], sawSel[NV], squSel[NV], nseSel[NV], anySel[NV];
+
+        for(uint8_t i = 0; i < NV; i++) {
+            V wv;
+
+            memcpy(&wv, &s.wvCtl[i][lane], sizeof(V));
+
+            memcpy(&acc[i], &s.acc[i][lane], sizeof(V));
+            memcpy(&step[i], &s.step[i][lane], sizeof(V));
+            memcpy(&noise[i], &s.noise[i][lane], sizeof(V));
+            memcpy(&pw[i], &s.pw[i][lane], sizeof(V));
+            memcpy(&env[i], &s.env[i][lane], sizeof(V));
+            memcpy(&envState[i], &s.envState[i][lane], sizeof(V));
+            memcpy(&attackInc[i], &s.attackInc[i][lane], sizeof(V));
+            memcpy(&decayInc[i], &s.decayInc[i][lane], sizeof(V));
+            memcpy(&releaseInc[i], &s.releaseInc[i][lane], sizeof(V));
+            memcpy(&sustain[i], &s.sustain[i][lane], sizeof(V));
+
+            tstSel[i] = (V) ((VS) (wv & Voice::SIDCtlTst) > (VS) zero);
+            rmdSel[i] = (V) ((VS) (wv & Voice::SIDCtlRMd) > (VS) zero);
+            synSel[i] = (V) ((VS) (wv & Voice::SIDCtlSyn) > (VS) zero);
+            triSel[i] = (V) ((VS) (wv & Voice::SIDWavTri) > (VS) zero);
+            sawSel[i] = (V) ((VS) (wv & Voice::SIDWavSaw) > (VS) zero);
+            squSel[i] = (V) ((VS) (wv & Voice::SIDWavSqu) > (VS) zero);
+            nseSel[i] = (V) ((VS) (wv & Voice::SIDWavNse) > (VS) zero);
+            anySel[i] = (V) ((VS) (wv & 0xf0) > (VS) zero);
+        }
+
+        for(size_t f = 0; f < frames; f++) {
+            V prev[NV];
+
+            // oscillators, noise is clocked by bit 19 of the accumulator
+            for(uint8_t i = 0; i < NV; i++) {
+                prev[i] = acc[i];
+                acc[i] += step[i] & ~tstSel[i];
+
+                const V clk = zero - (((~prev[i] & acc[i]) >> 27) & 1);
+                const V clocked = ((noise[i] << 1) & 0x7fffff) | (((noise[i] >> 22) ^ (noise[i] >> 17)) & 1);
+
+                noise[i] = (clocked & clk) | (noise[i] & ~clk);
+            }
+
+            // hard sync to the msb of the preceding voice
+            for(uint8_t i = 0; i < NV; i++) {
+                const uint8_t src = (i + 2) % NV;
+
+                acc[i] &= ~((V) ((VS) (~prev[src] & acc[src]) >> 31) & synSel[i]);
+            }
+
+            for(uint8_t i = 0; i < NV; i++) {
+                const uint8_t src = (i + 2) % NV;
+
+                // envelope; decay and release slow down by powers of two as the level falls
+                V dec = decayInc[i];
+                V rel = releaseInc[i];
+                static const uint32_t thresholds[5] = { 0x5e0000, 0x370000, 0x1b0000, 0x0f0000, 0x070000 };
+
+                for(uint8_t t = 0; t < 5; t++) {
+                    const V below = (V) ((VS) (zero + thresholds[t]) > (VS) env[i]);
+
+                    dec = ((dec >> 1) & below) | (dec & ~below);
+                    rel = ((rel >> 1) & below) | (rel & ~below);
+                }
+
+                const V isAttack = (V) (envState[i] == zero);
+                const V isDecay = (V) (envState[i] == (zero + 1));
+
+                V a = env[i] + attackInc[i];
+                const V attackDone = (V) ((VS) a > (VS) (envMax - 1));
+
+                a = (envMax & attackDone) | (a & ~attackDone);
+
+                const V aboveSustain = (V) ((VS) env[i] > (VS) sustain[i]);
+                const V decays = (V) ((VS) (env[i] - sustain[i]) > (VS) dec);
+                V d = ((env[i] - dec) & decays) | (sustain[i] & ~decays);
+
+                d = (d & aboveSustain) | (env[i] & ~aboveSustain);
+
+                const V releases = (V) ((VS) env[i] > (VS) rel);
+                const V r = (env[i] - rel) & releases;
+
+                env[i] = (a & isAttack) | (d & isDecay) | (r & ~(isAttack | isDecay));
+                envState[i] = ((zero + 1) & isAttack & attackDone) | (envState[i] & ~(isAttack & attackDone));
+
+                // waveforms, combined waveforms are approximated by and-ing them
+                const V acc24 = acc[i] >> 8;
+                const V msb = (V) ((VS) acc[i] >> 31) ^ ((V) ((VS) acc[src] >> 31) & rmdSel[i]);
+                const V tri = ((acc24 ^ msb) >> 11) & 0xfff;
+                const V saw = acc24 >> 12;
+                const V pulse = ~((V) ((VS) pw[i] > (VS) saw) & ~tstSel[i]) & 0xfff;
+                const V n = noise[i];
+                const V nse = ((n & 0x400000) >> 11) |
+                              ((n & 0x100000) >> 10) |
+                              ((n & 0x010000) >> 7) |
+                              ((n & 0x002000) >> 5) |
+                              ((n & 0x000800) >> 4) |
+                              ((n & 0x000080) >> 1) |
+                              ((n & 0x000010) << 1) |
+                              ((n & 0x000004) << 2);
+
+                const V wave = (tri | ~triSel[i]) & (saw | ~sawSel[i]) & (pulse | ~squSel[i]) &
+                               (nse | ~nseSel[i]) & anySel[i] & 0xfff;
+
+                const VS out = (VS) (wave - 0x800) * (VS) (env[i] >> 16);
+
+                memcpy(&outputs[f].out[i][lane], &out, sizeof(V));
+            }
+        }
+
+        for(uint8_t i = 0; i < NV; i++) {
+            memcpy(&s.acc[i][lane], &acc[i], sizeof(V));
+            memcpy(&s.noise[i][lane], &noise[i], sizeof(V));
+            memcpy(&s.env[i][lane], &env[i], sizeof(V));
+            memcpy(&s.envState[i][lane], &envState[i], sizeof(V));
+        }
+    }
+}
+
+// kernel variants
+
+enum SIDKernel {
+    SID_KERNEL_SCALAR,
+    SID_KERNEL_SSE2,
+    SID_KERNEL_AVX2
+};
+
+typedef void (*SIDVoiceKernelFn)(SIDVoiceLanes &s, SIDVoiceOutputs *outputs, size_t frames, uint8_t lanes);
+
+static inline void sidVoiceKernelScalar(SIDVoiceLanes &s, SIDVoiceOutputs *outputs, const size_t frames,
+                                        const uint8_t lanes) {
+    sidVoiceKernel<SIDVec1u, SIDVec1i>(s, outputs, frames, lanes);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// vector kernels always process whole vectors, the unused lanes are idle chips
+
+__attribute__((target("sse2")))
+static inline void sidVoiceKernelSSE2(SIDVoiceLanes &s, SIDVoiceOutputs *outputs, const size_t frames,
+                                      const uint8_t lanes) {
+    sidVoiceKernel<SIDVec4u, SIDVec4i>(s, outputs, frames, lanes);
+}
+
+__attribute__((target("avx2")))
+static inline void sidVoiceKernelAVX2(SIDVoiceLanes &s, SIDVoiceOutputs *outputs, const size_t frames,
+                                      const uint8_t lanes) {
+    sidVoiceKernel<SIDVec8u, SIDVec8i>(s, outputs, frames, lanes);
+}
+
+static inline bool sidKernelSupported(const SIDKernel kernel) {
+    switch(kernel) {
+        case SID_KERNEL_SSE2:
+            return __builtin_cpu_supports("sse2");
+
+        case SID_KERNEL_AVX2:
+            return __builtin_cpu_supports("avx2");
+
+        default:
+            return true;
+    }
+}
+
+static inline SIDVoiceKernelFn sidVoiceKernelFn(const SIDKernel kernel) {
+    switch(kernel) {
+        case SID_KERNEL_SSE2:
+            return sidVoiceKernelSSE2;
+
+        case SID_KERNEL_AVX2:
+            return sidVoiceKernelAVX2;
+
+        default:
+            return sidVoiceKernelScalar;
+    }
+}
+
+#else
+
+static inline bool sidKernelSupported(const SIDKernel kernel) {
+    return kernel == SID_KERNEL_SCALAR;
+}
+
+static inline SIDVoiceKernelFn sidVoiceKernelFn(const SIDKernel) {
+    return sidVoiceKernelScalar;
+}
+
+#endif
+
+// best kernel for the CPU we are running on
+static inline SIDKernel sidBestKernel() {
+    return sidKernelSupported(SID_KERNEL_AVX2) ? SID_KERNEL_AVX2 :
+           sidKernelSupported(SID_KERNEL_SSE2) ? SID_KERNEL_SSE2 :
+           SID_KERNEL_SCALAR;
+}
+
+#endif // ARDUINOSID_SIDEMU_KERNELS_H
@@ -0,0 +1,609 @@
+#pragma once
+
+#ifndef ARDUINOSID_SINKS_H
+#define ARDUINOSID_SINKS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <tuple>
+
+#include "ringbuffer.h"
+#include "sid.h"
+
+#if !defined(ARDUINO)
+#include <functional>
+#include <ostream>
+#endif
+
+// register sink policies for SID and SIDArray, see sid.h
+
+// queues register writes for the Arduino timer ISR
+
+template <size_t _size>
+class RingBufferSink {
+public:
+    using Buffer = SPSCRingBuffer<std::tuple<uint8_t, uint8_t, uint8_t>, _size>;
+
+private:
+    Buffer buffer;
+
+public:
+    inline bool write(const uint8_t sid, const uint8_t reg, const uint8_t val) {
+        return buffer.put(std::tuple<uint8_t, uint8_t, uint8_t>(sid, reg, val));
+    }
+
+    inline size_t size() const {
+        return buffer.size();
+    }
+
+    Buffer &getBuffer() {
+        return buffer;
+    }
+};
+
+// queues register writes for the Arduino timer ISR as (chips, reg, val), with one bit per chip, so a write
+// pending on several chips takes one slot and one bus cycle
+
+template <size_t _size>
+class MulticastRingBufferSink {
+public:
+    using Buffer = SPSCRingBuffer<std::tuple<uint8_t, uint8_t, uint8_t>, _size>;
+
+private:
+    Buffer buffer;
+
+public:
+    inline bool write(const uint8_t sid, const uint8_t reg, const uint8_t val) {
+        return buffer.put(std::tuple<uint8_t, uint8_t, uint8_t>(1 << sid, reg, val));
+    }
+
+    inline bool writeMulticast(const uint8_t chips, const uint8_t reg, const uint8_t val) {
+        return buffer.put(std::tuple<uint8_t, uint8_t, uint8_t>(chips, reg, val));
+    }
+
+    // consumer side, the next write as (chips, reg, val)
+    inline bool pop(std::tuple<uint8_t, uint8_t, uint8_t> &write) {
+        return buffer.pop(write);
+    }
+
+    inline size_t size() const {
+        return buffer.size();
+    }
+
+    Buffer &getBuffer() {
+        return buffer;
+    }
+};
+
+// what a queueing sink does with a write when its queue is full
+enum OverflowPolicy : uint8_t {
+    // reject the write, SIDArray keeps the register dirty and writes it with a later flush
+    OVERFLOW_REJECT,
+
+    // wait for the consumer to make room; the wait is bounded by a number of retries, maxRetries of setPolicy(),
+    // not by a time, since a retry costs a few cycles on AVR and a thread yield on the host; 0 for no limit
+    OVERFLOW_BLOCK,
+
+    // turn the write down like OVERFLOW_REJECT, so SIDArray writes the latest value later, but count it as dropped
+    OVERFLOW_DROP_NEWEST,
+
+    // discard the oldest queued write to make room, SIDArray writes its register again with the next flush
+    OVERFLOW_DROP_OLDEST,
+
+    // replace the value of a queued write to the same register of the same chip instead of queueing another
+    // write, whether the queue is full or not; reject if there is none
+    OVERFLOW_COALESCE,
+
+    // ask a backpressure callback, which may e.g. service the bus itself, whether to try again
+    OVERFLOW_CALLBACK
+};
+
+// producer side of the overflow policy of a queueing sink: whether a write which did not fit is tried again, and
+// counts of the writes given up on
+class OverflowControl {
+public:
+    // see setBackpressure()
+    typedef bool (*Backpressure)(void *context, const uint8_t chips, const uint8_t reg, const uint8_t val);
+
+protected:
+    OverflowPolicy policy;
+    uint32_t maxRetries = 0;
+    Backpressure backpressure = nullptr;
+    void *context = nullptr;
+
+    uint32_t dropped = 0;
+    uint32_t rejected = 0;
+
+    OverflowControl(const OverflowPolicy policy) : policy(policy) {
+    }
+
+    // a write did not fit for the retries + 1st time; true after a pause to try again, false to give up on it
+    bool retry(const uint32_t retries, const uint8_t chips, const uint8_t reg, const uint8_t val) {
+        const bool again = policy == OVERFLOW_BLOCK ? !maxRetries || retries < maxRetries :
+                           policy == OVERFLOW_CALLBACK ? backpressure && backpressure(context, chips, reg, val) :
+                           false;
+
+        if(again) {
+            ringBufferPause();
+        } else if(policy == OVERFLOW_DROP_NEWEST) {
+            dropped++;
+        } else {
+            rejected++;
+        }
+
+        return again;
+    }
+
+public:
+    // maxRetries is the number of retries OVERFLOW_BLOCK makes before it gives up on a write, 0 for no limit
+    void setPolicy(const OverflowPolicy p, const uint32_t maxRetries = 0) {
+        policy = p;
+        this->maxRetries = maxRetries;
+    }
+
+    // for OVERFLOW_CALLBACK, called with each write which does not fit, with one bit per chip it is for; returns
+    // true to try again
+    void setBackpressure(Backpressure callback, void *callbackContext = nullptr) {
+        backpressure = callback;
+        context = callbackContext;
+    }
+
+    OverflowPolicy getPolicy() const {
+        return policy;
+    }
+
+    // writes discarded by OVERFLOW_DROP_NEWEST and OVERFLOW_DROP_OLDEST
+    uint32_t getDropped() const {
+        return dropped;
+    }
+
+    // writes which were turned down
+    uint32_t getRejected() const {
+        return rejected;
+    }
+};
+
+// MulticastRingBufferSink with two lanes: writes to the wave and control registers, which carry the gate and
+// test bits, and to the envelope registers go to a high priority lane the consumer drains first, so note ons do
+// not queue up behind bulk parameter traffic like pulse width or filter sweeps.
+//
+// The frequency and pulse width of a voice go to the low lane, but must not be overtaken by its gate, or a note
+// would start at the previous pitch. So when a high priority write finds writes of its voice still waiting in the
+// low lane, the sink first puts a marker and the latest frequency and pulse width values of the voice into the
+// high lane. The consumer takes them ahead of the gate and, from the marker on, drops the older writes of that
+// voice it then finds in the low lane, up to the last one queued before the marker. Writes to a multicast of
+// several chips only lose the chips they are stale for. The frequency and pulse width thus reach the chip before
+// the gate and never go back to an older value afterwards.
+//
+// Producer and consumer each count the low lane writes per chip and voice, the producer those it put, the consumer
+// those it took; they differ while writes of the voice are queued. The marker carries the producer count, so the
+// consumer knows where the stale writes end.
+//
+// A full lane is handled by an overflow policy. Only those the producer carries out on its own are supported,
+// OVERFLOW_DROP_OLDEST and OVERFLOW_COALESCE change queued writes and need PolicyRingBufferSink.
+
+template <size_t _size, uint8_t _numSIDs = 6, size_t _highSize = (_size / 4 > 8 ? _size / 4 : 8)>
+class PriorityRingBufferSink : public OverflowControl {
+    static_assert(_numSIDs >= 1 && _numSIDs <= 8, "PriorityRingBufferSink chips must fit into a chip mask");
+    static_assert(_size <= 256, "PriorityRingBufferSink markers carry 8 bit counts");
+
+public:
+    using Buffer = SPSCRingBuffer<std::tuple<uint8_t, uint8_t, uint8_t>, _size>;
+    using HighBuffer = SPSCRingBuffer<std::tuple<uint8_t, uint8_t, uint8_t>, _highSize>;
+
+    // high lane marker (1 << chip, MARKER | voice, low lane writes of the voice put before it)
+    static const uint8_t MARKER = 0x80;
+
+private:
+    using count_t = typename Buffer::index_t;
+
+    // frequency and pulse width registers, resent with a marker
+    static const uint8_t NUM_RESENT = 4;
+
+    HighBuffer high;
+    Buffer low;
+
+    // producer side: low lane writes put and the last values of the resent registers, per chip and voice
+    count_t lowPut[_numSIDs][SIDLayout::NUM_VOICES] = {};
+    uint8_t sent[_numSIDs][SIDLayout::NUM_VOICES][NUM_RESENT] = {};
+
+    // consumer side: low lane writes taken, per chip and voice, read by the producer
+    RingBufferIndex<count_t> lowTaken[_numSIDs][SIDLayout::NUM_VOICES];
+
+    // consumer side: one bit per voice of a chip which drops low lane writes up to a count
+    uint8_t dropping[_numSIDs] = {};
+    count_t dropUntil[_numSIDs][SIDLayout::NUM_VOICES] = {};
+
+    static inline bool isHighPriority(const uint8_t voiceReg) {
+        return voiceReg == SIDVoiceLayout::SIDRegWvCtl || voiceReg == SIDVoiceLayout::SIDRegAD ||
+               voiceReg == SIDVoiceLayout::SIDRegSR;
+    }
+
+    // a high priority write of a voice, behind the marker and resent registers of each chip with writes of the
+    // voice in the low lane; all of them or nothing
+    bool putHigh(const uint8_t chips, const uint8_t reg, const uint8_t val) {
+        const uint8_t v = reg / SIDLayout::NUM_VOICE_REGS;
+        uint8_t stale = 0;
+        size_t needed = 1;
+
+        for(uint8_t c = 0; c < _numSIDs; c++) {
+            if((chips & (1 << c)) && lowPut[c][v] != lowTaken[c][v].load()) {
+                stale |= 1 << c;
+                needed += 1 + NUM_RESENT;
+            }
+        }
+
+        if(HighBuffer::capacity() - high.size() < needed) {
+            return false;
+        }
+
+        for(uint8_t c = 0; stale; c++, stale >>= 1) {
+            if(stale & 1) {
+                const uint8_t first = v * SIDLayout::NUM_VOICE_REGS + SIDVoiceLayout::SIDRegFQLo;
+
+                high.put(std::tuple<uint8_t, uint8_t, uint8_t>(1 << c, MARKER | v, lowPut[c][v]));
+
+                for(uint8_t i = 0; i < NUM_RESENT; i++) {
+                    high.put(std::tuple<uint8_t, uint8_t, uint8_t>(1 << c, first + i, sent[c][v][i]));
+                }
+            }
+        }
+
+        return high.put(std::tuple<uint8_t, uint8_t, uint8_t>(chips, reg, val));
+    }
+
+    // note which of the chips of a low lane write of a voice are stale, returns the chips to write
+    uint8_t takeLow(uint8_t chips, const uint8_t v) {
+        for(uint8_t c = 0; c < _numSIDs; c++) {
+            if(!(chips & (1 << c))) {
+                continue;
+            }
+
+            const count_t n = lowTaken[c][v].load() + 1;
+
+            lowTaken[c][v].store(n);
+
+            if(dropping[c] & (1 << v)) {
+                chips &= ~(1 << c);
+
+                if(n == dropUntil[c][v]) {
+                    dropping[c] &= ~(1 << v);
+                }
+            }
+        }
+
+        return chips;
+    }
+
+    inline bool put(const uint8_t chips, const uint8_t reg, const uint8_t val) {
+        if(reg >= SIDLayout::NUM_VOICES * SIDLayout::NUM_VOICE_REGS) {
+            return low.put(std::tuple<uint8_t, uint8_t, uint8_t>(chips, reg, val));
+        }
+
+        const uint8_t v = reg / SIDLayout::NUM_VOICE_REGS;
+        const uint8_t voiceReg = reg % SIDLayout::NUM_VOICE_REGS;
+
+        if(isHighPriority(voiceReg)) {
+            return putHigh(chips, reg, val);
+        }
+
+        if(!low.put(std::tuple<uint8_t, uint8_t, uint8_t>(chips, reg, val))) {
+            return false;
+        }
+
+        for(uint8_t c = 0; c < _numSIDs; c++) {
+            if(chips & (1 << c)) {
+                lowPut[c][v]++;
+                sent[c][v][voiceReg - SIDVoiceLayout::SIDRegFQLo] = val;
+            }
+        }
+
+        return true;
+    }
+
+    static inline bool isSupported(const OverflowPolicy policy) {
+        return policy != OVERFLOW_DROP_OLDEST && policy != OVERFLOW_COALESCE;
+    }
+
+public:
+    PriorityRingBufferSink(const OverflowPolicy policy = OVERFLOW_REJECT) : OverflowControl(policy) {
+        assert(isSupported(policy));
+    }
+
+    void setPolicy(const OverflowPolicy p, const uint32_t maxRetries = 0) {
+        assert(isSupported(p));
+
+        OverflowControl::setPolicy(p, maxRetries);
+    }
+
+    inline bool write(const uint8_t sid, const uint8_t reg, const uint8_t val) {
+        return writeMulticast(1 << sid, reg, val);
+    }
+
+    inline bool writeMulticast(const uint8_t chips, const uint8_t reg, const uint8_t val) {
+        for(uint32_t retries = 0; !put(chips, reg, val); retries++) {
+            if(!retry(retries, chips, reg, val)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // consumer side, the next write as (chips, reg, val)
+    inline bool pop(std::tuple<uint8_t, uint8_t, uint8_t> &write) {
+        for(;;) {
+            if(high.pop(write)) {
+                const uint8_t reg = std::get<1>(write);
+
+                if(!(reg & MARKER)) {
+                    return true;
+                }
+
+                // writes of the voice up to the count in the marker are stale, unless all of them went out already
+                uint8_t c = 0;
+
+                while(!(std::get<0>(write) & (1 << c))) {
+                    c++;
+                }
+
+                const uint8_t v = reg & ~MARKER;
+
+                if(lowTaken[c][v].load() != std::get<2>(write)) {
+                    dropping[c] |= 1 << v;
+                    dropUntil[c][v] = std::get<2>(write);
+                }
+
+                continue;
+            }
+
+            if(!low.pop(write)) {
+                return false;
+            }
+
+            const uint8_t reg = std::get<1>(write);
+
+            if(reg >= SIDLayout::NUM_VOICES * SIDLayout::NUM_VOICE_REGS) {
+                return true;
+            }
+
+            std::get<0>(write) = takeLow(std::get<0>(write), reg / SIDLayout::NUM_VOICE_REGS);
+
+            if(std::get<0>(write)) {
+                return true;
+            }
+        }
+    }
+
+    inline bool empty() const {
+        return high.empty() && low.empty();
+    }
+
+    inline size_t size() const {
+        return high.size() + low.size();
+    }
+
+    HighBuffer &getHighBuffer() {
+        return high;
+    }
+
+    Buffer &getBuffer() {
+        return low;
+    }
+};
+
+// queues register writes as (sid, reg, val) like RingBufferSink, with a selectable overflow policy
+//
+// Dropping the oldest write and coalescing change entries the consumer owns, so producer and consumer share a
+// RingBufferLock, which on AVR means interrupts are off for a few instructions per write and pop. The queued write
+// of each register is found through a table, so coalescing takes constant time.
+//
+// Coalescing keeps the order of the first write to a register, so the chip may see a new value of one register
+// before an older value of another one. A write to a wave and control register which changes the gate or test
+// bit of the queued value is always queued, so no edge is lost.
+
+template <size_t _size, uint8_t _numSIDs = 6>
+class PolicyRingBufferSink : public OverflowControl {
+    static_assert(_size >= 2 && (_size & (_size - 1)) == 0, "PolicyRingBufferSink size must be a power of two");
+
+public:
+    using index_t = typename std::conditional<(_size < 256), uint8_t, uint16_t>::type;
+
+    static const index_t NONE = (index_t) -1;
+
+    // see setEvicted()
+    typedef void (*Evicted)(void *context, const uint8_t sid, const uint8_t reg);
+
+private:
+    static const index_t MASK = (index_t) (_size - 1);
+    static const uint8_t EDGE_BITS = SIDVoiceLayout::SIDCtlGat | SIDVoiceLayout::SIDCtlTst;
+    static const uint8_t NO_REG = 0xff;
+
+    struct Entry {
+        uint8_t sid;
+        uint8_t reg;
+        uint8_t val;
+    };
+
+    Entry values[_size];
+    index_t head = 0;
+    index_t count = 0;
+
+    // entry holding the latest queued write per chip and register, or NONE
+    index_t queued[_numSIDs][SIDLayout::NUM_WO_REGS];
+
+    mutable RingBufferLock lock;
+
+    Evicted evicted = nullptr;
+    void *evictedContext = nullptr;
+
+    uint32_t coalesced = 0;
+
+    static inline bool isWvCtl(const uint8_t reg) {
+        return reg < SIDLayout::NUM_VOICES * SIDLayout::NUM_VOICE_REGS &&
+               reg % SIDLayout::NUM_VOICE_REGS == SIDVoiceLayout::SIDRegWvCtl;
+    }
+
+    // take the oldest entry off the queue, with the lock held
+    inline Entry take() {
+        const Entry e = values[head];
+
+        if(queued[e.sid][e.reg] == head) {
+            queued[e.sid][e.reg] = NONE;
+        }
+
+        head = (head + 1) & MASK;
+        count--;
+
+        return e;
+    }
+
+    // with the lock held; false if the write has to wait. An evicted write which was the latest one queued for its
+    // register is copied to lost.
+    inline bool tryWrite(const uint8_t sid, const uint8_t reg, const uint8_t val, Entry &lost) {
+        index_t &q = queued[sid][reg];
+
+        if(policy == OVERFLOW_COALESCE && q != NONE && (!isWvCtl(reg) || !((values[q].val ^ val) & EDGE_BITS))) {
+            values[q].val = val;
+            coalesced++;
+
+            return true;
+        }
+
+        if(count == _size) {
+            if(policy != OVERFLOW_DROP_OLDEST) {
+                return false;
+            }
+
+            if(queued[values[head].sid][values[head].reg] == head) {
+                lost = values[head];
+            }
+
+            take();
+            dropped++;
+        }
+
+        q = (head + count) & MASK;
+        values[q] = { sid, reg, val };
+        count++;
+
+        return true;
+    }
+
+public:
+    PolicyRingBufferSink(const OverflowPolicy policy = OVERFLOW_REJECT) : OverflowControl(policy) {
+        for(uint8_t sid = 0; sid < _numSIDs; sid++) {
+            for(uint8_t reg = 0; reg < SIDLayout::NUM_WO_REGS; reg++) {
+                queued[sid][reg] = NONE;
+            }
+        }
+    }
+
+    PolicyRingBufferSink(const PolicyRingBufferSink&) = delete;
+
+    // for OVERFLOW_DROP_OLDEST, called with the register of each evicted write no newer write of the register
+    // follows, so the chip keeps an older value; SIDArray sets this up itself
+    void setEvicted(Evicted callback, void *callbackContext = nullptr) {
+        evicted = callback;
+        evictedContext = callbackContext;
+    }
+
+    bool write(const uint8_t sid, const uint8_t reg, const uint8_t val) {
+        assert(sid < _numSIDs && reg < SIDLayout::NUM_WO_REGS);
+
+        for(uint32_t retries = 0;; retries++) {
+            Entry lost = { 0, NO_REG, 0 };
+
+            lock.lock();
+
+            const bool written = tryWrite(sid, reg, val, lost);
+
+            lock.unlock();
+
+            if(lost.reg != NO_REG && evicted) {
+                evicted(evictedContext, lost.sid, lost.reg);
+            }
+
+            if(written) {
+                return true;
+            }
+
+            if(!retry(retries, 1 << sid, reg, val)) {
+                return false;
+            }
+        }
+    }
+
+    // consumer side
+    bool pop(std::tuple<uint8_t, uint8_t, uint8_t> &write) {
+        RingBufferGuard guard(lock);
+
+        if(!count) {
+            return false;
+        }
+
+        const Entry e = take();
+
+        write = std::tuple<uint8_t, uint8_t, uint8_t>(e.sid, e.reg, e.val);
+
+        return true;
+    }
+
+    size_t size() const {
+        RingBufferGuard guard(lock);
+
+        return count;
+    }
+
+    static constexpr size_t capacity() {
+        return _size;
+    }
+
+    // writes merged into a queued write by OVERFLOW_COALESCE
+    uint32_t getCoalesced() const {
+        return coalesced;
+    }
+};
+
+#if !defined(ARDUINO)
+
+// forwards register writes to a type erased callback, the way SID used to work
+
+class CallbackSink {
+private:
+    std::function<void(const uint8_t, const uint8_t, const uint8_t)> callback;
+
+public:
+    CallbackSink(std::function<void(const uint8_t, const uint8_t, const uint8_t)> callback = [](const uint8_t, const uint8_t, const uint8_t) {})
+        : callback(callback) {
+    }
+
+    inline bool write(const uint8_t sid, const uint8_t reg, const uint8_t val) {
+        callback(sid, reg, val);
+
+        return true;
+    }
+};
+
+// prints register writes to a stream
+
+class TraceSink {
+private:
+    std::ostream &out;
+
+public:
+    TraceSink(std::ostream &out) : out(out) {
+    }
+
+    inline bool write(const uint8_t sid, const uint8_t reg, const uint8_t val) {
+        out << "sid: " << std::hex << (unsigned int) sid
+            << " reg: " << std::hex << (unsigned int) reg
+            << " val: " << std::hex << (unsigned int) val << "\n";
+
+        return true;
+    }
+};
+
+#endif // !ARDUINO
+
+#endif // ARDUINOSID_SINKS_H
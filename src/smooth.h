@@ -0,0 +1,274 @@
+#pragma once
+
+#ifndef ARDUINOSID_SMOOTH_H
+#define ARDUINOSID_SMOOTH_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+
+#include "sid.h"
+#include "freq.h"
+
+// portamento and parameter smoothing at control rate
+//
+// SmoothingEngine ramps the frequency and pulse width of every voice and the cut-off of every filter of N chips
+// towards targets, one step per control tick, and writes the result through the setters of a SIDArray or
+// SID. Values are in the units of the setters, setFQ(), setPW() and setFilterFQ(), and are kept in 16.16 fixed
+// point so slow ramps do not stall.
+//
+// A linear ramp adds a fixed 16.16 step per tick. An exponential ramp multiplies by a fixed 8.24 ratio per
+// tick, so a frequency glide moves at a constant number of cents per tick however far apart the notes are;
+// centsRatio() turns cents into the ratio at compile time. Both stop exactly on the target.
+//
+// Only parameters with a running ramp are touched: their numbers sit in a compact active list, and finished ramps
+// are swapped out of it, so a tick costs nothing for idle parameters and at most 7 * N steps. A parameter is only
+// written when the bits the chip register holds change, e.g. a cut-off ramp moving 1/4 of a register step per
+// tick writes on every fourth tick.
+
+enum RampShape : uint8_t {
+    // a fixed step per tick
+    RAMP_LINEAR,
+
+    // a fixed ratio per tick, constant speed in pitch
+    RAMP_EXPONENTIAL
+};
+
+template <uint8_t N>
+class SmoothingEngine {
+public:
+    static const uint8_t NUM_SIDS = N;
+
+    // per chip: FQ and PW of the three voices, then the cut-off
+    static const uint8_t PARAMS_PER_SID = 2 * SIDLayout::NUM_VOICES + 1;
+    static const uint8_t NUM_PARAMS = N * PARAMS_PER_SID;
+    static const uint8_t NONE = 0xff;
+
+    // ratio of 1 in 8.24 fixed point
+    static const uint32_t RATIO_ONE = 1UL << 24;
+
+    // 8.24 ratio per tick for an exponential ramp of a number of cents per tick
+    static constexpr uint32_t centsRatio(const double cents) {
+        return (uint32_t) (Frequency::exp2(cents / 1200.0) * RATIO_ONE + 0.5);
+    }
+
+    // 16.16 step per tick for a linear ramp over a distance in a number of ticks
+    static constexpr uint32_t linearRate(const uint16_t distance, const uint32_t ticks) {
+        return ticks ? (uint32_t) (((uint32_t) distance << 16) / ticks) : 0xffffffff;
+    }
+
+    static inline uint8_t fqParam(const uint8_t sid, const uint8_t voice) {
+        return sid * PARAMS_PER_SID + voice;
+    }
+
+    static inline uint8_t pwParam(const uint8_t sid, const uint8_t voice) {
+        return sid * PARAMS_PER_SID + SIDLayout::NUM_VOICES + voice;
+    }
+
+    static inline uint8_t cutoffParam(const uint8_t sid) {
+        return sid * PARAMS_PER_SID + 2 * SIDLayout::NUM_VOICES;
+    }
+
+private:
+    struct Ramp {
+        // current value and target, 16.16
+        uint32_t value = 0;
+        uint32_t target = 0;
+
+        // 16.16 step or 8.24 ratio per tick, for exponential ramps down the inverse ratio
+        uint32_t rate = 0;
+
+        RampShape shape = RAMP_LINEAR;
+
+        // position in the active list or NONE
+        uint8_t slot = NONE;
+
+        // chip, setter and low bits of the setter value the chip registers do not hold, fixed per parameter
+        uint8_t sid = 0;
+        uint8_t kind = 0;
+        uint8_t shift = 16;
+    };
+
+    Ramp ramps[NUM_PARAMS];
+    uint8_t active[NUM_PARAMS];
+    uint8_t numActive = 0;
+
+    void activate(const uint8_t param) {
+        if(ramps[param].slot == NONE) {
+            ramps[param].slot = numActive;
+            active[numActive++] = param;
+        }
+    }
+
+    void deactivate(const uint8_t param) {
+        const uint8_t slot = ramps[param].slot;
+        const uint8_t last = active[--numActive];
+
+        active[slot] = last;
+        ramps[last].slot = slot;
+        ramps[param].slot = NONE;
+    }
+
+    // advance a ramp by one tick, returns true when it reached its target
+    static inline bool step(Ramp &r) {
+        if(r.shape == RAMP_LINEAR) {
+            if(r.value < r.target) {
+                r.value = r.target - r.value > r.rate ? r.value + r.rate : r.target;
+            } else {
+                r.value = r.value - r.target > r.rate ? r.value - r.rate : r.target;
+            }
+        } else if(r.value < r.target) {
+            // from at least one register step since multiplying 0 goes nowhere, and at least one 16.16 step for
+            // ratios too close to 1
+            uint64_t next = ((uint64_t) (r.value < 0x10000 ? 0x10000 : r.value) * r.rate) >> 24;
+
+            next = next > r.value ? next : r.value + 1;
+            r.value = next < r.target ? (uint32_t) next : r.target;
+        } else if(r.value > 0x10000) {
+            uint64_t next = ((uint64_t) r.value * r.rate) >> 24;
+
+            next = next < r.value ? next : r.value - 1;
+            r.value = next > r.target ? (uint32_t) next : r.target;
+        } else {
+            // below one register step there is nowhere left to glide
+            r.value = r.target;
+        }
+
+        return r.value == r.target;
+    }
+
+    template <typename S>
+    static inline void apply(S &sid, const uint8_t kind, const uint16_t value) {
+        if(kind < SIDLayout::NUM_VOICES) {
+            sid.getVoice(kind).setFQ(value);
+        } else if(kind < 2 * SIDLayout::NUM_VOICES) {
+            sid.getVoice(kind - SIDLayout::NUM_VOICES).setPW(value);
+        } else {
+            sid.getFilter().setFilterFQ(value);
+        }
+    }
+
+public:
+    SmoothingEngine() {
+        for(uint8_t param = 0; param < NUM_PARAMS; param++) {
+            Ramp &r = ramps[param];
+
+            r.sid = param / PARAMS_PER_SID;
+            r.kind = param % PARAMS_PER_SID;
+            r.shift = 16 + (r.kind < SIDLayout::NUM_VOICES ? 0 : r.kind < 2 * SIDLayout::NUM_VOICES ? 4 : 5);
+        }
+    }
+
+    // take the current values of all parameters from the registers, e.g. after setting up a patch
+    template <typename Array>
+    void capture(Array &sidArray) {
+        for(uint8_t sid = 0; sid < N; sid++) {
+            auto &s = sidArray.getSID(sid);
+
+            for(uint8_t v = 0; v < SIDLayout::NUM_VOICES; v++) {
+                jump(fqParam(sid, v), s.getVoice(v).getFQ());
+                jump(pwParam(sid, v), s.getVoice(v).getPW());
+            }
+
+            jump(cutoffParam(sid), s.getFilter().getFilterFQ());
+        }
+    }
+
+    // set a parameter without a ramp, it is written with the next tick
+    void jump(const uint8_t param, const uint16_t value) {
+        assert(param < NUM_PARAMS);
+
+        Ramp &r = ramps[param];
+
+        r.value = (uint32_t) value << 16;
+        r.target = r.value;
+        r.rate = 0;
+        r.shape = RAMP_LINEAR;
+
+        // one tick with nothing left to go writes it
+        activate(param);
+    }
+
+    // ramp a parameter from where it is to a target, by a 16.16 step per tick
+    void rampLinear(const uint8_t param, const uint16_t target, const uint32_t rate) {
+        assert(param < NUM_PARAMS && rate > 0);
+
+        Ramp &r = ramps[param];
+
+        r.target = (uint32_t) target << 16;
+        r.rate = rate;
+        r.shape = RAMP_LINEAR;
+
+        activate(param);
+    }
+
+    // ramp a parameter from where it is to a target, by an 8.24 ratio above 1 per tick, see centsRatio()
+    void rampExponential(const uint8_t param, const uint16_t target, const uint32_t ratio) {
+        assert(param < NUM_PARAMS && ratio > RATIO_ONE);
+
+        Ramp &r = ramps[param];
+
+        r.target = (uint32_t) target << 16;
+        r.rate = r.target > r.value ? ratio : (uint32_t) (((uint64_t) RATIO_ONE << 24) / ratio);
+        r.shape = RAMP_EXPONENTIAL;
+
+        activate(param);
+    }
+
+    // stop a ramp where it is
+    void hold(const uint8_t param) {
+        assert(param < NUM_PARAMS);
+
+        if(ramps[param].slot != NONE) {
+            ramps[param].target = ramps[param].value;
+        }
+    }
+
+    // advance all running ramps by one tick and write the parameters whose register bits changed through the
+    // setters of a SIDArray; returns the number of parameters written
+    template <typename Array>
+    uint8_t tick(Array &sidArray) {
+        uint8_t written = 0;
+
+        for(uint8_t i = 0; i < numActive;) {
+            const uint8_t param = active[i];
+            Ramp &r = ramps[param];
+            const uint32_t before = r.value >> r.shift;
+            const bool jumped = r.rate == 0;
+            const bool done = step(r);
+
+            if(jumped || (r.value >> r.shift) != before) {
+                apply(sidArray.getSID(r.sid), r.kind, (uint16_t) (r.value >> 16));
+                written++;
+            }
+
+            if(done) {
+                // the last active parameter moves into this slot and is advanced next
+                deactivate(param);
+            } else {
+                i++;
+            }
+        }
+
+        return written;
+    }
+
+    // current value of a parameter in setter units
+    uint16_t getValue(const uint8_t param) const {
+        assert(param < NUM_PARAMS);
+
+        return (uint16_t) (ramps[param].value >> 16);
+    }
+
+    bool isActive(const uint8_t param) const {
+        assert(param < NUM_PARAMS);
+
+        return ramps[param].slot != NONE;
+    }
+
+    uint8_t getActive() const {
+        return numActive;
+    }
+};
+
+#endif // ARDUINOSID_SMOOTH_H
@@ -1,12 +1,2387 @@
+// the statistics are checked by testStats
+#define ARDUINOSID_STATS 1
+
 #include "sid.h"
+#include "sinks.h"
+#include "sidemu.h"
+#include "trace.h"
+#include "lfo.h"
+#include "freq.h"
+#include "voices.h"
+#include "midi.h"
+#include "bus.h"
+#include "arduino.h"
+#include "schedule.h"
+#include "patch.h"
+#include "render.h"
+#include "resample.h"
+#include "smooth.h"
+#include "modmatrix.h"
 #include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+
+const void testCallback(const uint8_t sid, const uint8_t reg, const uint8_t val) {
+    std::cout << "sid: " << std::hex << (unsigned int)sid << "reg: " << std::hex << (unsigned int)reg << " val: " << std::hex << (unsigned int)val << "\n";
+}
+
+// hammer a SPSCRingBuffer from a producer and a consumer thread and check nothing is lost, duplicated or reordered
+void testSPSCRingBuffer() {
+    static SPSCRingBuffer<uint32_t, 256> buffer;
+    const uint32_t count = 1000000;
+
+    std::thread producer([&]() {
+        uint32_t chunk[7];
+
+        for(uint32_t i = 0; i < count;) {
+            if(i % 3) {
+                if(buffer.put(i)) {
+                    i++;
+                } else {
+                    std::this_thread::yield();
+                }
+            } else {
+                uint32_t n = 0;
+
+                for(; n < 7 && i + n < count; n++) {
+                    chunk[n] = i + n;
+                }
+
+                size_t stored = buffer.put_n(chunk, n);
+
+                if(stored == 0) {
+                    std::this_thread::yield();
+                }
+
+                i += stored;
+            }
+        }
+    });
+
+    uint32_t expected = 0;
+    uint32_t chunk[5];
+
+    while(expected < count) {
+        size_t n = buffer.pop_n(chunk, 5);
+
+        for(size_t i = 0; i < n; i++, expected++) {
+            assert(chunk[i] == expected);
+        }
+
+        uint32_t val;
+
+        if(buffer.pop(val)) {
+            assert(val == expected);
+            expected++;
+        } else if(n == 0) {
+            std::this_thread::yield();
+        }
+    }
+
+    producer.join();
+
+    assert(buffer.empty());
+
+    std::cout << "SPSCRingBuffer: " << count << " elements passed\n";
+}
+
+// RAM footprint of a SIDArray and its register queue for the supported board sizes; host sizes, pointers
+// and references are larger than on AVR
+template <uint8_t N>
+size_t footprint() {
+    using Array = SIDArray<N, RingBufferSink<registerQueueSize(N)>>;
+
+    std::cout << "SIDArray<" << (unsigned int) N << ">: " << std::dec << sizeof(Array) << " bytes, queue of "
+              << registerQueueSize(N) << " writes\n";
+
+    return sizeof(Array);
+}
+
+void testFootprint() {
+    static_assert(registerQueueSize(1) == 32, "queue size for 1 SID");
+    static_assert(registerQueueSize(2) == 64, "queue size for 2 SIDs");
+    static_assert(registerQueueSize(4) == 128, "queue size for 4 SIDs");
+    static_assert(registerQueueSize(6) == 256, "queue size for 6 SIDs");
+
+    size_t size1 = footprint<1>();
+    size_t size2 = footprint<2>();
+    size_t size4 = footprint<4>();
+    size_t size6 = footprint<6>();
+
+    assert(size1 < size2 && size2 < size4 && size4 < size6);
+
+    // a single chip board only pays for one chip
+    assert(size1 * 4 < size6);
+}
+
+// snapshot, diff and restore of the register images
+void testSnapshot() {
+    using Array = SIDArray<2, RingBufferSink<registerQueueSize(2)>>;
+
+    static Array sidArray;
+    Array::Snapshot before, after;
+    Array::RegisterWrite writes[Array::MAX_DIFF];
+    Array::RegisterWrite write;
+
+    sidArray.getSID(0).getVoice(0).setFQ(0x1234);
+    sidArray.getSID(1).getFilter().setVolume(15);
+    sidArray.flush();
+    sidArray.snapshot(before);
+
+    sidArray.getSID(0).getVoice(0).setFQ(0x1299);
+    sidArray.getSID(1).getVoice(2).setADSR(0x12f0);
+    sidArray.snapshot(after);
+
+    assert(Array::diff(before, before, writes) == 0);
+    assert(Array::diff(before, after, writes) == 3);
+    assert(writes[0] == Array::RegisterWrite(0, 0, 0x99));
+    assert(writes[1] == Array::RegisterWrite(1, 19, 0x12));
+    assert(writes[2] == Array::RegisterWrite(1, 20, 0xf0));
+
+    // restoring the flushed state leaves nothing to flush
+    assert(sidArray.restore(before) == 3);
+    assert(!sidArray.isDirty());
+    assert(sidArray.getSID(0).getVoice(0).getFQ() == 0x1234);
+
+    // restoring the other state only flushes the differences
+    assert(sidArray.restore(after) == 3);
+    assert(sidArray.flush() == 3);
+
+    while(sidArray.getSink().getBuffer().pop(write)) {
+    }
+
+    assert(sidArray.restore(after) == 0);
+}
+
+// drive the software SID through a SIDArray and check pitch and envelope of the rendered sound
+void testEmulator() {
+    static SIDArray<1, SIDEmulator<1>> sidArray(false, SIDEmulation::PAL_CLOCK, 44100);
+    static int16_t buffer[44100];
+
+    auto voice = sidArray.getSID(0).getVoice(0);
+
+    sidArray.getSID(0).getFilter().setVolume(15);
+    voice.setFQ(7493); // 440 Hz at the PAL clock
+    voice.setADSR(0x00f0);
+    voice.setSawtooth(true);
+    voice.setGate(true);
+    sidArray.flush();
+
+    sidArray.getSink().render(44100, buffer);
+
+    uint32_t cycles = 0;
+
+    for(size_t i = 1; i < 44100; i++) {
+        if(buffer[i] < buffer[i - 1] - 1000) {
+            cycles++;
+        }
+    }
+
+    assert(cycles >= 439 && cycles <= 441);
+    assert(sidArray.getSink().getEnvelope(0, 0) == 0xff);
+
+    // release at the fastest rate is over after a few milliseconds
+    voice.setGate(false);
+    sidArray.flush();
+
+    sidArray.getSink().render(4410, buffer);
+
+    assert(sidArray.getSink().getEnvelope(0, 0) == 0);
+    assert(buffer[4409] == 0);
+}
+
+// all voice kernels must render bit identical output
+void testEmulatorKernels() {
+    static int16_t reference[8192];
+    static int16_t buffer[8192];
+
+    for(int k = SID_KERNEL_SCALAR; k <= SID_KERNEL_AVX2; k++) {
+        if(!sidKernelSupported((SIDKernel) k)) {
+            std::cout << "kernel " << k << " not supported\n";
+            continue;
+        }
+
+        SIDEmulator<6> emu;
+
+        emu.setKernel((SIDKernel) k);
+
+        // every waveform, ring modulation, sync, test bit and a range of envelopes
+        for(uint8_t sid = 0; sid < 6; sid++) {
+            for(uint8_t voice = 0; voice < SIDLayout::NUM_VOICES; voice++) {
+                const uint8_t base = voice * SIDLayout::NUM_VOICE_REGS;
+                const uint8_t n = sid * SIDLayout::NUM_VOICES + voice;
+
+                emu.write(sid, base + SIDVoiceLayout::SIDRegFQLo, n * 37);
+                emu.write(sid, base + SIDVoiceLayout::SIDRegFQHi, 4 + n * 11);
+                emu.write(sid, base + SIDVoiceLayout::SIDRegPWHi, n & 0x0f);
+                emu.write(sid, base + SIDVoiceLayout::SIDRegAD, n * 0x13);
+                emu.write(sid, base + SIDVoiceLayout::SIDRegSR, 0x80 + n);
+                emu.write(sid, base + SIDVoiceLayout::SIDRegWvCtl, ((0x10 << (n & 3)) | (n & 0x06) | 1) ^ (n == 17 ? 0xc0 : 0));
+            }
+
+            emu.write(sid, SIDFilterLayout::SIDRegFCHi, 0x20 * sid);
+            emu.write(sid, SIDFilterLayout::SIDRegResFilt, 0x03 + (sid << 4));
+            emu.write(sid, SIDFilterLayout::SIDRegModVol, 0x1f + (sid << 5));
+        }
+
+        emu.render(4096, buffer);
+
+        // release some voices, pulse test bit on another
+        emu.write(1, SIDVoiceLayout::SIDRegWvCtl, 0x20);
+        emu.write(4, SIDVoiceLayout::SIDRegWvCtl + SIDLayout::NUM_VOICE_REGS, 0x48);
+        emu.render(2048, buffer + 4096);
+        emu.write(4, SIDVoiceLayout::SIDRegWvCtl + SIDLayout::NUM_VOICE_REGS, 0x41);
+        emu.render(2048, buffer + 6144);
+
+        if(k == SID_KERNEL_SCALAR) {
+            memcpy(reference, buffer, sizeof(buffer));
+        } else {
+            assert(memcmp(reference, buffer, sizeof(buffer)) == 0);
+        }
+    }
+}
+
+// filter: cut-off curves of both models, lowpass response, a mixed 6581/8580 stack and stability at full
+// resonance while sweeping
+void testFilter() {
+    assert(fabs(SIDEmulation::cutoffHz(SID_MODEL_8580, 0) - 30.0f) < 0.01f);
+    assert(fabs(SIDEmulation::cutoffHz(SID_MODEL_8580, 2047) - 12500.0f) < 0.1f);
+    assert(SIDEmulation::cutoffHz(SID_MODEL_6581, 0) < 400.0f && SIDEmulation::cutoffHz(SID_MODEL_6581, 2047) > 17000.0f);
+
+    for(uint16_t fc = 1; fc < SIDEmulation::NUM_CUTOFFS; fc++) {
+        assert(SIDEmulation::cutoffHz(SID_MODEL_6581, fc) > SIDEmulation::cutoffHz(SID_MODEL_6581, fc - 1));
+        assert(SIDEmulation::cutoffHz(SID_MODEL_8580, fc) > SIDEmulation::cutoffHz(SID_MODEL_8580, fc - 1));
+    }
+
+    // a 2 kHz sawtooth through the lowpass, more of it gets through the higher the cut-off
+    auto setup = [](auto &emu, const uint8_t sid, const uint8_t fcHi, const uint8_t res) {
+        emu.write(sid, SIDVoiceLayout::SIDRegFQHi, 34);
+        emu.write(sid, SIDVoiceLayout::SIDRegSR, 0xf0);
+        emu.write(sid, SIDVoiceLayout::SIDRegWvCtl, SIDVoiceLayout::SIDWavSaw | SIDVoiceLayout::SIDCtlGat);
+        emu.write(sid, SIDFilterLayout::SIDRegFCHi, fcHi);
+        emu.write(sid, SIDFilterLayout::SIDRegResFilt, (uint8_t) (res << 4 | SIDFilterLayout::SIDFilt1));
+        emu.write(sid, SIDFilterLayout::SIDRegModVol, SIDFilterLayout::SIDFModLP | 0x0f);
+    };
+
+    auto rms = [](const int16_t *buffer, const size_t n) {
+        double sum = 0;
+
+        for(size_t i = 0; i < n; i++) {
+            sum += (double) buffer[i] * buffer[i];
+        }
+
+        return sqrt(sum / n);
+    };
+
+    static int16_t buffer[8820];
+    double last = 0;
+
+    for(uint16_t fcHi = 0; fcHi < 256; fcHi += 51) {
+        SIDEmulator<1> emu;
+
+        setup(emu, 0, (uint8_t) fcHi, 0);
+        emu.render(8820, buffer);
+
+        const double level = rms(buffer + 4410, 4410);
+
+        assert(level > last);
+        last = level;
+    }
+
+    // the same registers on a 6581 and an 8580 sound different, and a mixed stack of two renders each with its
+    // own curve
+    static int16_t mixed[4410], a[4410], b[4410];
+    SIDEmulator<2> stack;
+    SIDEmulator<1> old, recent;
+
+    recent.setModel(0, SID_MODEL_8580);
+    stack.setModel(1, SID_MODEL_8580);
+    assert(stack.getModel(0) == SID_MODEL_6581 && stack.getModel(1) == SID_MODEL_8580);
+
+    setup(old, 0, 0x60, 8);
+    setup(recent, 0, 0x60, 8);
+    setup(stack, 0, 0x60, 8);
+    setup(stack, 1, 0x60, 8);
+    assert(stack.getCutoff(0) != stack.getCutoff(1));
+
+    old.render(4410, a);
+    recent.render(4410, b);
+    stack.render(4410, mixed);
+
+    assert(memcmp(a, b, sizeof(a)) != 0);
+
+    for(size_t i = 0; i < 4410; i++) {
+        assert(mixed[i] == (a[i] + b[i]) / 2);
+    }
+
+    // full resonance, a fast sweep over the whole range and back, the filter stays bounded and goes quiet
+    for(uint8_t model = SID_MODEL_6581; model <= SID_MODEL_8580; model++) {
+        SIDEmulator<1> emu;
+        int16_t peak = 0;
+
+        emu.setModel(0, (SIDModel) model);
+        setup(emu, 0, 0, 15);
+        emu.write(0, SIDVoiceLayout::SIDRegWvCtl, SIDVoiceLayout::SIDWavNse | SIDVoiceLayout::SIDCtlGat);
+        emu.write(0, SIDFilterLayout::SIDRegModVol, SIDFilterLayout::SIDFModLP | 0x04);
+
+        for(uint32_t i = 0; i < 2048; i++) {
+            emu.write(0, SIDFilterLayout::SIDRegFCHi, (uint8_t) (i < 1024 ? i / 4 : 511 - i / 4));
+            emu.render(16, buffer);
+
+            for(uint8_t j = 0; j < 16; j++) {
+                peak = (int16_t) std::max<int>(peak, abs(buffer[j]));
+            }
+        }
+
+        assert(peak > 1000 && peak < 20000);
+
+        // the 8580 ends the sweep at 30 Hz, which rings for a while
+        emu.write(0, SIDVoiceLayout::SIDRegWvCtl, SIDVoiceLayout::SIDWavNse);
+        emu.render(8820, buffer);
+        emu.render(8820, buffer);
+        assert(buffer[8819] == 0);
+    }
+
+    std::cout << "filter: 6581 and 8580 curves, mixed stack, passed\n";
+}
+
+// a recorded trace replays the same writes in the same order with the same timestamps
+void testTrace() {
+    const char *path = "/tmp/arduinosid-test.trace";
+    std::vector<std::tuple<uint64_t, uint8_t, uint8_t, uint8_t>> recorded;
+
+    {
+        std::ofstream out(path, std::ios::binary);
+        uint64_t now = 0;
+        CallbackSink collect([&](const uint8_t sid, const uint8_t reg, const uint8_t val) {
+            recorded.emplace_back(now, sid, reg, val);
+        });
+        SIDArray<2, TraceRecorder<CallbackSink>> sidArray(false, out, SIDEmulation::PAL_CLOCK, collect);
+
+        for(uint32_t i = 0; i < 1000; i++) {
+            // mostly short deltas, with a few that need long varints
+            now += (i % 100 == 99) ? (1ull << (i / 100 * 4)) : i % 3;
+            sidArray.getSink().setTime(now);
+
+            auto voice = sidArray.getSID(i & 1).getVoice(i % 3);
+
+            voice.setFQ((uint16_t) (i * 97));
+            voice.setGate(i & 2);
+            sidArray.getSID(i & 1).getFilter().setFilterFQ((uint16_t) i);
+            sidArray.flush();
+        }
+
+        assert(sidArray.getSink().getRecords() == recorded.size());
+    }
+
+    TraceReplayer replayer(path);
+    size_t n = 0;
+    uint64_t ticks;
+    uint8_t sid, reg, val;
+
+    assert(replayer.isOpen());
+    assert(replayer.getTickRate() == SIDEmulation::PAL_CLOCK);
+
+    while(replayer.next(ticks, sid, reg, val)) {
+        assert(n < recorded.size());
+        assert(recorded[n] == std::make_tuple(ticks, sid, reg, val));
+        n++;
+    }
+
+    assert(n == recorded.size());
+
+    CallbackSink count([&](const uint8_t, const uint8_t, const uint8_t) { n--; });
+
+    assert(replayer.replay(count) == recorded.size());
+    assert(n == 0);
+
+    // not a trace
+    static const uint8_t garbage[16] = { 'S', 'I', 'D', 'X' };
+    TraceReader reader;
+
+    assert(!reader.open(garbage, sizeof(garbage)));
+    assert(!replayer.open("/nonexistent/arduinosid.trace"));
+
+    // writes the sink rejects are not recorded, their retries are, once
+    struct RejectingSink {
+        std::vector<std::tuple<uint8_t, uint8_t, uint8_t>> taken;
+        uint32_t calls = 0;
+
+        bool write(const uint8_t sid, const uint8_t reg, const uint8_t val) {
+            if(calls++ % 3 == 0) {
+                return false;
+            }
+
+            taken.emplace_back(sid, reg, val);
+
+            return true;
+        }
+    };
+
+    {
+        std::ofstream out(path, std::ios::binary);
+        SIDArray<1, TraceRecorder<RejectingSink>> sidArray(false, out, SIDEmulation::PAL_CLOCK);
+
+        for(uint16_t i = 0; i < 100; i++) {
+            sidArray.getSID(0).getVoice(i % 3).setFQ(i * 1000);
+
+            while(sidArray.isDirty()) {
+                sidArray.flush();
+            }
+        }
+
+        assert(sidArray.getSink().getRecords() == sidArray.getSink().getSink().taken.size());
+        sidArray.getSink().flushTrace();
+
+        TraceReplayer rejected(path);
+        n = 0;
+
+        while(rejected.next(ticks, sid, reg, val)) {
+            assert(sidArray.getSink().getSink().taken[n++] == std::make_tuple(sid, reg, val));
+        }
+
+        assert(n == sidArray.getSink().getSink().taken.size());
+    }
+
+    remove(path);
+    std::cout << "trace: " << recorded.size() << " writes passed\n";
+}
+
+// the tables must follow the float shapes of lfo.c within a few Q15 steps
+void testLFO() {
+    const double max = LFOTables::MAX;
+    int maxError[5] = {};
+
+    for(uint32_t i = 0; i < 65536; i++) {
+        const uint32_t phase = i << 16 | (i * 40503 & 0xffff);
+        const double x = phase / 4294967296.0;
+        const double expected[5] = {
+            sin(2 * M_PI * x),
+            x < 0.25 ? x * 4 : x < 0.75 ? 2 - x * 4 : x * 4 - 4,
+            2 * x - 1,
+            1 - 2 * x,
+            x < 0.25 ? 1.0 : -1.0
+        };
+
+        for(uint8_t shape = LFO_SINE; shape <= LFO_RECTANGLE; shape++) {
+            const int error = abs(LFOTables::lookup((LFOShape) shape, phase, 0x40000000) - (int) lround(expected[shape] * max));
+
+            maxError[shape] = std::max(maxError[shape], error);
+        }
+    }
+
+    assert(maxError[LFO_SINE] <= 6);
+    assert(maxError[LFO_TRIANGLE] <= 2);
+    assert(maxError[LFO_SAW_UP] <= 2);
+    assert(maxError[LFO_SAW_DOWN] <= 2);
+    assert(maxError[LFO_RECTANGLE] == 0);
+
+    // a 1 Hz sine at 1 kHz control rate is back at its start after 1000 ticks, shifted by a quarter cycle
+    LFOEngine<2> engine(1000);
+
+    engine.setRate(0, 1000);
+    engine.setRate(1, 1000);
+    engine.setShift(1, 0x4000);
+    engine.setDepth(1, -LFOTables::MAX / 2);
+
+    for(uint32_t i = 0; i < 1000; i++) {
+        engine.tick();
+
+        assert(abs(engine.getValue(0) - lround(sin(2 * M_PI * i / 1000.0) * max)) <= 6);
+        assert(abs(engine.getValue(1) + lround(cos(2 * M_PI * i / 1000.0) * max / 2)) <= 6);
+    }
+
+    assert((uint32_t) (engine.getLFO(0).phase + 1000000) < 2000000);
+
+    std::cout << "LFO: max error sine " << maxError[LFO_SINE] << ", triangle " << maxError[LFO_TRIANGLE]
+              << ", saw " << maxError[LFO_SAW_UP] << " in Q15 passed\n";
+}
+
+// the FQ tables must match the exact conversion to within rounding, also between notes
+void testFrequencyTables() {
+    assert(PALFrequencyTable::noteToFQ(69) == 7493);
+    assert(NTSCFrequencyTable::noteToFQ(69) == 7218);
+    assert(noteToFQ(69, 0, true) == 7218);
+
+    for(uint8_t ntsc = 0; ntsc < 2; ntsc++) {
+        const uint32_t clock = ntsc ? Frequency::NTSC_CLOCK : Frequency::PAL_CLOCK;
+
+        for(int note = 0; note < 128; note++) {
+            for(int cents = -250; cents <= 250; cents += 7) {
+                const double fq = 440.0 * pow(2.0, (note - 69 + cents / 100.0) / 12.0) * 16777216.0 / clock;
+                const int expected = note + cents / 100.0 < 0 ? noteToFQ(0, 0, ntsc) :
+                                     note + cents / 100.0 > 127 ? noteToFQ(127, 0, ntsc) :
+                                     (int) lround(fq);
+
+                // between the last note in range and the first saturated one the pitch is not exact
+                if(fq * 1.06 > 65535 && expected != noteToFQ(127, 0, ntsc)) {
+                    continue;
+                }
+
+                assert(abs(noteToFQ(note, cents, ntsc) - expected) <= 1);
+            }
+        }
+    }
+
+    std::cout << "frequency tables: passed\n";
+}
+
+// envelope levels set by the test
+class TestEnvelopes {
+public:
+    uint8_t levels[6][3] = {};
+
+    uint8_t getEnvelope(const uint8_t sid, const uint8_t voice) {
+        return levels[sid][voice];
+    }
+};
+
+void testVoiceAllocator() {
+    typedef VoiceAllocator<2, TestEnvelopes> Allocator;
+    TestEnvelopes envelopes;
+    Allocator voices(STEAL_OLDEST, &envelopes);
+    bool stolen;
+
+    // six notes get six voices, spread over both chips
+    uint8_t used = 0;
+
+    for(uint8_t note = 60; note < 66; note++) {
+        const uint8_t v = voices.noteOn(note, Allocator::NONE, &stolen);
+
+        assert(!stolen && !(used & (1 << v)));
+        used |= 1 << v;
+    }
+
+    assert(Allocator::getSIDNo(voices.getVoice(60)) != Allocator::getSIDNo(voices.getVoice(61)));
+
+    // the seventh steals the oldest, whose note off is then ignored
+    const uint8_t first = voices.getVoice(60);
+
+    assert(voices.noteOn(70, Allocator::NONE, &stolen) == first && stolen);
+    assert(voices.getVoice(60) == Allocator::NONE);
+    assert(voices.noteOff(60) == Allocator::NONE);
+
+    // a released voice is reused before stealing, the one released first
+    const uint8_t released = voices.noteOff(62);
+
+    voices.noteOff(63);
+    assert(voices.noteOn(71, Allocator::NONE, &stolen) == released && !stolen);
+
+    // stealing with a hint takes the oldest voice on that chip
+    const uint8_t v64 = voices.getVoice(64);
+    const uint8_t hint = 1 - Allocator::getSIDNo(v64);
+    const uint8_t v72 = voices.noteOn(72, hint);
+
+    assert(Allocator::getSIDNo(v72) == hint);
+    voices.noteOn(73, hint, &stolen);
+    assert(stolen);
+
+    // quietest
+    voices.reset();
+    voices.setPolicy(STEAL_QUIETEST);
+
+    for(uint8_t note = 60; note < 66; note++) {
+        const uint8_t v = voices.noteOn(note);
+
+        envelopes.levels[Allocator::getSIDNo(v)][Allocator::getVoiceNo(v)] = 0xff - note;
+    }
+
+    assert(voices.noteOn(80) == voices.getVoice(80) && voices.getVoice(65) == Allocator::NONE);
+
+    // a hint keeps free voices on one chip
+    voices.reset();
+
+    for(uint8_t note = 60; note < 63; note++) {
+        assert(Allocator::getSIDNo(voices.noteOn(note, 1)) == 1);
+    }
+
+    assert(Allocator::getSIDNo(voices.noteOn(63, 1)) == 0);
+
+    // same note retrigger reuses the releasing voice although others are free
+    voices.reset();
+    voices.setPolicy(STEAL_SAME_NOTE);
+
+    const uint8_t v = voices.noteOn(60);
+
+    voices.noteOff(60);
+    assert(voices.noteOn(60, Allocator::NONE, &stolen) == v && !stolen);
+
+    voices.setPolicy(STEAL_OLDEST);
+    voices.noteOff(60);
+    assert(voices.noteOn(60) != v);
+
+    std::cout << "voice allocator: passed\n";
+}
+
+// writes the parsed messages as text
+class TextMIDIHandler : public MIDIHandler {
+public:
+    std::string text;
+
+    void add(const char *name, const int a, const int b = -1, const int c = -1) {
+        text += name;
+
+        for(int v : { a, b, c }) {
+            if(v >= 0) {
+                text += " " + std::to_string(v);
+            }
+        }
+
+        text += ";";
+    }
+
+    void noteOff(const uint8_t channel, const uint8_t note, const uint8_t velocity) { add("off", channel, note, velocity); }
+    void noteOn(const uint8_t channel, const uint8_t note, const uint8_t velocity) { add("on", channel, note, velocity); }
+    void controlChange(const uint8_t channel, const uint8_t cc, const uint8_t value) { add("cc", channel, cc, value); }
+    void programChange(const uint8_t channel, const uint8_t program) { add("pc", channel, program); }
+    void pitchBend(const uint8_t channel, const int16_t bend) { add("bend", channel, bend + 8192); }
+    void systemCommon(const uint8_t status, const uint8_t a, const uint8_t b) { add("sys", status, a, b); }
+    void sysExStart() { add("sysex", 0); }
+    void sysExData(const uint8_t data) { add("data", data); }
+    void sysExEnd(const bool complete) { add("end", complete); }
+    void realtime(const uint8_t status) { add("rt", status); }
+};
+
+void testMIDIParser() {
+    static const uint8_t stream[] = {
+        // note on with running status, velocity 0 as note off, a clock in the middle of a message
+        0x91, 60, 100, 64, 0xf8, 90, 60, 0,
+        // controller, program change, pitch bend centered
+        0xb2, 74, 127, 0xc3, 5, 6, 0xe0, 0x00, 0x40,
+        // SysEx with a realtime message inside, then a SysEx aborted by a note
+        0xf0, 0x7d, 0xfa, 0x01, 0xf7, 0xf0, 0x02, 0x80, 61, 0,
+        // song position cancels running status, the stray data byte is dropped
+        0xf2, 0x10, 0x20, 0x30, 0xf6
+    };
+
+    TextMIDIHandler handler;
+    MIDIParser<TextMIDIHandler> parser(handler);
+
+    parser.parse(stream, sizeof(stream));
+
+    assert(handler.text ==
+           "on 1 60 100;rt 248;on 1 64 90;off 1 60 64;"
+           "cc 2 74 127;pc 3 5;pc 3 6;bend 0 8192;"
+           "sysex 0;data 125;rt 250;data 1;end 1;sysex 0;data 2;end 0;off 0 61 0;"
+           "sys 242 16 32;sys 246 0 0;");
+
+    // notes on the SIDs
+    static SIDArray<2, RingBufferSink<registerQueueSize(2)>> sidArray;
+    SIDMIDIHandler<2, RingBufferSink<registerQueueSize(2)>> synth(sidArray);
+    MIDIParser<decltype(synth)> synthParser(synth);
+    static const uint8_t notes[] = { 0xc1, 2, 0x91, 69, 100, 0xe1, 0x7f, 0x7f, 0xb1, 7, 127 };
+
+    synthParser.parse(notes, sizeof(notes));
+
+    const uint8_t v = synth.getVoices().getVoice(69);
+    auto voice = sidArray.getSID(1).getVoice(v % 3);
+
+    assert(v / 3 == 1);
+    assert(voice.getGate() && voice.getSquare());
+    assert(voice.getFQ() == noteToFQ(69, 199));
+    assert(sidArray.getSID(1).getFilter().getVolume() == 15);
+    assert(sidArray.getSID(0).getFilter().getVolume() == 0);
+
+    synthParser.parse(0x81);
+    synthParser.parse(69);
+    synthParser.parse(0);
+    assert(!voice.getGate());
+
+    // a note on and off within one flush: the frequency and envelope reach the sink ahead of the gate on edge
+    static SIDArray<2, RingBufferSink<registerQueueSize(2)>> blipArray;
+    SIDMIDIHandler<2, RingBufferSink<registerQueueSize(2)>> blipSynth(blipArray);
+    MIDIParser<decltype(blipSynth)> blipParser(blipSynth);
+    static const uint8_t blip[] = { 0xb0, 72, 80, 0x90, 60, 100, 0x80, 60, 0 };
+    std::vector<std::tuple<uint8_t, uint8_t, uint8_t>> writes;
+    std::tuple<uint8_t, uint8_t, uint8_t> write;
+
+    blipParser.parse(blip, sizeof(blip));
+    blipArray.flush();
+
+    while(blipArray.getSink().getBuffer().pop(write)) {
+        writes.push_back(write);
+    }
+
+    // position of the first write to a register of chip 0, for a wave and control register with the gate as given
+    auto find = [&](const uint8_t reg, const bool gate = false) {
+        size_t i = 0;
+
+        for(; i < writes.size(); i++) {
+            if(std::get<0>(writes[i]) == 0 && std::get<1>(writes[i]) == reg &&
+               (reg % SIDLayout::NUM_VOICE_REGS != SIDVoiceLayout::SIDRegWvCtl ||
+                !(std::get<2>(writes[i]) & SIDVoiceLayout::SIDCtlGat) == !gate)) {
+                break;
+            }
+        }
+
+        return i;
+    };
+
+    uint8_t played = 0;
+
+    for(uint8_t v = 0; v < SIDLayout::NUM_VOICES; v++) {
+        const uint8_t first = v * SIDLayout::NUM_VOICE_REGS;
+        const size_t on = find(first + SIDVoiceLayout::SIDRegWvCtl, true);
+
+        if(on == writes.size()) {
+            continue;
+        }
+
+        assert(find(first + SIDVoiceLayout::SIDRegFQLo) < on && find(first + SIDVoiceLayout::SIDRegFQHi) < on);
+        assert(find(first + SIDVoiceLayout::SIDRegAD) < on && find(first + SIDVoiceLayout::SIDRegSR) < on);
+        assert(on < find(first + SIDVoiceLayout::SIDRegWvCtl) && find(first + SIDVoiceLayout::SIDRegWvCtl) < writes.size());
+        played++;
+    }
+
+    assert(played == 1 && !blipArray.isDirty());
+
+    std::cout << "MIDI parser: passed\n";
+}
+
+// the pin at a time bus write as writeRegister used to do it, for comparison
+void pinByPinWrite(SimulatedPorts &ports, const uint8_t sid, const uint8_t reg, const uint8_t val) {
+    auto pinWrite = [&](const uint8_t pin, const bool high) {
+        const uint8_t port = sidBusPinPort(pin);
+
+        ports.write(port, high ? ports.read(port) | sidBusPinMask(pin) : ports.read(port) & ~sidBusPinMask(pin));
+    };
+
+    for(uint8_t i = 0; i < NUM_SIDS; i++) {
+        pinWrite(SID_CS[i], true);
+    }
+
+    for(uint8_t i = 0; i < NUM_SID_AX; i++) {
+        pinWrite(SID_AX[i], reg & (1 << i));
+    }
+
+    for(uint8_t i = 0; i < NUM_SID_DX; i++) {
+        pinWrite(SID_DX[i], val & (1 << i));
+    }
+
+    pinWrite(SID_CS[sid], false);
+}
+
+// simulated ports which check every port store: address and data lines only change while no chip is selected
+class CheckedPorts : public SimulatedPorts {
+public:
+    uint32_t lineChanges = 0;
+
+    bool selected() const {
+        for(uint8_t i = 0; i < NUM_SIDS; i++) {
+            if(!pin(SID_CS[i])) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    inline void write(const uint8_t port, const uint8_t val) {
+        const bool selectedBefore = selected();
+        uint8_t changed[SID_BUS_NUM_PORTS] = {};
+
+        changed[port] = ports[port] ^ val;
+        SimulatedPorts::write(port, val);
+
+        for(uint8_t i = 0; i < NUM_SID_AX + NUM_SID_DX; i++) {
+            const uint8_t pin = i < NUM_SID_AX ? SID_AX[i] : SID_DX[i - NUM_SID_AX];
+
+            if(changed[sidBusPinPort(pin)] & sidBusPinMask(pin)) {
+                assert(!selectedBefore && !selected());
+                lineChanges++;
+            }
+        }
+    }
+};
+
+// the port mask tables must leave the pins exactly as the pin at a time write does, in fewer port operations
+void testBus() {
+    static constexpr SIDBusMap<NUM_SID_AX, NUM_SID_DX, NUM_SIDS> map(SID_AX, SID_DX, SID_CS);
+    SimulatedPorts ports, reference;
+
+    // pins not on the bus, like phi2 and the serial port, keep their levels
+    ports.ports[SID_BUS_PORT_D] = reference.ports[SID_BUS_PORT_D] = sidBusPinMask(SID_PHI_2) | 0x03;
+
+    for(uint32_t i = 0; i < 4 * 32 * 256; i++) {
+        const uint8_t sid = i % NUM_SIDS;
+        const uint8_t reg = (i / NUM_SIDS) % 32;
+        const uint8_t val = (uint8_t) (i / (NUM_SIDS * 32));
+
+        sidBusWrite(ports, map, sid, reg, val);
+        pinByPinWrite(reference, sid, reg, val);
+
+        assert(memcmp(ports.ports, reference.ports, sizeof(ports.ports)) == 0);
+
+        for(uint8_t cs = 0; cs < NUM_SIDS; cs++) {
+            assert(ports.pin(SID_CS[cs]) == (cs != sid));
+        }
+
+        for(uint8_t a = 0; a < NUM_SID_AX; a++) {
+            assert(ports.pin(SID_AX[a]) == ((reg >> a) & 1));
+        }
+
+        for(uint8_t d = 0; d < NUM_SID_DX; d++) {
+            assert(ports.pin(SID_DX[d]) == ((val >> d) & 1));
+        }
+
+        assert(ports.pin(SID_PHI_2) && ports.pin(0) && ports.pin(1));
+    }
+
+    const uint32_t writes = 4 * 32 * 256;
+
+    // a deselect pass, the address and data lines, and the select
+    assert(ports.reads + ports.writes <= writes * 12);
+
+    // the previous chip is deselected before any address or data line moves, also when writing several chips
+    CheckedPorts checked;
+
+    for(uint32_t i = 0; i < 4 * 32 * 16; i++) {
+        const uint8_t reg = i % 32;
+        const uint8_t val = (uint8_t) (i * 37);
+
+        if(i & 1) {
+            sidBusWrite(checked, map, (i / 32) % NUM_SIDS, reg, val);
+        } else {
+            sidBusWriteChips(checked, map, 1 + (i / 32) % ((1 << NUM_SIDS) - 1), reg, val);
+        }
+
+        assert(checked.selected());
+    }
+
+    assert(checked.lineChanges > 0);
+
+    std::cout << "bus: " << (double) (ports.reads + ports.writes) / writes << " port operations per write, was "
+              << (double) (reference.reads + reference.writes) / writes << ", passed\n";
+}
+
+// six SIDs on a simulated bus, latching a register on every chip whose chip select is low
+class SimulatedSIDBus {
+public:
+    static constexpr uint8_t CS[6] = { A5, 11, 12, 13, 0, 1 };
+    static constexpr SIDBusMap<NUM_SID_AX, NUM_SID_DX, 6> MAP = SIDBusMap<NUM_SID_AX, NUM_SID_DX, 6>(SID_AX, SID_DX, CS);
+
+    SimulatedPorts ports;
+    uint8_t regs[6][SIDLayout::NUM_WO_REGS] = {};
+    uint32_t cycles = 0;
+
+    void latch() {
+        uint8_t reg = 0, val = 0;
+
+        for(uint8_t i = 0; i < NUM_SID_AX; i++) {
+            reg |= ports.pin(SID_AX[i]) << i;
+        }
+
+        for(uint8_t i = 0; i < NUM_SID_DX; i++) {
+            val |= ports.pin(SID_DX[i]) << i;
+        }
+
+        for(uint8_t sid = 0; sid < 6; sid++) {
+            if(!ports.pin(CS[sid])) {
+                regs[sid][reg] = val;
+            }
+        }
+
+        cycles++;
+    }
+
+    bool write(const uint8_t sid, const uint8_t reg, const uint8_t val) {
+        sidBusWrite(ports, MAP, sid, reg, val);
+        latch();
+
+        return true;
+    }
+
+};
+
+constexpr uint8_t SimulatedSIDBus::CS[6];
+constexpr SIDBusMap<NUM_SID_AX, NUM_SID_DX, 6> SimulatedSIDBus::MAP;
+
+// the simulated bus with multicast
+class MulticastSIDBus : public SimulatedSIDBus {
+public:
+    bool writeMulticast(const uint8_t chips, const uint8_t reg, const uint8_t val) {
+        sidBusWriteChips(ports, MAP, chips, reg, val);
+        latch();
+
+        return true;
+    }
+};
+
+template <typename Bus>
+void unisonPatch(SIDArray<6, Bus> &sidArray) {
+    for(uint8_t sid = 0; sid < 6; sid++) {
+        for(uint8_t v = 0; v < 3; v++) {
+            auto voice = sidArray.getSID(sid).getVoice(v);
+
+            voice.setFQ(4000 + v * 1000);
+            voice.setPW(0x800);
+            voice.setADSR(0x09a0);
+            voice.setWave(SIDVoiceLayout::SIDWavSaw);
+            voice.setGate(true);
+        }
+
+        sidArray.getSID(sid).getFilter().setFilterFQ(0x4000);
+        sidArray.getSID(sid).getFilter().setVolume(15);
+    }
+
+    // detune one chip
+    sidArray.getSID(3).getVoice(0).setFQ(4003);
+}
+
+// identical writes to several chips must be merged into one bus cycle and land on all of them
+void testMulticast() {
+    static SIDArray<6, MulticastSIDBus> multicast;
+    static SIDArray<6, SimulatedSIDBus> unicast;
+
+    unisonPatch(multicast);
+    unisonPatch(unicast);
+
+    const uint8_t merged = multicast.flush();
+    const uint8_t single = unicast.flush();
+
+    for(uint8_t sid = 0; sid < 6; sid++) {
+        assert(memcmp(multicast.getSink().regs[sid], multicast.getSID(sid).getRegisters(), SIDLayout::NUM_WO_REGS) == 0);
+        assert(memcmp(unicast.getSink().regs[sid], unicast.getSID(sid).getRegisters(), SIDLayout::NUM_WO_REGS) == 0);
+    }
+
+    // everything but the detuned FQ register is shared by all chips
+    assert(single == 6 * (merged - 1));
+    assert(multicast.getSink().cycles == merged);
+    assert(!multicast.isDirty());
+
+    std::cout << "multicast: unison patch on 6 SIDs in " << (int) merged << " bus cycles instead of "
+              << (int) single << ", passed\n";
+}
+
+// registers of chip 0 in the order they reach a sink, its queue drained
+template <typename Array>
+std::vector<uint8_t> drainChip0(Array &sidArray) {
+    std::vector<uint8_t> regs;
+    std::tuple<uint8_t, uint8_t, uint8_t> write;
+
+    const bool multicast = SinkHasMulticast<typename std::remove_reference<decltype(sidArray.getSink())>::type>();
+
+    while(sidArray.getSink().getBuffer().pop(write)) {
+        // the sid for plain sinks, the chip mask for multicast ones
+        if(multicast ? (std::get<0>(write) & 1) : !std::get<0>(write)) {
+            regs.push_back(std::get<1>(write));
+        }
+    }
+
+    return regs;
+}
+
+// a gate goes out after the frequency, pulse width and envelope of its voice, from a flush or queued early for
+// a retrigger within one tick
+template <typename Array>
+void testGateOrder(Array &sidArray) {
+    const uint8_t v1 = SIDLayout::NUM_VOICE_REGS;
+    const uint8_t v2 = 2 * SIDLayout::NUM_VOICE_REGS;
+    const uint8_t fqLo = SIDVoiceLayout::SIDRegFQLo, fqHi = SIDVoiceLayout::SIDRegFQHi;
+    const uint8_t pwLo = SIDVoiceLayout::SIDRegPWLo, pwHi = SIDVoiceLayout::SIDRegPWHi;
+    const uint8_t wvCtl = SIDVoiceLayout::SIDRegWvCtl;
+    const uint8_t ad = SIDVoiceLayout::SIDRegAD, sr = SIDVoiceLayout::SIDRegSR;
+
+    for(uint8_t sid = 0; sid < 2; sid++) {
+        auto voice = sidArray.getSID(sid).getVoice(1);
+
+        voice.setGate(true);
+        voice.setFQ(0x1234);
+        voice.setPW(0x5670);
+        voice.setADSR(0x29a0);
+        sidArray.getSID(sid).getFilter().setVolume(15);
+    }
+
+    sidArray.flush();
+
+    std::vector<uint8_t> expected = {
+        v1 + fqLo, v1 + fqHi, v1 + pwLo, v1 + pwHi, v1 + ad, v1 + sr, SIDFilterLayout::SIDRegModVol, v1 + wvCtl
+    };
+
+    assert(drainChip0(sidArray) == expected);
+
+    // a note on and off within one tick: the gate on edge is queued right away, behind the voice's registers
+    for(uint8_t sid = 0; sid < 2; sid++) {
+        auto voice = sidArray.getSID(sid).getVoice(2);
+
+        voice.setFQ(0x2345);
+        voice.setAD(0x11);
+        voice.setSawtooth(true);
+        voice.setGate(true);
+        sidArray.getSID(sid).getFilter().setFilterFQ(0x123);
+        voice.setGate(false);
+    }
+
+    expected = { v2 + fqLo, v2 + fqHi, v2 + ad, v2 + wvCtl };
+    assert(drainChip0(sidArray) == expected);
+
+    sidArray.flush();
+    expected = { SIDFilterLayout::SIDRegFCLo, SIDFilterLayout::SIDRegFCHi, v2 + wvCtl };
+    assert(drainChip0(sidArray) == expected);
+    assert(!sidArray.isDirty());
+}
+
+void testGateOrder() {
+    static SIDArray<2, RingBufferSink<64>> unicast;
+    static SIDArray<2, MulticastRingBufferSink<64>> multicast;
+
+    testGateOrder(unicast);
+    testGateOrder(multicast);
+
+    std::cout << "gate order: passed\n";
+}
+
+// gate writes overtake bulk traffic, writes to the same register stay in order
+void testPriorityLanes() {
+    typedef PriorityRingBufferSink<64> Sink;
+    typedef std::tuple<uint8_t, uint8_t, uint8_t> Write;
+
+    const uint8_t wvCtl = SIDVoiceLayout::SIDRegWvCtl;
+    const uint8_t wvCtl2 = SIDLayout::NUM_VOICE_REGS + SIDVoiceLayout::SIDRegWvCtl;
+    Sink sink;
+    Write write;
+
+    sink.write(0, SIDFilterLayout::SIDRegFCHi, 1);
+    sink.write(0, wvCtl, 0x21);
+    sink.write(0, SIDVoiceLayout::SIDRegPWLo, 2);
+    sink.write(0, SIDFilterLayout::SIDRegFCHi, 3);
+    sink.write(0, wvCtl, 0x20);
+    sink.writeMulticast(0x06, wvCtl2, 0x41);
+
+    // the second gate write takes the frequency and pulse width of its voice along, the pulse width queued in the
+    // low lane is then dropped; the gate of another voice just overtakes
+    static const Write expected[9] = {
+        Write(1, wvCtl, 0x21), Write(1, SIDVoiceLayout::SIDRegFQLo, 0), Write(1, SIDVoiceLayout::SIDRegFQHi, 0),
+        Write(1, SIDVoiceLayout::SIDRegPWLo, 2), Write(1, SIDVoiceLayout::SIDRegPWHi, 0), Write(1, wvCtl, 0x20),
+        Write(6, wvCtl2, 0x41), Write(1, SIDFilterLayout::SIDRegFCHi, 1), Write(1, SIDFilterLayout::SIDRegFCHi, 3)
+    };
+
+    for(const Write &e : expected) {
+        assert(sink.pop(write) && write == e);
+    }
+
+    assert(!sink.pop(write) && sink.empty());
+
+    // a note on after a filter and pulse width sweep on all chips is the first write on the bus, after the
+    // frequency and pulse width of its voice; the pulse width multicast queued before then leaves out its chip
+    static SIDArray<6, Sink> sidArray;
+
+    for(uint8_t sid = 0; sid < 6; sid++) {
+        sidArray.getSID(sid).getFilter().setFilterFQ(0x1234);
+
+        for(uint8_t v = 0; v < 3; v++) {
+            sidArray.getSID(sid).getVoice(v).setPW(0x123);
+        }
+    }
+
+    sidArray.getSID(5).getVoice(2).setGate(true);
+    sidArray.flush();
+
+    const uint8_t voice2 = 2 * SIDLayout::NUM_VOICE_REGS;
+
+    for(uint8_t i = 0; i < 4; i++) {
+        assert(sidArray.getSink().pop(write) && write == Write(1 << 5, voice2 + SIDVoiceLayout::SIDRegFQLo + i, i == 2 ? 0x12 : 0));
+    }
+
+    assert(sidArray.getSink().pop(write) && write == Write(1 << 5, wvCtl + voice2, 0x01));
+
+    for(uint8_t v = 0; v < 3; v++) {
+        assert(sidArray.getSink().pop(write) && write == Write(v == 2 ? 0x1f : 0x3f, v * SIDLayout::NUM_VOICE_REGS + SIDVoiceLayout::SIDRegPWLo, 0x12));
+    }
+
+    while(sidArray.getSink().pop(write));
+
+    // a note on under a backlog: the gate overtakes the filter sweep, but not the frequency of its own voice
+    auto voice = sidArray.getSID(2).getVoice(1);
+    const uint8_t fqHi = SIDLayout::NUM_VOICE_REGS + SIDVoiceLayout::SIDRegFQHi;
+    std::vector<Write> bus;
+
+    for(uint16_t t = 0; t < 20; t++) {
+        sidArray.getSID(2).getFilter().setFilterFQ(t << 8);
+        sidArray.flush();
+
+        if(t == 10) {
+            voice.setFQ(0x4321);
+            voice.setAD(0x12);
+        }
+    }
+
+    voice.setGate(true);
+    sidArray.getSID(0).getVoice(0).setGate(true);
+    sidArray.flush();
+
+    while(sidArray.getSink().pop(write)) {
+        bus.push_back(write);
+    }
+
+    auto at = [&](const uint8_t reg) {
+        return (size_t) (std::find_if(bus.begin(), bus.end(), [&](const Write &w) { return std::get<1>(w) == reg; }) - bus.begin());
+    };
+
+    const size_t gate = at(wvCtl2);
+
+    assert(bus.size() > 20 && at(wvCtl) < 15 && gate < 15 && std::get<2>(bus[gate]) == 0x01);
+    assert(at(SIDLayout::NUM_VOICE_REGS + SIDVoiceLayout::SIDRegAD) < gate);
+
+    // the chip has the new frequency when the gate opens, and no older one arrives afterwards
+    uint16_t fq = 0;
+
+    for(size_t i = 0; i < bus.size(); i++) {
+        const uint8_t reg = std::get<1>(bus[i]);
+
+        if((std::get<0>(bus[i]) & (1 << 2)) && (reg == fqHi || reg == fqHi - 1)) {
+            assert(i < gate);
+            fq = reg == fqHi ? (fq & 0xff) | std::get<2>(bus[i]) << 8 : (fq & 0xff00) | std::get<2>(bus[i]);
+        }
+    }
+
+    assert(fq == 0x4321);
+
+    // random traffic drained a bit at a time: at the end the chips hold what the shadow registers say
+    uint8_t chips[6][SIDLayout::NUM_WO_REGS] = {};
+    uint32_t seed = 7;
+
+    while(sidArray.getSink().pop(write));
+
+    for(uint8_t sid = 0; sid < 6; sid++) {
+        memcpy(chips[sid], sidArray.getSID(sid).getRegisters(), SIDLayout::NUM_WO_REGS);
+    }
+
+    for(uint32_t t = 0; t < 2000; t++) {
+        for(uint8_t i = 0; i < 8; i++) {
+            seed = seed * 1103515245 + 12345;
+
+            auto v = sidArray.getSID((seed >> 8) % 6).getVoice((seed >> 12) % 3);
+
+            switch((seed >> 16) % 4) {
+                case 0: v.setFQ((uint16_t) (seed >> 3)); break;
+                case 1: v.setPW((uint16_t) (seed >> 5)); break;
+                case 2: v.setGate(seed & 0x100000); break;
+                default: sidArray.getSID((seed >> 8) % 6).getFilter().setFilterFQ((uint16_t) seed);
+            }
+        }
+
+        sidArray.flush();
+
+        for(uint32_t i = 0; i < (seed >> 24) % 12 && sidArray.getSink().pop(write); i++) {
+            for(uint8_t sid = 0; sid < 6; sid++) {
+                if(std::get<0>(write) & (1 << sid)) {
+                    chips[sid][std::get<1>(write)] = std::get<2>(write);
+                }
+            }
+        }
+    }
+
+    while(sidArray.isDirty() || !sidArray.getSink().empty()) {
+        sidArray.flush();
+
+        while(sidArray.getSink().pop(write)) {
+            for(uint8_t sid = 0; sid < 6; sid++) {
+                if(std::get<0>(write) & (1 << sid)) {
+                    chips[sid][std::get<1>(write)] = std::get<2>(write);
+                }
+            }
+        }
+    }
+
+    for(uint8_t sid = 0; sid < 6; sid++) {
+        assert(memcmp(chips[sid], sidArray.getSID(sid).getRegisters(), SIDLayout::NUM_WO_REGS) == 0);
+    }
+
+    std::cout << "priority lanes: passed\n";
+}
+
+// records the simulated tick each write is released on, and rejects writes while full is set and the next
+// rejects ones
+class ClockedSink {
+public:
+    uint32_t *clock;
+    bool full = false;
+    uint8_t rejects = 0;
+    std::vector<std::tuple<uint32_t, uint8_t, uint8_t, uint8_t>> writes;
+
+    ClockedSink(uint32_t *clock) : clock(clock) {
+    }
+
+    bool write(const uint8_t sid, const uint8_t reg, const uint8_t val) {
+        if(full) {
+            return false;
+        }
+
+        if(rejects) {
+            rejects--;
+
+            return false;
+        }
+
+        writes.emplace_back(*clock, sid, reg, val);
+
+        return true;
+    }
+};
+
+void testScheduler() {
+    uint32_t clock = 0;
+    WriteScheduler<ClockedSink, 200> scheduler(&clock);
+    auto &writes = scheduler.getSink().writes;
+    std::vector<std::tuple<uint32_t, uint8_t, uint8_t, uint8_t>> expected;
+
+    // deadlines on and around every level boundary, beyond the wheel, and some in the past
+    static const uint32_t ticks[] = {
+        0, 1, 62, 63, 64, 65, 127, 128, 4095, 4096, 4097, 5000, 70000, 262143, 262144, 300000, 600000
+    };
+    uint32_t seed = 5;
+
+    for(uint32_t tick : ticks) {
+        for(uint8_t i = 0; i < 3; i++) {
+            assert(scheduler.schedule(tick, i, tick & 0x1f, (uint8_t) (tick >> 8)));
+            expected.emplace_back(tick, i, tick & 0x1f, (uint8_t) (tick >> 8));
+        }
+    }
+
+    // random ones, scheduled while the clock runs; a frame of writes for the same tick keeps its order
+    for(clock = 0; clock < 700000; clock++) {
+        if(clock % 5000 == 17 && clock < 550000) {
+            seed = seed * 1103515245 + 12345;
+
+            const uint32_t tick = clock + (seed >> 8) % 100000;
+
+            for(uint8_t reg = 0; reg < 4; reg++) {
+                assert(scheduler.schedule(tick, 5, reg, (uint8_t) clock));
+                expected.emplace_back(tick, 5, reg, (uint8_t) clock);
+            }
+
+            // already due, goes out with this tick
+            assert(scheduler.schedule(clock - 10, 4, 0, 0));
+            expected.emplace_back(clock, 4, 0, 0);
+        }
+
+        scheduler.tick();
+    }
+
+    std::stable_sort(expected.begin(), expected.end(), [](const std::tuple<uint32_t, uint8_t, uint8_t, uint8_t> &a,
+                                                           const std::tuple<uint32_t, uint8_t, uint8_t, uint8_t> &b) {
+        return std::get<0>(a) < std::get<0>(b);
+    });
+
+    assert(writes.size() == expected.size());
+
+    for(size_t i = 0; i < writes.size(); i++) {
+        assert(std::get<0>(writes[i]) == std::get<0>(expected[i]));
+    }
+
+    // same tick, same time: in order
+    for(size_t i = 1; i < writes.size(); i++) {
+        if(std::get<1>(writes[i]) == 5 && std::get<0>(writes[i]) == std::get<0>(writes[i - 1]) && std::get<1>(writes[i - 1]) == 5) {
+            assert(std::get<2>(writes[i]) == std::get<2>(writes[i - 1]) + 1);
+        }
+    }
+
+    assert(scheduler.getAvailable() == 200);
+
+    // a full pool refuses, a full sink delays
+    for(uint8_t i = 0; i < 200; i++) {
+        assert(scheduler.scheduleIn(10, 0, 0, i));
+    }
+
+    assert(!scheduler.scheduleIn(10, 0, 0, 0));
+
+    const uint32_t due = scheduler.getTime() + 10;
+
+    writes.clear();
+    scheduler.getSink().full = true;
+
+    for(; clock <= due + 5; clock++) {
+        scheduler.tick();
+    }
+
+    assert(writes.empty() && scheduler.getAvailable() == 0);
+
+    scheduler.getSink().full = false;
+    scheduler.tick();
+    assert(writes.size() == 200 && std::get<3>(writes[199]) == 199);
+
+    // a retried write does not overwrite a newer one to the same register, due on the next tick or later in the
+    // same one
+    writes.clear();
+    assert(scheduler.scheduleIn(0, 1, 4, 0x10) && scheduler.scheduleIn(1, 1, 4, 0x11));
+    scheduler.getSink().full = true;
+    scheduler.tick();
+    scheduler.getSink().full = false;
+    assert(scheduler.tick() == 2);
+    assert(writes.size() == 2 && std::get<3>(writes[0]) == 0x10 && std::get<3>(writes[1]) == 0x11);
+
+    writes.clear();
+    assert(scheduler.scheduleIn(0, 2, 4, 0x20) && scheduler.scheduleIn(0, 2, 4, 0x21));
+    assert(scheduler.scheduleIn(1, 2, 4, 0x22));
+    scheduler.getSink().rejects = 1;
+    assert(scheduler.tick() == 0 && scheduler.tick() == 3);
+    assert(writes.size() == 3 && std::get<3>(writes[1]) == 0x21 && std::get<3>(writes[2]) == 0x22);
+    assert(scheduler.getAvailable() == 200);
+
+    std::cout << "scheduler: " << expected.size() << " writes released on their tick, passed\n";
+}
+
+// sink accepting writes after rejecting a number of them, like a queue the consumer is just draining
+class RejectingSink {
+public:
+    uint8_t rejects;
+    uint32_t accepted = 0;
+
+    RejectingSink(const uint8_t rejects = 0) : rejects(rejects) {
+    }
+
+    inline bool write(const uint8_t sid, const uint8_t reg, const uint8_t val) {
+        if(rejects) {
+            rejects--;
+
+            return false;
+        }
+
+        accepted++;
+
+        return true;
+    }
+};
+
+// pipeline statistics against a scripted workload on a queue of 7 writes
+void testStats() {
+    typedef SIDArray<2, RingBufferSink<8>> Array;
+    typedef SIDArrayStats<2> Stats;
+
+    const uint8_t modVol = SIDFilterLayout::SIDRegModVol;
+    static Array sidArray;
+    auto &buffer = sidArray.getSink().getBuffer();
+    std::tuple<uint8_t, uint8_t, uint8_t> write;
+
+    auto drain = [&](const uint8_t max) {
+        uint8_t n = 0;
+
+        while(n < max && buffer.pop(write)) {
+            n++;
+        }
+
+        sidArray.drained(n);
+
+        return n;
+    };
+
+    auto total = [](const Stats &stats) {
+        uint32_t n = 0;
+
+        for(uint8_t sid = 0; sid < 2; sid++) {
+            for(uint8_t reg = 0; reg < SIDLayout::NUM_WO_REGS; reg++) {
+                n += stats.writes[sid][reg];
+            }
+        }
+
+        return n;
+    };
+
+    // three writes, drained in one batch, then an empty drain
+    sidArray.getSID(0).getVoice(0).setFQ(0x1234);
+    sidArray.getSID(1).getFilter().setVolume(15);
+    assert(sidArray.flush() == 3);
+    assert(drain(255) == 3 && drain(255) == 0);
+
+    Stats stats = sidArray.stats();
+
+    assert(stats.writes[0][SIDVoiceLayout::SIDRegFQLo] == 1 && stats.writes[0][SIDVoiceLayout::SIDRegFQHi] == 1);
+    assert(stats.writes[1][modVol] == 1 && total(stats) == 3);
+    assert(stats.flushes == 1 && stats.highWatermark == 3 && stats.stalls == 0);
+    assert(stats.drainBatches[0] == 1 && stats.drainBatches[2] == 1);
+
+    // ten registers changed, the queue takes seven, the next flush finds it still full; both stall
+    for(uint8_t v = 0; v < 3; v++) {
+        sidArray.getSID(0).getVoice(v).setPW(0x1230);
+        sidArray.getSID(0).getVoice(v).setAD(0x42);
+    }
+
+    sidArray.getSID(0).getVoice(0).setSR(0xf0);
+
+    assert(sidArray.flush() == 7 && sidArray.flush() == 0);
+    assert(drain(4) == 4 && drain(255) == 3);
+    assert(sidArray.flush() == 3);
+
+    stats = sidArray.stats();
+    assert(total(stats) == 13 && stats.highWatermark == 7 && stats.stalls == 2 && stats.flushes == 4);
+    assert(stats.drainBatches[3] == 1 && stats.drainBatches[2] == 2);
+
+    // a gate edge retriggered within one tick on a full queue is lost
+    sidArray.getSID(1).getVoice(0).setPW(0x1100);
+    sidArray.getSID(1).getVoice(1).setPW(0x1100);
+    assert(sidArray.flush() == 4 && buffer.full());
+
+    sidArray.getSID(1).getVoice(2).setGate(true);
+    sidArray.getSID(1).getVoice(2).setGate(false);
+
+    stats = sidArray.stats();
+    assert(stats.drops == 1 && total(stats) == 17);
+
+    drain(255);
+    sidArray.resetStats();
+    stats = sidArray.stats();
+    assert(total(stats) == 0 && stats.flushes == 0 && stats.highWatermark == 0 && stats.drainBatches[3] == 0);
+
+    // in busy wait mode the edge is retried until the sink takes it
+    static SIDArray<1, RejectingSink> busy(true, 3);
+
+    busy.getSID(0).getVoice(1).setGate(true);
+    busy.getSID(0).getVoice(1).setGate(false);
+
+    const SIDArrayStats<1> busyStats = busy.stats();
+
+    assert(busyStats.spins == 3 && busyStats.writes[0][SIDLayout::NUM_VOICE_REGS + SIDVoiceLayout::SIDRegWvCtl] == 1);
+    assert(busy.getSink().accepted == 1);
+
+    // compiled out, all counters read zero
+    SIDStatsCounters<2, false> disabled;
+
+    disabled.drained(3);
+    disabled.get(stats);
+    assert(!disabled.IS_ENABLED && stats.drainBatches[2] == 0 && stats.spins == 0);
+
+    std::cout << "stats: passed\n";
+}
+
+// every overflow policy of PolicyRingBufferSink with the producer writing much faster than the consumer drains
+void testOverflowPolicies() {
+    typedef PolicyRingBufferSink<16, 2> Sink;
+    typedef std::tuple<uint8_t, uint8_t, uint8_t> Write;
+
+    // writes to 25 registers of 2 chips, n as value
+    auto nth = [](const uint32_t n) {
+        return Write(n % 2, n % SIDLayout::NUM_WO_REGS, (uint8_t) n);
+    };
+
+    auto write = [](Sink &sink, const Write &w) {
+        return sink.write(std::get<0>(w), std::get<1>(w), std::get<2>(w));
+    };
+
+    // popped writes must be a subsequence of the accepted ones, in order
+    auto isSubsequence = [](const std::vector<Write> &popped, const std::vector<Write> &accepted) {
+        size_t i = 0;
+
+        for(const Write &w : accepted) {
+            if(i < popped.size() && popped[i] == w) {
+                i++;
+            }
+        }
+
+        return i == popped.size();
+    };
+
+    Write w;
 
-const void testCallback(const uint8_t sid, const uint8_t reg, const uint8_t val) {
-    std::cout << "sid: " << std::hex << (unsigned int)sid << "reg: " << std::hex << (unsigned int)reg << " val: " << std::hex << (unsigned int)val << "\n";
+    // reject: what fits is kept in order, the rest is turned down
+    {
+        static Sink sink;
+        std::vector<Write> popped;
+
+        for(uint32_t n = 0; n < 20; n++) {
+            assert(write(sink, nth(n)) == (n < 16));
+        }
+
+        while(sink.pop(w)) {
+            popped.push_back(w);
+        }
+
+        assert(popped.size() == 16 && popped[15] == nth(15) && sink.getRejected() == 4);
+    }
+
+    // drop newest turns down what does not fit, drop oldest never turns a write down and keeps the latest writes
+    static Sink dropping[2] = { Sink(OVERFLOW_DROP_NEWEST), Sink(OVERFLOW_DROP_OLDEST) };
+
+    for(Sink &sink : dropping) {
+        std::vector<Write> popped, accepted;
+
+        for(uint32_t n = 0; n < 10000; n++) {
+            if(write(sink, nth(n))) {
+                accepted.push_back(nth(n));
+            } else {
+                assert(sink.getPolicy() == OVERFLOW_DROP_NEWEST);
+            }
+
+            if(n % 4 == 3 && sink.pop(w)) {
+                popped.push_back(w);
+            }
+        }
+
+        std::vector<Write> rest;
+
+        while(sink.pop(w)) {
+            rest.push_back(w);
+        }
+
+        popped.insert(popped.end(), rest.begin(), rest.end());
+
+        assert(isSubsequence(popped, accepted) && sink.getDropped() > 7000 && sink.getRejected() == 0);
+
+        if(sink.getPolicy() == OVERFLOW_DROP_OLDEST) {
+            assert(popped.size() + sink.getDropped() == accepted.size());
+            assert(rest.size() == 15 && rest[0] == nth(10000 - 15) && rest[14] == nth(9999));
+        } else {
+            assert(popped == accepted && accepted.size() + sink.getDropped() == 10000);
+        }
+    }
+
+    // coalescing: modulating all registers at 8 times the drain rate, the last value of every register arrives,
+    // the values of one register arrive in order and every gate edge arrives
+    {
+        static PolicyRingBufferSink<64, 2> sink(OVERFLOW_COALESCE);
+        std::vector<Write> accepted[2][SIDLayout::NUM_WO_REGS], popped[2][SIDLayout::NUM_WO_REGS];
+        uint32_t seed = 13;
+
+        auto pop = [&]() {
+            if(!sink.pop(w)) {
+                return false;
+            }
+
+            popped[std::get<0>(w)][std::get<1>(w)].push_back(w);
+
+            return true;
+        };
+
+        for(uint32_t n = 0; n < 100000; n++) {
+            seed = seed * 1103515245 + 12345;
+
+            const Write m((seed >> 8) % 2, (seed >> 12) % SIDLayout::NUM_WO_REGS, (uint8_t) (seed >> 20));
+
+            if(sink.write(std::get<0>(m), std::get<1>(m), std::get<2>(m))) {
+                accepted[std::get<0>(m)][std::get<1>(m)].push_back(m);
+            }
+
+            if(n % 8 == 7) {
+                pop();
+            }
+        }
+
+        while(pop()) {
+        }
+
+        // gate and test bits of a register's writes with repeats collapsed
+        auto edges = [](const std::vector<Write> &writes) {
+            std::vector<uint8_t> e;
+
+            for(const Write &x : writes) {
+                const uint8_t bits = std::get<2>(x) & (SIDVoiceLayout::SIDCtlGat | SIDVoiceLayout::SIDCtlTst);
+
+                if(e.empty() || e.back() != bits) {
+                    e.push_back(bits);
+                }
+            }
+
+            return e;
+        };
+
+        for(uint8_t sid = 0; sid < 2; sid++) {
+            for(uint8_t reg = 0; reg < SIDLayout::NUM_WO_REGS; reg++) {
+                const std::vector<Write> &a = accepted[sid][reg];
+                const std::vector<Write> &p = popped[sid][reg];
+
+                assert(!a.empty() && p.back() == a.back() && isSubsequence(p, a) && p.size() < a.size());
+
+                if(reg < SIDFilterLayout::SIDRegFCLo && reg % SIDLayout::NUM_VOICE_REGS == SIDVoiceLayout::SIDRegWvCtl) {
+                    assert(edges(p) == edges(a));
+                }
+            }
+        }
+
+        assert(sink.getCoalesced() > 50000 && sink.getDropped() == 0);
+    }
+
+    // blocking: a slow consumer thread gets every write in order; without a consumer the write gives up
+    {
+        static Sink sink(OVERFLOW_BLOCK);
+        const uint32_t count = 100000;
+        std::vector<Write> popped;
+
+        std::thread consumer([&]() {
+            Write x;
+
+            while(popped.size() < count) {
+                if(sink.pop(x)) {
+                    popped.push_back(x);
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+
+        for(uint32_t n = 0; n < count; n++) {
+            assert(write(sink, nth(n)));
+        }
+
+        consumer.join();
+
+        for(uint32_t n = 0; n < count; n++) {
+            assert(popped[n] == nth(n));
+        }
+
+        sink.setPolicy(OVERFLOW_BLOCK, 1000);
+
+        for(uint32_t n = 0; n < 16; n++) {
+            assert(write(sink, nth(n)));
+        }
+
+        assert(!write(sink, nth(16)) && sink.getRejected() == 1);
+    }
+
+    // backpressure: the callback services the queue itself and asks for a retry, until told to stop
+    {
+        struct Bus {
+            Sink sink;
+            std::vector<Write> popped;
+            uint32_t calls = 0;
+            bool stop = false;
+        };
+
+        static Bus bus;
+
+        bus.sink.setPolicy(OVERFLOW_CALLBACK);
+        bus.sink.setBackpressure([](void *context, const uint8_t, const uint8_t, const uint8_t) {
+            Bus &b = *(Bus *) context;
+            Write x;
+
+            b.calls++;
+
+            for(uint8_t i = 0; i < 4 && !b.stop && b.sink.pop(x); i++) {
+                b.popped.push_back(x);
+            }
+
+            return !b.stop;
+        }, &bus);
+
+        for(uint32_t n = 0; n < 1000; n++) {
+            assert(write(bus.sink, nth(n)));
+        }
+
+        while(bus.sink.pop(w)) {
+            bus.popped.push_back(w);
+        }
+
+        assert(bus.popped.size() == 1000 && bus.popped[999] == nth(999) && bus.calls == (1000 - 16 + 3) / 4);
+
+        for(uint32_t n = 0; n < 16; n++) {
+            assert(write(bus.sink, nth(n)));
+        }
+
+        bus.stop = true;
+        assert(!write(bus.sink, nth(16)) && bus.sink.getRejected() == 1);
+    }
+
+    // SIDArray with a sweep on every register of 2 chips per tick and a bus draining 2 writes per tick: the
+    // flush stalls with a plain queue but never with coalescing, and the chips end up with the last values
+    auto sweep = [](auto &sidArray, uint32_t &stalls) {
+        std::vector<Write> bus;
+        Write x;
+
+        for(uint32_t t = 0; t < 10000; t++) {
+            for(uint8_t sid = 0; sid < 2; sid++) {
+                sidArray.getSID(sid).getFilter().setFilterFQ((uint16_t) (t * 37 + sid));
+
+                for(uint8_t v = 0; v < 3; v++) {
+                    sidArray.getSID(sid).getVoice(v).setPW((uint16_t) (t * 53 + v * 7));
+                }
+            }
+
+            sidArray.flush();
+
+            for(uint8_t i = 0; i < 2 && sidArray.getSink().pop(x); i++) {
+                bus.push_back(x);
+            }
+        }
+
+        do {
+            sidArray.flush();
+
+            while(sidArray.getSink().pop(x)) {
+                bus.push_back(x);
+            }
+        } while(sidArray.isDirty());
+
+        uint8_t regs[2][SIDLayout::NUM_WO_REGS] = {};
+
+        for(const Write &b : bus) {
+            regs[std::get<0>(b)][std::get<1>(b)] = std::get<2>(b);
+        }
+
+        for(uint8_t sid = 0; sid < 2; sid++) {
+            assert(memcmp(regs[sid], sidArray.getSID(sid).getRegisters(), SIDLayout::NUM_WO_REGS) == 0);
+        }
+
+        stalls = sidArray.stats().stalls;
+    };
+
+    static SIDArray<2, PolicyRingBufferSink<32, 2>> plain(false, OVERFLOW_REJECT);
+    static SIDArray<2, PolicyRingBufferSink<32, 2>> coalescing(false, OVERFLOW_COALESCE);
+    uint32_t plainStalls, coalescingStalls;
+
+    sweep(plain, plainStalls);
+    sweep(coalescing, coalescingStalls);
+
+    assert(plainStalls > 9000 && coalescingStalls == 0);
+
+    // dropping the oldest writes, the registers they were for are written again
+    static SIDArray<2, PolicyRingBufferSink<32, 2>> evicting(false, OVERFLOW_DROP_OLDEST);
+    uint32_t evictingStalls;
+
+    sweep(evicting, evictingStalls);
+
+    assert(evictingStalls == 0 && evicting.getSink().getDropped() > 9000);
+
+    // the sink the timer ISR drains: blocking against a consumer thread and backpressure lose nothing, drop newest
+    // turns writes down; the chips end up with the last values either way
+    for(const OverflowPolicy policy : { OVERFLOW_BLOCK, OVERFLOW_CALLBACK, OVERFLOW_DROP_NEWEST }) {
+        typedef PriorityRingBufferSink<16, 2> Lanes;
+
+        struct Bus {
+            Lanes sink;
+            uint8_t regs[2][SIDLayout::NUM_WO_REGS] = {};
+            std::atomic<bool> done{false};
+
+            Bus(const OverflowPolicy policy) : sink(policy) {
+            }
+
+            bool pop() {
+                Write x;
+
+                if(!sink.pop(x)) {
+                    return false;
+                }
+
+                for(uint8_t sid = 0; sid < 2; sid++) {
+                    if(std::get<0>(x) & (1 << sid)) {
+                        regs[sid][std::get<1>(x)] = std::get<2>(x);
+                    }
+                }
+
+                return true;
+            }
+        };
+
+        Bus bus(policy);
+        uint8_t last[2][SIDLayout::NUM_WO_REGS] = {};
+        uint32_t seed = 29;
+
+        bus.sink.setBackpressure([](void *context, const uint8_t, const uint8_t, const uint8_t) {
+            return ((Bus *) context)->pop();
+        }, &bus);
+
+        std::thread consumer;
+
+        if(policy == OVERFLOW_BLOCK) {
+            consumer = std::thread([&]() {
+                while(!bus.done) {
+                    if(!bus.pop()) {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+        }
+
+        for(uint32_t n = 0; n < 20000; n++) {
+            seed = seed * 1103515245 + 12345;
+
+            const uint8_t sid = (seed >> 8) % 2;
+            const uint8_t reg = (seed >> 12) % SIDLayout::NUM_WO_REGS;
+            const bool accepted = bus.sink.write(sid, reg, (uint8_t) (seed >> 20));
+
+            assert(accepted || policy == OVERFLOW_DROP_NEWEST);
+
+            if(accepted) {
+                last[sid][reg] = (uint8_t) (seed >> 20);
+            }
+        }
+
+        bus.done = true;
+
+        if(consumer.joinable()) {
+            consumer.join();
+        }
+
+        while(bus.pop()) {
+        }
+
+        assert(memcmp(bus.regs, last, sizeof(last)) == 0 && bus.sink.getRejected() == 0);
+        assert((bus.sink.getDropped() > 10000) == (policy == OVERFLOW_DROP_NEWEST));
+    }
+
+    std::cout << "overflow policies: " << plainStalls << " stalled flushes without coalescing, none with, passed\n";
+}
+
+void testPatch() {
+    static SIDArray<2, CallbackSink> sidArray;
+    SIDPatch patch;
+
+    // set up a sound with the setters and take it as a patch
+    auto &sid = sidArray.getSID(0);
+
+    for(uint8_t v = 0; v < 3; v++) {
+        sid.getVoice(v).setFQ(0x1000 + v);
+        sid.getVoice(v).setWave(v == 0 ? 0x40 : 0x20);
+        sid.getVoice(v).setPW(0x0800 + v);
+        sid.getVoice(v).setADSR(0x29a0 + v);
+    }
+
+    sid.getVoice(1).setRingMod(true);
+    sid.getVoice(0).setGate(true);
+    sid.getFilter().setFilterFQ(0x5a5);
+    sid.getFilter().setFilterRes(12);
+    sid.getFilter().setFilter1(true);
+    sid.getFilter().setFilterMode(0x10);
+    sid.getFilter().setVolume(15);
+
+    capturePatch(sid, patch);
+    patch.lfos[0] = { PATCH_MOD_PW, LFO_TRIANGLE, 2500, 0x4000 };
+    patch.lfos[1] = { PATCH_MOD_CUTOFF, LFO_SAW_DOWN, 60000, -1234 };
+
+    assert(patch.regs[SIDVoiceLayout::SIDRegFQLo] == 0 && !(patch.regs[SIDVoiceLayout::SIDRegWvCtl] & SIDVoiceLayout::SIDCtlGat));
+
+    // round trip
+    uint8_t data[64];
+    SIDPatch decoded;
+
+    assert(PatchFormat::encode(patch, data) == PatchFormat::SIZE && PatchFormat::SIZE == 35);
+    assert(PatchFormat::decode(data, decoded) && memcmp(decoded.regs, patch.regs, SIDLayout::NUM_WO_REGS) == 0);
+
+    for(uint8_t i = 0; i < SIDPatch::NUM_LFOS; i++) {
+        assert(decoded.lfos[i].destination == patch.lfos[i].destination && decoded.lfos[i].shape == patch.lfos[i].shape &&
+               decoded.lfos[i].rate == patch.lfos[i].rate && decoded.lfos[i].depth == patch.lfos[i].depth);
+    }
+
+    // a later version with a longer body is read, a foreign or truncated one is not
+    data[2] = 7;
+    data[3] = PatchFormat::BODY_SIZE + 4;
+    assert(PatchFormat::decode(data, decoded));
+    data[3] = PatchFormat::BODY_SIZE - 1;
+    assert(!PatchFormat::decode(data, decoded));
+    data[3] = PatchFormat::BODY_SIZE;
+    data[0] = 'X';
+    assert(!PatchFormat::decode(data, decoded));
+    data[0] = 'S';
+
+    // an LFO shape or destination this version does not know, e.g. from a later version, is read as none
+    const uint8_t lfo = PatchFormat::HEADER_SIZE + SIDLayout::NUM_VOICES * PatchFormat::VOICE_SIZE +
+                        SIDLayout::NUM_FILTER_REGS;
+
+    assert(PatchFormat::decode(data, decoded) && decoded.lfos[1].shape == LFO_SAW_DOWN);
+    data[lfo + PatchFormat::LFO_SIZE + 1] = LFO_RECTANGLE + 1;
+    data[lfo] = 0xff;
+    assert(PatchFormat::decode(data, decoded) && decoded.lfos[1].shape == LFO_SINE);
+    assert(decoded.lfos[0].destination == PATCH_MOD_NONE && decoded.lfos[0].shape == LFO_TRIANGLE);
+    assert(decoded.lfos[1].destination == PATCH_MOD_CUTOFF && decoded.lfos[1].rate == 60000);
+    data[lfo + PatchFormat::LFO_SIZE + 1] = LFO_SAW_DOWN;
+    data[lfo] = PATCH_MOD_VOLUME;
+    assert(PatchFormat::decode(data, decoded) && decoded.lfos[0].destination == PATCH_MOD_VOLUME);
+
+    // loading onto the other chip, which holds a note: only the differences are written, the note stays
+    std::vector<std::tuple<uint8_t, uint8_t, uint8_t>> writes;
+    SIDPatch other = patch;
+    auto &target = sidArray.getSID(1);
+
+    target.getVoice(2).setFQ(0x2345);
+    target.getVoice(2).setGate(true);
+    sidArray.flush();
+    sidArray.getSink() = CallbackSink([&](const uint8_t sid, const uint8_t reg, const uint8_t val) {
+        writes.emplace_back(sid, reg, val);
+    });
+
+    const uint8_t n = loadPatch(sidArray, patch, 0x02);
+
+    sidArray.flush();
+
+    assert(n == writes.size() && n > 0);
+    assert(target.getVoice(2).getFQ() == 0x2345 && target.getVoice(2).getGate() && !target.getVoice(0).getGate());
+
+    for(uint8_t reg = 0; reg < SIDLayout::NUM_WO_REGS; reg++) {
+        const uint8_t gate = reg == 2 * SIDLayout::NUM_VOICE_REGS + SIDVoiceLayout::SIDRegWvCtl ? SIDVoiceLayout::SIDCtlGat : 0;
+
+        if(SIDPatch::REGS & (1UL << reg)) {
+            assert(target.getRegister(reg) == (patch.regs[reg] | gate));
+        }
+    }
+
+    for(const auto &w : writes) {
+        assert(std::get<0>(w) == 1 && (SIDPatch::REGS & (1UL << std::get<1>(w))));
+    }
+
+    writes.clear();
+    assert(loadPatch(sidArray, patch, 0x02) == 0);
+    sidArray.flush();
+    assert(writes.empty());
+
+    // a program change touching one voice and the cutoff
+    other.regs[SIDVoiceLayout::SIDRegAD] = 0x00;
+    other.regs[SIDFilterLayout::SIDRegFCHi] = 0x10;
+    assert(loadPatch(sidArray, other) == 4);
+    sidArray.flush();
+    assert(writes.size() == 4);
+
+    // file round trip
+    const char *path = "/tmp/arduinosid-test.patch";
+
+    assert(PatchFormat::save(path, patch) && PatchFormat::load(path, decoded));
+    assert(memcmp(decoded.regs, patch.regs, SIDLayout::NUM_WO_REGS) == 0 && decoded.lfos[1].depth == -1234);
+    remove(path);
+
+    // LFO settings
+    LFOEngine<4> lfos(1000);
+
+    loadPatchLFOs(lfos, 2, patch);
+    assert(lfos.getLFO(2).shape == LFO_TRIANGLE && lfos.getLFO(3).depth == -1234 && lfos.getLFO(3).rate > lfos.getLFO(2).rate);
+
+    std::cout << "patch: " << (int) PatchFormat::SIZE << " bytes, " << (int) n << " writes to load, passed\n";
+}
+
+// the offline renderer must mix the same samples as a single SIDEmulator, whatever the number of threads
+void testRenderer() {
+    typedef OfflineRenderer<6, 256, 4> Renderer;
+    static Renderer renderer;
+    static SIDEmulator<6> reference;
+    const uint64_t frames = 30000;
+    std::vector<int16_t> expected(frames);
+    uint64_t frame = 0;
+    uint32_t seed = 3;
+
+    // a note on some voice every few hundred frames, filter sweeps in between; volumes are low enough that no
+    // chip clips on its own
+    for(uint32_t i = 0; frame < frames; i++) {
+        seed = seed * 1103515245 + 12345;
+
+        const uint64_t next = frame + (seed >> 8) % 400;
+        const uint8_t sid = (seed >> 4) % 6;
+        const uint8_t base = (i % 3) * SIDLayout::NUM_VOICE_REGS;
+        const std::tuple<uint8_t, uint8_t, uint8_t> writes[] = {
+            std::make_tuple(sid, base + SIDVoiceLayout::SIDRegFQHi, (uint8_t) (seed >> 16)),
+            std::make_tuple(sid, base + SIDVoiceLayout::SIDRegAD, (uint8_t) (i * 0x13)),
+            std::make_tuple(sid, base + SIDVoiceLayout::SIDRegSR, (uint8_t) (0x80 + i)),
+            std::make_tuple(sid, base + SIDVoiceLayout::SIDRegWvCtl, (uint8_t) ((0x10 << (i & 3)) | (i & 1))),
+            std::make_tuple((uint8_t) (i % 6), SIDFilterLayout::SIDRegFCHi, (uint8_t) (i * 7)),
+            std::make_tuple((uint8_t) (i % 6), SIDFilterLayout::SIDRegResFilt, (uint8_t) (0x31 + i % 4)),
+            std::make_tuple((uint8_t) (i % 6), SIDFilterLayout::SIDRegModVol, (uint8_t) (0x18 + (i & 0x70)))
+        };
+
+        reference.render((size_t) ((next < frames ? next : frames) - frame), expected.data() + frame);
+        frame = next;
+        renderer.setTime(frame);
+
+        for(const auto &w : writes) {
+            reference.write(std::get<0>(w), std::get<1>(w), std::get<2>(w));
+            assert(renderer.write(std::get<0>(w), std::get<1>(w), std::get<2>(w)));
+        }
+    }
+
+    assert(!renderer.write(6, 0, 0));
+
+    for(uint8_t threads = 1; threads <= 6; threads++) {
+        std::vector<int16_t> mixed;
+
+        renderer.render(frames, threads, [&](const int16_t *samples, const size_t n) {
+            mixed.insert(mixed.end(), samples, samples + n);
+        });
+
+        assert(mixed == expected);
+    }
+
+    // the same writes through a trace at one tick per frame, into a WAV file
+    const char *tracePath = "/tmp/arduinosid-test-render.trace";
+    const char *wavPath = "/tmp/arduinosid-test-render.wav";
+
+    {
+        std::ofstream out(tracePath, std::ios::binary);
+        TraceRecorder<Renderer> recorder(out, 44100);
+
+        frame = 0;
+        seed = 3;
+
+        for(uint32_t i = 0; frame < frames; i++) {
+            seed = seed * 1103515245 + 12345;
+            frame += (seed >> 8) % 400;
+            recorder.setTime(frame);
+
+            const uint8_t sid = (seed >> 4) % 6;
+            const uint8_t base = (i % 3) * SIDLayout::NUM_VOICE_REGS;
+
+            recorder.write(sid, base + SIDVoiceLayout::SIDRegFQHi, (uint8_t) (seed >> 16));
+            recorder.write(sid, base + SIDVoiceLayout::SIDRegAD, (uint8_t) (i * 0x13));
+            recorder.write(sid, base + SIDVoiceLayout::SIDRegSR, (uint8_t) (0x80 + i));
+            recorder.write(sid, base + SIDVoiceLayout::SIDRegWvCtl, (uint8_t) ((0x10 << (i & 3)) | (i & 1)));
+            recorder.write(i % 6, SIDFilterLayout::SIDRegFCHi, (uint8_t) (i * 7));
+            recorder.write(i % 6, SIDFilterLayout::SIDRegResFilt, (uint8_t) (0x31 + i % 4));
+            recorder.write(i % 6, SIDFilterLayout::SIDRegModVol, (uint8_t) (0x18 + (i & 0x70)));
+        }
+    }
+
+    static Renderer fromTrace;
+    TraceReplayer replayer(tracePath);
+
+    assert(fromTrace.load(replayer) == renderer.getWrites());
+    assert(fromTrace.renderFile(wavPath, frames, 3));
+
+    std::ifstream wav(wavPath, std::ios::binary);
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(wav)), std::istreambuf_iterator<char>());
+
+    assert(bytes.size() == 44 + frames * 2 && memcmp(bytes.data(), "RIFF", 4) == 0 && memcmp(bytes.data() + 8, "WAVE", 4) == 0);
+    assert((bytes[24] | bytes[25] << 8) == 44100 && (bytes[40] | bytes[41] << 8 | bytes[42] << 16) == frames * 2);
+
+    for(size_t i = 0; i < frames; i++) {
+        assert((int16_t) (bytes[44 + 2 * i] | bytes[45 + 2 * i] << 8) == expected[i]);
+    }
+
+    remove(tracePath);
+    remove(wavPath);
+
+    std::cout << "renderer: " << renderer.getWrites() << " writes on 6 chips, same mix on 1 to 6 threads, passed\n";
+}
+
+void testResampler() {
+    // passband flat, stopband down to what the quality promises, at both clocks
+    for(uint32_t clock : { Frequency::PAL_CLOCK, Frequency::NTSC_CLOCK }) {
+        for(double hz : { 1000.0, 10000.0, 19000.0 }) {
+            assert(fabs(SIDResampler::measureGain(clock, 44100, RESAMPLE_GOOD, hz)) < 0.01);
+        }
+
+        for(double hz : { 24200.0, 30000.0, 60000.0, 200000.0 }) {
+            assert(SIDResampler::measureGain(clock, 44100, RESAMPLE_GOOD, hz) < -85.0);
+            assert(SIDResampler::measureGain(clock, 48000, RESAMPLE_FAST, hz + 4000.0) < -55.0);
+        }
+    }
+
+    assert(ResamplerBank::get(Frequency::PAL_CLOCK, 44100, RESAMPLE_BEST)->taps >
+           ResamplerBank::get(Frequency::PAL_CLOCK, 44100, RESAMPLE_FAST)->taps);
+    assert(ResamplerBank::get(Frequency::PAL_CLOCK, 96000, RESAMPLE_GOOD) == ResamplerBank::get(Frequency::PAL_CLOCK, 96000, RESAMPLE_GOOD));
+
+    // noise at the PAL clock: the output has the right length, feeding it in pieces changes nothing, and all
+    // kernels agree to float precision
+    const size_t n = 200000;
+    std::vector<int16_t> in(n);
+    uint32_t seed = 9;
+
+    for(size_t i = 0; i < n; i++) {
+        seed = seed * 1103515245 + 12345;
+        in[i] = (int16_t) (seed >> 16);
+    }
+
+    std::vector<float> reference;
+
+    for(int k = SID_KERNEL_SCALAR; k <= SID_KERNEL_AVX2; k++) {
+        SIDResampler whole(Frequency::PAL_CLOCK, 48000), pieces(Frequency::PAL_CLOCK, 48000);
+
+        if(!whole.setKernel((SIDKernel) k)) {
+            continue;
+        }
+
+        pieces.setKernel((SIDKernel) k);
+
+        std::vector<float> a(whole.maxOutput(n)), b(whole.maxOutput(n));
+        const size_t written = whole.process(in.data(), n, a.data());
+        size_t piecewise = 0;
+
+        for(size_t i = 0, len = 1; i < n; i += len, len = len * 3 % 10007 + 1) {
+            const size_t take = len < n - i ? len : n - i;
+
+            piecewise += pieces.process(in.data() + i, take, b.data() + piecewise);
+        }
+
+        a.resize(written);
+        b.resize(piecewise);
+
+        assert(written == piecewise && a == b);
+        // the last outputs wait for the input their windows reach into
+        assert(written + (size_t) whole.getLatency() + 2 >= (size_t) ((uint64_t) n * 48000 / Frequency::PAL_CLOCK));
+        assert(written <= whole.maxOutput(n));
+
+        if(reference.empty()) {
+            reference = a;
+        }
+
+        for(size_t i = 0; i < written; i++) {
+            assert(fabs(a[i] - reference[i]) < 0.02f);
+        }
+    }
+
+    // DC comes through at unity gain, as int16
+    SIDResampler dc(Frequency::NTSC_CLOCK, 96000, RESAMPLE_BEST);
+    std::vector<int16_t> ones(20000, 1000), out(dc.maxOutput(20000));
+    const size_t written = dc.process(ones.data(), ones.size(), out.data());
+
+    assert(out[written - 1] == 1000 && (size_t) dc.getLatency() < written);
+
+    std::cout << "resampler: " << ResamplerBank::get(Frequency::PAL_CLOCK, 44100, RESAMPLE_GOOD)->taps
+              << " taps from PAL to 44.1 kHz, passed\n";
+}
+
+void testSmoothing() {
+    typedef SmoothingEngine<6> Engine;
+    static SIDArray<6, CallbackSink> sidArray;
+    static Engine engine;
+    uint32_t writes = 0;
+
+    sidArray.getSink() = CallbackSink([&](const uint8_t, const uint8_t, const uint8_t) {
+        writes++;
+    });
+
+    auto voice = sidArray.getSID(0).getVoice(0);
+
+    assert(Engine::NUM_PARAMS == 42 && engine.getActive() == 0);
+
+    // a jump is written with the next tick only
+    engine.jump(Engine::fqParam(0, 0), 1000);
+    assert(engine.tick(sidArray) == 1 && voice.getFQ() == 1000 && engine.getActive() == 0);
+    assert(engine.tick(sidArray) == 0);
+
+    // linear: 2.5 per tick, monotonic, exactly on the target, one write per changed value
+    uint16_t last = voice.getFQ();
+    uint32_t ticks = 0, written = 0, changes = 0;
+
+    engine.rampLinear(Engine::fqParam(0, 0), 1250, 0x28000);
+
+    while(engine.isActive(Engine::fqParam(0, 0))) {
+        written += engine.tick(sidArray);
+        changes += voice.getFQ() != last;
+        assert(voice.getFQ() >= last);
+        last = voice.getFQ();
+        ticks++;
+    }
+
+    assert(ticks == 100 && voice.getFQ() == 1250 && written == changes && written == 100);
+
+    // exponential: an octave up at 12 cents a tick takes 100 ticks, half way is a tritone up
+    const uint32_t ratio = Engine::centsRatio(12);
+
+    engine.jump(Engine::fqParam(0, 0), 4000);
+    engine.tick(sidArray);
+    engine.rampExponential(Engine::fqParam(0, 0), 8000, ratio);
+
+    for(ticks = 0; engine.isActive(Engine::fqParam(0, 0)); ticks++) {
+        engine.tick(sidArray);
+
+        if(ticks == 49) {
+            assert(fabs(voice.getFQ() - 4000 * sqrt(2.0)) < 4);
+        }
+    }
+
+    assert(ticks >= 99 && ticks <= 101 && voice.getFQ() == 8000);
+
+    // and back down, through the same pitches
+    engine.rampExponential(Engine::fqParam(0, 0), 4000, ratio);
+
+    for(ticks = 0; engine.isActive(Engine::fqParam(0, 0)); ticks++) {
+        engine.tick(sidArray);
+
+        if(ticks == 49) {
+            assert(fabs(voice.getFQ() - 4000 * sqrt(2.0)) < 4);
+        }
+    }
+
+    assert(ticks >= 99 && ticks <= 101 && voice.getFQ() == 4000);
+
+    // a glide down to 0 ends
+    engine.rampExponential(Engine::fqParam(0, 0), 0, Engine::centsRatio(1200));
+
+    for(ticks = 0; engine.isActive(Engine::fqParam(0, 0)); ticks++) {
+        engine.tick(sidArray);
+    }
+
+    assert(ticks <= 13 && voice.getFQ() == 0);
+
+    // the cut-off register holds 11 bits: a quarter of a register step per tick writes every fourth tick
+    auto filter = sidArray.getSID(1).getFilter();
+    const uint8_t cutoff = Engine::cutoffParam(1);
+
+    engine.jump(cutoff, 0);
+    engine.tick(sidArray);
+    engine.rampLinear(cutoff, 100 << 5, 8 << 16);
+
+    for(ticks = 0, written = 0; engine.isActive(cutoff); ticks++) {
+        written += engine.tick(sidArray);
+        assert(filter.getFilterFQ() == (engine.getValue(cutoff) & ~0x1f));
+    }
+
+    assert(ticks == 400 && written == 100 && filter.getFilterFQ() == 100 << 5);
+
+    // retargeting mid-ramp carries on from where it is
+    engine.rampLinear(cutoff, 0, 32 << 16);
+
+    for(ticks = 0; ticks < 10; ticks++) {
+        engine.tick(sidArray);
+    }
+
+    engine.rampLinear(cutoff, 200 << 5, 32 << 16);
+    engine.tick(sidArray);
+    assert(filter.getFilterFQ() == 91 << 5);
+
+    engine.hold(cutoff);
+    assert(engine.tick(sidArray) == 0 && !engine.isActive(cutoff));
+
+    // all 42 parameters at once, everything on the chips reaches its target and then ticks write nothing
+    sidArray.flush();
+    writes = 0;
+    engine.capture(sidArray);
+    engine.tick(sidArray);
+
+    for(uint8_t sid = 0; sid < 6; sid++) {
+        for(uint8_t v = 0; v < 3; v++) {
+            engine.rampExponential(Engine::fqParam(sid, v), 0x1000 + 0x1000 * v + sid, Engine::centsRatio(100));
+            engine.rampLinear(Engine::pwParam(sid, v), 0x8000 + (v << 4), Engine::linearRate(0x8000, 64));
+        }
+
+        engine.rampLinear(Engine::cutoffParam(sid), 0xffe0, Engine::linearRate(0xffe0, 64));
+    }
+
+    assert(engine.getActive() == 42);
+
+    for(ticks = 0; engine.getActive(); ticks++) {
+        assert(engine.tick(sidArray) <= 42);
+        sidArray.flush();
+    }
+
+    assert(engine.tick(sidArray) == 0 && ticks <= 200);
+
+    for(uint8_t sid = 0; sid < 6; sid++) {
+        auto &s = sidArray.getSID(sid);
+
+        for(uint8_t v = 0; v < 3; v++) {
+            assert(s.getVoice(v).getFQ() == 0x1000 + 0x1000 * v + sid && s.getVoice(v).getPW() == 0x8000 + (v << 4));
+        }
+
+        assert(s.getFilter().getFilterFQ() == 0xffe0);
+    }
+
+    std::cout << "smoothing: 42 parameters glided in " << ticks << " ticks with " << writes << " register writes, passed\n";
+}
+
+void testModMatrix() {
+    typedef ModMatrix<2, 8, 4> Matrix;
+    static SIDArray<2, CallbackSink> sidArray;
+    static Matrix matrix;
+    uint32_t writes = 0;
+
+    sidArray.getSink() = CallbackSink([&](const uint8_t, const uint8_t, const uint8_t) {
+        writes++;
+    });
+
+    auto voice = sidArray.getSID(0).getVoice(1);
+    auto filter = sidArray.getSID(1).getFilter();
+    const uint8_t pw = Matrix::pwDest(0, 1);
+    const uint8_t cutoff = Matrix::cutoffDest(1);
+
+    assert(Matrix::NUM_DESTS == 16 && matrix.getSlots() == 0 && matrix.tick(sidArray) == 0);
+
+    // one source to a pulse width around its base
+    matrix.setBase(pw, 0x8000);
+    matrix.setSlot(0, 0, pw, 0x4000);
+    assert(matrix.tick(sidArray) == 1 && voice.getPW() == 0x8000);
+
+    matrix.setSource(0, 32767);
+    assert(matrix.tick(sidArray) == 1 && voice.getPW() == ((0x8000 + 0x3fff) & 0xfff0));
+
+    matrix.setSource(0, -32768);
+    assert(matrix.tick(sidArray) == 1 && voice.getPW() == 0x4000);
+
+    // unchanged sources and changes below a register step write nothing
+    matrix.setSource(0, -32768);
+    assert(matrix.tick(sidArray) == 0);
+    matrix.setSource(0, -32767);
+    assert(matrix.tick(sidArray) == 0 && matrix.getValue(pw) == 0x4000);
+
+    // two sources on one cut-off are summed into one write
+    matrix.setBase(cutoff, 0x4000);
+    matrix.setSlot(1, 1, cutoff, 0x2000);
+    matrix.setSlot(2, 2, cutoff, -0x1000);
+    matrix.tick(sidArray);
+    sidArray.flush();
+    writes = 0;
+
+    matrix.setSource(1, 32767);
+    matrix.setSource(2, 32767);
+    assert(matrix.tick(sidArray) == 1 && filter.getFilterFQ() == ((0x4000 + 0x1fff - 0x1000) & 0xffe0));
+    sidArray.flush();
+    assert(writes <= 2);
+
+    // the sum clamps to the range of the setter
+    matrix.setAmount(1, -0x7fff);
+    assert(matrix.tick(sidArray) == 1 && filter.getFilterFQ() == 0);
+    matrix.setAmount(1, 0x7fff);
+    matrix.setSource(1, 32767);
+    matrix.setBase(cutoff, 0xf000);
+    assert(matrix.tick(sidArray) == 1 && filter.getFilterFQ() == 0xffe0);
+
+    // one source to several destinations, the resonance in the top 4 bits
+    matrix.setBase(Matrix::resDest(1), 0x8000);
+    matrix.setSlot(3, 3, Matrix::resDest(1), 0x7fff);
+    matrix.setSlot(4, 3, Matrix::fqDest(1, 2), 1000);
+    matrix.setSource(3, 32767);
+    assert(matrix.tick(sidArray) == 2 && filter.getFilterRes() == 0xf0 && sidArray.getSID(1).getVoice(2).getFQ() == 999);
+    matrix.setSource(3, -32768);
+    assert(matrix.tick(sidArray) == 2 && filter.getFilterRes() == 0 && sidArray.getSID(1).getVoice(2).getFQ() == 0);
+
+    // replacing and clearing slots takes their contributions out again
+    assert(matrix.getSlots() == 5);
+    matrix.setSlot(0, 1, pw, 0x1000);
+    assert(matrix.tick(sidArray) == 1 && voice.getPW() == 0x8ff0);
+    matrix.clearSlot(0);
+    matrix.clearSlot(1);
+    matrix.clearSlot(2);
+    assert(matrix.tick(sidArray) == 2 && voice.getPW() == 0x8000 && filter.getFilterFQ() == 0xf000);
+    assert(matrix.getSlots() == 2);
+
+    // LFOs as sources
+    LFOEngine<2> lfos(1000);
+
+    lfos.setRate(0, 5000);
+    lfos.setShape(1, LFO_SAW_UP);
+    lfos.setRate(1, 1000);
+    matrix.setSlot(0, 0, pw, 0x4000);
+    matrix.setSlot(1, 1, Matrix::pwDest(1, 0), 0x4000);
+    matrix.setBase(Matrix::pwDest(1, 0), 0x8000);
+
+    for(uint16_t t = 0; t < 1000; t++) {
+        lfos.tick();
+        matrix.setSources(lfos);
+        matrix.tick(sidArray);
+
+        assert(voice.getPW() == ((0x8000 + (lfos.getValue(0) * 0x4000 >> 15)) & 0xfff0));
+        assert(sidArray.getSID(1).getVoice(0).getPW() == ((0x8000 + (lfos.getValue(1) * 0x4000 >> 15)) & 0xfff0));
+    }
+
+    std::cout << "mod matrix: passed\n";
 }
 
 int main() {
-    SIDArray sidArray(true);
+    testSPSCRingBuffer();
+    testFootprint();
+    testSnapshot();
+    testEmulator();
+    testEmulatorKernels();
+    testFilter();
+    testTrace();
+    testLFO();
+    testFrequencyTables();
+    testVoiceAllocator();
+    testMIDIParser();
+    testBus();
+    testMulticast();
+    testGateOrder();
+    testPriorityLanes();
+    testScheduler();
+    testStats();
+    testOverflowPolicies();
+    testPatch();
+    testRenderer();
+    testResampler();
+    testSmoothing();
+    testModMatrix();
+
+    SIDArray<6, RingBufferSink<registerQueueSize(6)>> sidArray(true);
 
 //    for(uint8_t i = 0; i < SID_ARRAY_MAX_NUM_SIDS; i++) {
 //        SID& sid = sidArray.getSID(i);
@@ -18,18 +2393,48 @@ int main() {
 //        sid.getFilter().setRegisterWriteCallback(testCallback);
 //    }
 
-    for(uint8_t i = 0; i < SIDArray::MAX_NUM_SIDS; i++) {
-        SID& sid = sidArray.getSID(i);
+    for(uint8_t i = 0; i < sidArray.NUM_SIDS; i++) {
+        auto& sid = sidArray.getSID(i);
 
         sid.getFilter().setVolume(15);
         sid.getVoice(1).setAttack(12);
         sid.getVoice(0).setFQ(12000);
+        sid.getVoice(2).setFQ(8000);
+        sid.getVoice(2).setAttack(9);
         sid.getVoice(2).setTriangle(true);
         sid.getVoice(2).setGate(true);
         sid.getVoice(2).setGate(false);
     }
 
+    sidArray.flush();
+
+    // drain the register write queue like the timer ISR would
+    std::tuple<uint8_t, uint8_t, uint8_t> write;
+
+    while(sidArray.getSink().getBuffer().pop(write)) {
+        testCallback(std::get<0>(write), std::get<1>(write), std::get<2>(write));
+    }
+
+    // repeated writes between two ticks are coalesced into a single one
     for(uint8_t i = 0; i < 255; i++) {
-        sidArray.getSID(0).getFilter().setVolume(0);
+        sidArray.getSID(0).getFilter().setVolume(i & 0x0f);
     }
+
+    sidArray.getSID(0).getFilter().setVolume(0);
+
+    assert(sidArray.flush() == 1);
+    assert(sidArray.getSink().getBuffer().pop(write) && std::get<2>(write) == 0);
+
+    // writes which end up with the value already on the chip are dropped
+    sidArray.getSID(1).getVoice(0).setFQ(12345);
+    sidArray.getSID(1).getVoice(0).setFQ(12000);
+
+    assert(sidArray.flush() == 0);
+
+    // a gate edge is not lost even if it is reverted within the same tick
+    sidArray.getSID(2).getVoice(2).setGate(true);
+    sidArray.getSID(2).getVoice(2).setGate(false);
+
+    assert(sidArray.flush() == 1);
+    assert(sidArray.getSink().getBuffer().size() == 2);
 }
\ No newline at end of file
@@ -0,0 +1,320 @@
+#pragma once
+
+#ifndef ARDUINOSID_TRACE_H
+#define ARDUINOSID_TRACE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <chrono>
+#include <ostream>
+#include <thread>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sid.h"
+
+// host side recording and replay of timestamped register write streams
+//
+// A trace is a 12 byte header followed by one record per register write:
+//
+//   header:  "SIDT", uint16 version, uint16 reserved, uint32 ticks per second, all little endian
+//   record:  varint ticks since the previous record, (sid << 5 | reg), val
+//
+// The varint stores 7 bits per byte, least significant group first, with the high bit set on all but the
+// last byte. Writes flushed in the same tick therefore take 3 bytes each. What a tick is is up to the
+// recording side, e.g. phi2 cycles or timer ISR ticks; the header only records how many there are per second
+// so the replayer can reproduce the original timing.
+
+class TraceFormat {
+public:
+    static constexpr char MAGIC[4] = { 'S', 'I', 'D', 'T' };
+    static const uint16_t VERSION = 1;
+    static const size_t HEADER_SIZE = 12;
+
+    // longest record, a 64 bit delta takes up to 10 varint bytes
+    static const size_t MAX_RECORD_SIZE = 12;
+
+    static inline uint8_t packAddress(const uint8_t sid, const uint8_t reg) {
+        return (uint8_t) (sid << 5 | reg);
+    }
+
+    static inline uint8_t unpackSID(const uint8_t address) {
+        return address >> 5;
+    }
+
+    static inline uint8_t unpackRegister(const uint8_t address) {
+        return address & 0x1f;
+    }
+
+    static size_t writeHeader(uint8_t *buffer, const uint32_t tickRate) {
+        memcpy(buffer, MAGIC, 4);
+        buffer[4] = VERSION & 0xff;
+        buffer[5] = VERSION >> 8;
+        buffer[6] = 0;
+        buffer[7] = 0;
+
+        for(uint8_t i = 0; i < 4; i++) {
+            buffer[8 + i] = (uint8_t) (tickRate >> (i * 8));
+        }
+
+        return HEADER_SIZE;
+    }
+
+    static inline size_t writeRecord(uint8_t *buffer, uint64_t delta, const uint8_t sid, const uint8_t reg,
+                                     const uint8_t val) {
+        size_t n = 0;
+
+        while(delta >= 0x80) {
+            buffer[n++] = (uint8_t) (delta | 0x80);
+            delta >>= 7;
+        }
+
+        buffer[n++] = (uint8_t) delta;
+        buffer[n++] = packAddress(sid, reg);
+        buffer[n++] = val;
+
+        return n;
+    }
+};
+
+// register sink that records every write with the current tick and forwards it to another sink
+//
+// The owner advances the time with tick() or setTime(), e.g. from the same loop that calls SIDArray::flush().
+// Records are buffered and written to the stream when the buffer fills up, on flushTrace() and on destruction.
+
+template <typename Sink>
+class TraceRecorder {
+private:
+    static const size_t BUFFER_SIZE = 4096;
+
+    Sink sink;
+    std::ostream &out;
+    uint64_t now = 0;
+    uint64_t last = 0;
+    size_t records = 0;
+    size_t used = 0;
+    uint8_t buffer[BUFFER_SIZE];
+
+public:
+    template <typename... SinkArgs>
+    TraceRecorder(std::ostream &out, const uint32_t tickRate, SinkArgs&&... sinkArgs)
+        : sink(std::forward<SinkArgs>(sinkArgs)...), out(out) {
+        used = TraceFormat::writeHeader(buffer, tickRate);
+    }
+
+    ~TraceRecorder() {
+        flushTrace();
+    }
+
+    TraceRecorder(const TraceRecorder&) = delete;
+
+    // only writes the sink takes are recorded, a rejected one is retried by the SIDArray and recorded then
+    inline bool write(const uint8_t sid, const uint8_t reg, const uint8_t val) {
+        if(!sink.write(sid, reg, val)) {
+            return false;
+        }
+
+        if(used > BUFFER_SIZE - TraceFormat::MAX_RECORD_SIZE) {
+            flushTrace();
+        }
+
+        used += TraceFormat::writeRecord(buffer + used, now - last, sid, reg, val);
+        last = now;
+        records++;
+
+        return true;
+    }
+
+    void flushTrace() {
+        out.write((const char *) buffer, used);
+        out.flush();
+        used = 0;
+    }
+
+    inline void tick(const uint64_t ticks = 1) {
+        now += ticks;
+    }
+
+    // time never runs backwards in a trace, earlier times are recorded as a delta of 0
+    inline void setTime(const uint64_t ticks) {
+        now = ticks < last ? last : ticks;
+    }
+
+    uint64_t getTime() const {
+        return now;
+    }
+
+    size_t getRecords() const {
+        return records;
+    }
+
+    Sink &getSink() {
+        return sink;
+    }
+};
+
+// decodes a trace held in memory
+
+class TraceReader {
+private:
+    const uint8_t *data = nullptr;
+    size_t length = 0;
+    size_t pos = 0;
+    uint32_t tickRate = 0;
+    uint64_t time = 0;
+
+public:
+    // returns false if the data does not start with a valid header
+    bool open(const uint8_t *trace, const size_t size) {
+        data = nullptr;
+        length = 0;
+
+        if(size < TraceFormat::HEADER_SIZE || memcmp(trace, TraceFormat::MAGIC, 4) != 0 ||
+           (trace[4] | trace[5] << 8) != TraceFormat::VERSION) {
+            return false;
+        }
+
+        data = trace;
+        length = size;
+        tickRate = (uint32_t) trace[8] | (uint32_t) trace[9] << 8 | (uint32_t) trace[10] << 16 | (uint32_t) trace[11] << 24;
+        rewind();
+
+        return true;
+    }
+
+    void rewind() {
+        pos = TraceFormat::HEADER_SIZE;
+        time = 0;
+    }
+
+    // decodes the next record, returns false at the end of the trace or on a truncated record
+    inline bool next(uint64_t &ticks, uint8_t &sid, uint8_t &reg, uint8_t &val) {
+        uint64_t delta = 0;
+        uint8_t shift = 0;
+
+        while(pos < length && (data[pos] & 0x80) && shift < 63) {
+            delta |= (uint64_t) (data[pos++] & 0x7f) << shift;
+            shift += 7;
+        }
+
+        if(pos + 3 > length) {
+            pos = length;
+
+            return false;
+        }
+
+        delta |= (uint64_t) data[pos++] << shift;
+        sid = TraceFormat::unpackSID(data[pos]);
+        reg = TraceFormat::unpackRegister(data[pos++]);
+        val = data[pos++];
+
+        time += delta;
+        ticks = time;
+
+        return true;
+    }
+
+    uint32_t getTickRate() const {
+        return tickRate;
+    }
+
+    bool isOpen() const {
+        return data != nullptr;
+    }
+};
+
+// memory maps a trace file and feeds it into a register sink
+
+class TraceReplayer : public TraceReader {
+private:
+    void *map = MAP_FAILED;
+    size_t mapSize = 0;
+
+public:
+    TraceReplayer() = default;
+
+    TraceReplayer(const char *path) {
+        open(path);
+    }
+
+    ~TraceReplayer() {
+        close();
+    }
+
+    TraceReplayer(const TraceReplayer&) = delete;
+
+    using TraceReader::open;
+
+    // returns false if the file cannot be mapped or is not a trace
+    bool open(const char *path) {
+        close();
+
+        int fd = ::open(path, O_RDONLY);
+
+        if(fd < 0) {
+            return false;
+        }
+
+        struct stat st;
+
+        if(fstat(fd, &st) == 0 && st.st_size > 0) {
+            mapSize = (size_t) st.st_size;
+            map = mmap(nullptr, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+
+        ::close(fd);
+
+        if(map == MAP_FAILED) {
+            mapSize = 0;
+
+            return false;
+        }
+
+        madvise(map, mapSize, MADV_SEQUENTIAL);
+
+        return open((const uint8_t *) map, mapSize);
+    }
+
+    void close() {
+        if(map != MAP_FAILED) {
+            munmap(map, mapSize);
+        }
+
+        map = MAP_FAILED;
+        mapSize = 0;
+        TraceReader::open(nullptr, 0);
+    }
+
+    // replays the whole trace, either as fast as possible or at the recorded timing; returns the number of
+    // writes the sink accepted
+    template <typename Sink>
+    size_t replay(Sink &sink, const bool realTime = false) {
+        using Clock = std::chrono::steady_clock;
+
+        const Clock::time_point start = Clock::now();
+        const uint32_t rate = getTickRate();
+        size_t accepted = 0;
+        uint64_t ticks;
+        uint8_t sid, reg, val;
+
+        rewind();
+
+        while(next(ticks, sid, reg, val)) {
+            if(realTime && rate) {
+                std::this_thread::sleep_until(start + std::chrono::nanoseconds(
+                    (int64_t) (ticks / rate * 1000000000ull + ticks % rate * 1000000000ull / rate)));
+            }
+
+            accepted += sink.write(sid, reg, val);
+        }
+
+        return accepted;
+    }
+};
+
+#endif // ARDUINOSID_TRACE_H
@@ -0,0 +1,284 @@
+#pragma once
+
+#ifndef ARDUINOSID_VOICES_H
+#define ARDUINOSID_VOICES_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include "sid.h"
+
+// polyphonic voice allocation over all voices of a SIDArray
+//
+// Voices are numbered sid * 3 + voice. Each voice is a node of intrusive doubly linked lists held in index
+// arrays, there is no allocation after construction:
+//
+// - sounding voices are in a global LRU list and in an LRU list of their chip, oldest first
+// - released voices are in a free list of their chip, in the order they were released, so a voice which was
+//   released long ago and has probably finished its release is reused first
+//
+// With a chip hint, a free voice of that chip is used if there is one, so voices which share a filter are kept
+// together; stealing also prefers the hinted chip. All operations touch a fixed number of nodes, except the
+// quietest steal policy which compares the envelopes of all sounding voices.
+
+enum VoiceStealPolicy : uint8_t {
+    // steal the voice which was started first
+    STEAL_OLDEST,
+
+    // steal the voice with the lowest envelope level
+    STEAL_QUIETEST,
+
+    // retrigger the voice which last played the same note, even if it is releasing, otherwise steal the oldest
+    STEAL_SAME_NOTE
+};
+
+// envelope source for STEAL_QUIETEST, e.g. SIDEmulator; without one all voices are equally loud and the oldest
+// is stolen
+class NoEnvelopes {
+public:
+    inline uint8_t getEnvelope(const uint8_t, const uint8_t) {
+        return 0;
+    }
+};
+
+template <uint8_t NUM_SIDS, typename Envelopes = NoEnvelopes>
+class VoiceAllocator {
+public:
+    static const uint8_t NUM_VOICES = NUM_SIDS * SIDLayout::NUM_VOICES;
+    static const uint8_t NONE = 0xff;
+    static const uint8_t NUM_NOTES = 128;
+
+    static_assert(NUM_VOICES < NONE, "too many voices");
+
+private:
+    struct Voice {
+        // global LRU list of sounding voices
+        uint8_t prev;
+        uint8_t next;
+
+        // LRU list of sounding voices or free list, of the chip
+        uint8_t chipPrev;
+        uint8_t chipNext;
+
+        uint8_t note;
+        bool sounding;
+    };
+
+    struct List {
+        uint8_t head = NONE;
+        uint8_t tail = NONE;
+    };
+
+    Voice voices[NUM_VOICES];
+    List lru;
+    List chipLRU[NUM_SIDS];
+    List chipFree[NUM_SIDS];
+
+    // voice which last played a note, or NONE
+    uint8_t noteVoice[NUM_NOTES];
+
+    VoiceStealPolicy policy;
+    Envelopes *envelopes;
+
+    // where to start looking for a free voice without a hint, so voices are spread over the chips
+    uint8_t nextChip = 0;
+
+    template <uint8_t Voice::*Prev, uint8_t Voice::*Next>
+    inline void append(List &list, const uint8_t v) {
+        voices[v].*Prev = list.tail;
+        voices[v].*Next = NONE;
+
+        if(list.tail != NONE) {
+            voices[list.tail].*Next = v;
+        } else {
+            list.head = v;
+        }
+
+        list.tail = v;
+    }
+
+    template <uint8_t Voice::*Prev, uint8_t Voice::*Next>
+    inline void unlink(List &list, const uint8_t v) {
+        const uint8_t prev = voices[v].*Prev;
+        const uint8_t next = voices[v].*Next;
+
+        if(prev != NONE) {
+            voices[prev].*Next = next;
+        } else {
+            list.head = next;
+        }
+
+        if(next != NONE) {
+            voices[next].*Prev = prev;
+        } else {
+            list.tail = prev;
+        }
+    }
+
+    // take a voice out of whichever lists it is in
+    void take(const uint8_t v) {
+        const uint8_t chip = v / SIDLayout::NUM_VOICES;
+
+        if(voices[v].sounding) {
+            unlink<&Voice::prev, &Voice::next>(lru, v);
+            unlink<&Voice::chipPrev, &Voice::chipNext>(chipLRU[chip], v);
+        } else {
+            unlink<&Voice::chipPrev, &Voice::chipNext>(chipFree[chip], v);
+        }
+
+        if(noteVoice[voices[v].note] == v) {
+            noteVoice[voices[v].note] = NONE;
+        }
+    }
+
+    uint8_t findFree(const uint8_t hint) {
+        if(hint < NUM_SIDS && chipFree[hint].head != NONE) {
+            return chipFree[hint].head;
+        }
+
+        for(uint8_t i = 0; i < NUM_SIDS; i++) {
+            const uint8_t chip = (nextChip + i) % NUM_SIDS;
+
+            if(chipFree[chip].head != NONE) {
+                nextChip = (chip + 1) % NUM_SIDS;
+
+                return chipFree[chip].head;
+            }
+        }
+
+        return NONE;
+    }
+
+    uint8_t findVictim(const uint8_t hint) {
+        const List &list = hint < NUM_SIDS && chipLRU[hint].head != NONE ? chipLRU[hint] : lru;
+
+        if(policy != STEAL_QUIETEST || !envelopes) {
+            return list.head;
+        }
+
+        // ties go to the older voice
+        uint8_t victim = NONE;
+        uint8_t level = 0xff;
+        const bool chipList = &list != &lru;
+
+        for(uint8_t v = list.head; v != NONE; v = chipList ? voices[v].chipNext : voices[v].next) {
+            const uint8_t env = envelopes->getEnvelope(v / SIDLayout::NUM_VOICES, v % SIDLayout::NUM_VOICES);
+
+            if(victim == NONE || env < level) {
+                victim = v;
+                level = env;
+            }
+        }
+
+        return victim;
+    }
+
+public:
+    VoiceAllocator(const VoiceStealPolicy policy = STEAL_OLDEST, Envelopes *envelopes = nullptr)
+        : policy(policy), envelopes(envelopes) {
+        reset();
+    }
+
+    // release all voices
+    void reset() {
+        lru = List();
+
+        for(uint8_t chip = 0; chip < NUM_SIDS; chip++) {
+            chipLRU[chip] = List();
+            chipFree[chip] = List();
+        }
+
+        for(uint8_t v = 0; v < NUM_VOICES; v++) {
+            voices[v].note = 0;
+            voices[v].sounding = false;
+            voices[v].prev = voices[v].next = NONE;
+            append<&Voice::chipPrev, &Voice::chipNext>(chipFree[v / SIDLayout::NUM_VOICES], v);
+        }
+
+        for(uint8_t note = 0; note < NUM_NOTES; note++) {
+            noteVoice[note] = NONE;
+        }
+
+        nextChip = 0;
+    }
+
+    void setPolicy(const VoiceStealPolicy p) {
+        policy = p;
+    }
+
+    // assign a voice to a note, preferably on the given chip; returns the voice, which the caller sets up and
+    // gates, and whether it was taken from a sounding note
+    uint8_t noteOn(const uint8_t note, const uint8_t chipHint = NONE, bool *stolen = nullptr) {
+        uint8_t v = noteVoice[note & 0x7f];
+
+        // a note still held is always retriggered on its voice, one which is releasing only for STEAL_SAME_NOTE
+        if(v == NONE || (!voices[v].sounding && policy != STEAL_SAME_NOTE)) {
+            v = findFree(chipHint);
+        }
+
+        if(v == NONE) {
+            v = findVictim(chipHint);
+        }
+
+        if(stolen) {
+            *stolen = voices[v].sounding && voices[v].note != (note & 0x7f);
+        }
+
+        take(v);
+
+        voices[v].note = note & 0x7f;
+        voices[v].sounding = true;
+        noteVoice[note & 0x7f] = v;
+
+        append<&Voice::prev, &Voice::next>(lru, v);
+        append<&Voice::chipPrev, &Voice::chipNext>(chipLRU[v / SIDLayout::NUM_VOICES], v);
+
+        return v;
+    }
+
+    // release the voice playing a note; returns the voice, which the caller ungates, or NONE if the note is
+    // not sounding any more, e.g. because its voice was stolen
+    uint8_t noteOff(const uint8_t note) {
+        const uint8_t v = noteVoice[note & 0x7f];
+
+        if(v == NONE || !voices[v].sounding) {
+            return NONE;
+        }
+
+        const uint8_t chip = v / SIDLayout::NUM_VOICES;
+
+        unlink<&Voice::prev, &Voice::next>(lru, v);
+        unlink<&Voice::chipPrev, &Voice::chipNext>(chipLRU[chip], v);
+        voices[v].sounding = false;
+
+        // stays assigned to the note until reused, for STEAL_SAME_NOTE
+        append<&Voice::chipPrev, &Voice::chipNext>(chipFree[chip], v);
+
+        return v;
+    }
+
+    bool isSounding(const uint8_t v) const {
+        return voices[v].sounding;
+    }
+
+    uint8_t getNote(const uint8_t v) const {
+        return voices[v].note;
+    }
+
+    // voice playing a note or NONE
+    uint8_t getVoice(const uint8_t note) const {
+        const uint8_t v = noteVoice[note & 0x7f];
+
+        return v != NONE && voices[v].sounding ? v : NONE;
+    }
+
+    static inline uint8_t getSIDNo(const uint8_t v) {
+        return v / SIDLayout::NUM_VOICES;
+    }
+
+    static inline uint8_t getVoiceNo(const uint8_t v) {
+        return v % SIDLayout::NUM_VOICES;
+    }
+};
+
+#endif // ARDUINOSID_VOICES_H